@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdlib>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -60,12 +61,18 @@ struct Container {
  */
 void init();
 
+/**
+ * Keeps the connections to the docker socket alive between requests, see: docker.cpp
+ */
+class ConnectionPool;
+
 class DockerAPI {
 private:
   std::string socket_path; // TODO: add B64 registry_auth
+  std::shared_ptr<ConnectionPool> connections; // Shared between copies, safe to use from multiple threads
 
 public:
-  inline explicit DockerAPI(std::string socket_path = "/var/run/docker.sock") : socket_path(std::move(socket_path)) {}
+  explicit DockerAPI(std::string socket_path = "/var/run/docker.sock");
 
   /**
    * Get a list of all containers
@@ -115,6 +122,22 @@ public:
    */
   bool stop_by_id(std::string_view id, int timeout_seconds = 2) const;
 
+  /**
+   * Renames the container
+   *
+   * https://docs.docker.com/engine/api/v1.40/#tag/Container/operation/ContainerRename
+   * @param force_if_present: if another container with the same name is already present it will be removed
+   */
+  bool rename_by_id(std::string_view id, std::string_view new_name, bool force_if_present = true) const;
+
+  /**
+   * Blocks until the container is not running anymore; this is a long-poll request, no polling involved.
+   *
+   * https://docs.docker.com/engine/api/v1.40/#tag/Container/operation/ContainerWait
+   * @return the exit code of the container, an empty optional if the request failed
+   */
+  std::optional<int> wait_by_id(std::string_view id) const;
+
   /**
    * Removes the container
    *
@@ -136,7 +159,15 @@ public:
    */
   bool pull_image(std::string_view image_name, std::string_view registry_auth = {}) const;
 
-  bool exec(std::string_view id, const std::vector<std::string_view> &command, std::string_view user = "root") const;
+  /**
+   * Runs a command in a running container
+   *
+   * @param detach: when true, returns as soon as the command has been started without waiting for it to complete
+   */
+  bool exec(std::string_view id,
+            const std::vector<std::string_view> &command,
+            std::string_view user = "root",
+            bool detach = false) const;
 
   /**
    * Get the container logs
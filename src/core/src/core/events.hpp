@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <eventbus/event_bus.hpp>
+#include <functional>
+#include <immer/atom.hpp>
+#include <immer/map.hpp>
+#include <memory>
+#include <type_traits>
+#include <typeindex>
+#include <utility>
+
+namespace wolf::core::events {
+
+/**
+ * A handle to a registered event handler, call unregister() in order to stop receiving events.
+ * Works for both global handlers (see: dp::handler_registration) and session handlers.
+ */
+class handler_registration {
+public:
+  explicit handler_registration(std::function<void()> on_unregister) : on_unregister(std::move(on_unregister)) {}
+
+  explicit handler_registration(dp::handler_registration &&global_registration) {
+    auto reg = std::make_shared<dp::handler_registration>(std::move(global_registration));
+    on_unregister = [reg]() { reg->unregister(); };
+  }
+
+  void unregister() const {
+    if (on_unregister) {
+      on_unregister();
+    }
+  }
+
+private:
+  std::function<void()> on_unregister;
+};
+
+template <typename T, typename = void> struct has_session_id : std::false_type {};
+
+/**
+ * True for events (always wrapped in an immer::box) that expose a `session_id` field
+ */
+template <typename T>
+struct has_session_id<T, std::void_t<decltype(std::declval<const T &>()->session_id)>> : std::true_type {};
+
+/**
+ * An event bus that on top of the global handlers of dp::event_bus supports handlers that are scoped to a single
+ * session. When an event that carries a `session_id` is fired, it'll be delivered straight to the handlers registered
+ * for that session without going through the handlers of all the other running sessions.
+ *
+ * Session handlers are stored in an immutable map, firing an event doesn't take any lock.
+ */
+class EventBus : public dp::event_bus {
+public:
+  /**
+   * Register a handler that will only be called for events of type EventType where `ev->session_id == session_id`
+   */
+  template <typename EventType, typename EventHandler>
+  handler_registration register_session_handler(std::size_t session_id, EventHandler &&handler) {
+    static_assert(has_session_id<EventType>::value, "Session handlers require an event with a session_id field");
+    auto handler_id = next_handler_id.fetch_add(1, std::memory_order_relaxed);
+    session_handler_fn fn = [handler = std::forward<EventHandler>(handler)](const void *ev) {
+      handler(*static_cast<const EventType *>(ev));
+    };
+    auto type = std::type_index(typeid(EventType));
+
+    session_handlers.update([&](const auto &by_type) {
+      auto by_session = by_type.find(type) ? by_type.at(type) : sessions_map{};
+      auto handlers = by_session.find(session_id) ? by_session.at(session_id) : handlers_map{};
+      return by_type.set(type, by_session.set(session_id, handlers.set(handler_id, fn)));
+    });
+
+    return handler_registration([this, type, session_id, handler_id]() {
+      this->remove_session_handler(type, session_id, handler_id);
+    });
+  }
+
+  /**
+   * Fires the event to all the global handlers and, if the event has a session_id, to the handlers registered for
+   * that session.
+   */
+  template <typename EventType> void fire_event(EventType &&ev) {
+    using event_t = std::decay_t<EventType>;
+    if constexpr (has_session_id<event_t>::value) {
+      fire_session_event<event_t>(ev->session_id, ev);
+    }
+    dp::event_bus::fire_event(std::forward<EventType>(ev));
+  }
+
+private:
+  using session_handler_fn = std::function<void(const void *)>;
+  using handlers_map = immer::map<std::size_t /* handler_id */, session_handler_fn>;
+  using sessions_map = immer::map<std::size_t /* session_id */, handlers_map>;
+
+  template <typename EventType> void fire_session_event(std::size_t session_id, const EventType &ev) {
+    auto by_type = session_handlers.load();
+    if (auto by_session = by_type->find(std::type_index(typeid(EventType)))) {
+      if (auto handlers = by_session->find(session_id)) {
+        for (const auto &[handler_id, handler] : *handlers) {
+          handler(&ev);
+        }
+      }
+    }
+  }
+
+  void remove_session_handler(std::type_index type, std::size_t session_id, std::size_t handler_id) {
+    session_handlers.update([&](const auto &by_type) {
+      auto by_session = by_type.find(type);
+      if (!by_session || !by_session->find(session_id)) {
+        return by_type;
+      }
+      auto handlers = by_session->at(session_id).erase(handler_id);
+      auto new_by_session = handlers.empty() ? by_session->erase(session_id) : by_session->set(session_id, handlers);
+      return new_by_session.empty() ? by_type.erase(type) : by_type.set(type, new_by_session);
+    });
+  }
+
+  immer::atom<immer::map<std::type_index, sessions_map>> session_handlers;
+  std::atomic<std::size_t> next_handler_id{0};
+};
+
+} // namespace wolf::core::events
@@ -1,10 +1,17 @@
 #pragma once
 
-#include <eventbus/event_bus.hpp>
+#include <array>
+#include <core/events.hpp>
+#include <cstring>
+#include <functional>
 #include <gst/gst.h>
 #include <helpers/logger.hpp>
 #include <immer/array.hpp>
 #include <immer/box.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace wolf::core::gstreamer {
 
@@ -31,7 +38,7 @@ static void pipeline_eos_handler(GstBus *bus, GstMessage *message, gpointer data
 }
 
 static bool run_pipeline(const std::string &pipeline_desc,
-                         const std::function<immer::array<immer::box<dp::handler_registration>>(
+                         const std::function<immer::array<immer::box<events::handler_registration>>(
                              gst_element_ptr /* pipeline */, gst_main_loop_ptr /* main_loop */)> &on_pipeline_ready) {
   GError *error = nullptr;
   gst_element_ptr pipeline(gst_parse_launch(pipeline_desc.c_str(), &error), [](const auto &pipeline) {
@@ -50,18 +57,18 @@ static bool run_pipeline(const std::string &pipeline_desc,
   }
 
   /*
-   * create a mainloop that runs/iterates the default GLib main context
-   * (context NULL), in other words: makes the context check if anything
-   * it watches for has happened. When a message has been posted on the
-   * bus, the default main context will automatically call our
-   * my_bus_callback() function to notify us of that message.
+   * Each pipeline gets its own GLib main context, pushed as the thread default for the calling thread:
+   * the bus watch (and any source that the caller attaches to the context of the loop) will only be dispatched
+   * by this loop, so that sessions running in parallel don't end up dispatching (or waiting on) each other's sources.
    */
-  gst_main_loop_ptr loop(g_main_loop_new(nullptr, FALSE), ::g_main_loop_unref);
+  std::shared_ptr<GMainContext> context(g_main_context_new(), ::g_main_context_unref);
+  g_main_context_push_thread_default(context.get());
+  gst_main_loop_ptr loop(g_main_loop_new(context.get(), FALSE), ::g_main_loop_unref);
 
   /*
    * adds a watch for new message on our pipeline's message bus to
-   * the default GLib main context, which is the main context that our
-   * GLib main loop is attached to below
+   * the thread default GLib main context, which is the main context that our
+   * GLib main loop is attached to
    */
   auto bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline.get()));
   gst_bus_add_signal_watch(bus);
@@ -90,6 +97,11 @@ static bool run_pipeline(const std::string &pipeline_desc,
     handler->unregister();
   }
 
+  bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline.get()));
+  gst_bus_remove_signal_watch(bus);
+  gst_object_unref(bus);
+  g_main_context_pop_thread_default(context.get());
+
   return true;
 }
 
@@ -100,4 +112,205 @@ static void send_message(GstElement *recipient, GstStructure *message) {
   auto gst_ev = gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, message);
   gst_element_send_event(recipient, gst_ev);
 }
+
+/**
+ * Calls fn on each element of the pipeline, recursing into sub-bins
+ */
+static void for_each_element(GstElement *pipeline, const std::function<void(GstElement *)> &fn) {
+  auto it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+  GValue item = G_VALUE_INIT;
+  while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+    fn(GST_ELEMENT(g_value_get_object(&item)));
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(it);
+}
+
+/**
+ * @return true if the element has been created by the factory with the given name (ex: "udpsink")
+ */
+static bool is_factory(GstElement *element, std::string_view factory_name) {
+  auto factory = gst_element_get_factory(element);
+  return factory && factory_name == GST_OBJECT_NAME(factory);
+}
+
+/**
+ * udpsink keeps its socket bound to `bind-port` until it goes back to the NULL state; Linux delivers unicast UDP to the
+ * most recently bound of the sockets that share a port, so a PAUSED pipeline would get the packets meant for any other
+ * listener on the same port (ex: the RTP PING sent by the client on resume, see: rtp::PingListener).
+ *
+ * Sets the udpsink elements at the top level of the pipeline to NULL, closing their sockets, and locks their state so
+ * that the pipeline doesn't bring them back up. See: restore_udp_sinks()
+ */
+static void release_udp_sinks(GstElement *pipeline) {
+  for_each_element(pipeline, [&](GstElement *element) {
+    if (is_factory(element, "udpsink") && GST_OBJECT_PARENT(element) == GST_OBJECT(pipeline)) {
+      gst_element_set_locked_state(element, TRUE);
+      gst_element_set_state(element, GST_STATE_NULL);
+    }
+  });
+}
+
+/**
+ * Points the udpsink elements at the top level of the pipeline to the given client and unlocks their state, they'll
+ * bind their sockets again when the pipeline is set to PLAYING.
+ * Spectators (see: streaming::attach_spectator()) live in their own sub-bin and are left untouched.
+ */
+static void restore_udp_sinks(GstElement *pipeline, const std::string &client_ip, unsigned short client_port) {
+  for_each_element(pipeline, [&](GstElement *element) {
+    if (is_factory(element, "udpsink") && GST_OBJECT_PARENT(element) == GST_OBJECT(pipeline)) {
+      logs::log(logs::debug, "[GSTREAMER] Updating {} to {}:{}", GST_ELEMENT_NAME(element), client_ip, client_port);
+      g_object_set(element, "host", client_ip.c_str(), "port", static_cast<gint>(client_port), NULL);
+      gst_element_set_locked_state(element, FALSE);
+    }
+  });
+}
+
+/**
+ * Parses the pipeline once, without starting it, in order to surface syntax errors and missing elements early.
+ * This will also resolve and load the factories of all the elements (this is where GStreamer loads the plugins), so
+ * that the first session that uses them doesn't have to wait for it.
+ *
+ * @return the error message if the pipeline can't be created
+ */
+static std::optional<std::string> preload_pipeline(const std::string &pipeline_desc) {
+  GError *error = nullptr;
+  auto parse_ctx = gst_parse_context_new();
+  auto pipeline = gst_parse_launch_full(pipeline_desc.c_str(), parse_ctx, GST_PARSE_FLAG_FATAL_ERRORS, &error);
+
+  std::optional<std::string> result;
+  if (error) {
+    result = error->message;
+    if (auto missing = gst_parse_context_get_missing_elements(parse_ctx)) {
+      std::vector<std::string> missing_elements(missing, missing + g_strv_length(missing));
+      result = fmt::format("{}, missing elements: {}", *result, fmt::join(missing_elements, ", "));
+      g_strfreev(missing);
+    }
+    g_error_free(error);
+  }
+  gst_parse_context_free(parse_ctx);
+
+  if (pipeline) {
+    gst_object_unref(pipeline);
+  }
+  return result;
+}
+
+static constexpr std::array<const char *, 3> VIDEO_BITRATE_PROPS = {"bitrate", "max-bitrate", "target-bitrate"};
+static constexpr auto VIDEO_BITRATE_PROP_KEY = "wolf-bitrate-prop";
+
+static bool is_video_encoder(GstElement *element) {
+  auto factory = gst_element_get_factory(element);
+  auto klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : nullptr;
+  return klass && std::strstr(klass, "Encoder") && std::strstr(klass, "Video");
+}
+
+/**
+ * Encoders don't agree on the name of the bitrate property and VBR capable encoders have more than one of them
+ * (ex: target and max bitrate); only the one that the pipeline has been configured with should be changed.
+ *
+ * Remembers, for each video encoder in the pipeline, the property that is currently set to configured_kbps
+ * (the `{bitrate}` of the app template) so that set_video_bitrate() will only change that one.
+ */
+static void track_video_bitrate(GstElement *pipeline, int configured_kbps) {
+  for_each_element(pipeline, [&](GstElement *element) {
+    if (!is_video_encoder(element)) {
+      return;
+    }
+    for (const auto &prop : VIDEO_BITRATE_PROPS) {
+      if (auto spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), prop)) {
+        GValue value = G_VALUE_INIT, converted = G_VALUE_INIT;
+        g_value_init(&value, spec->value_type);
+        g_value_init(&converted, G_TYPE_INT64);
+        g_object_get_property(G_OBJECT(element), prop, &value);
+        bool matches = g_value_transform(&value, &converted) && g_value_get_int64(&converted) == configured_kbps;
+        g_value_unset(&value);
+        g_value_unset(&converted);
+        if (matches) {
+          g_object_set_data(G_OBJECT(element), VIDEO_BITRATE_PROP_KEY, const_cast<char *>(prop));
+          return;
+        }
+      }
+    }
+  });
+}
+
+/**
+ * Changes the bitrate (in kbit/sec) of all the video encoders in the pipeline.
+ * Only the property found by track_video_bitrate() is changed, when that's not available we fall back to the first
+ * known bitrate property of the encoder.
+ *
+ * @return the number of encoders that have been updated
+ */
+static int set_video_bitrate(GstElement *pipeline, int bitrate_kbps) {
+  int updated = 0;
+  for_each_element(pipeline, [&](GstElement *element) {
+    if (!is_video_encoder(element)) {
+      return;
+    }
+
+    auto prop = static_cast<const char *>(g_object_get_data(G_OBJECT(element), VIDEO_BITRATE_PROP_KEY));
+    for (auto it = VIDEO_BITRATE_PROPS.begin(); !prop && it != VIDEO_BITRATE_PROPS.end(); it++) {
+      if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), *it)) {
+        prop = *it;
+      }
+    }
+
+    bool found = false;
+    if (auto spec = prop ? g_object_class_find_property(G_OBJECT_GET_CLASS(element), prop) : nullptr) {
+      GValue value = G_VALUE_INIT, converted = G_VALUE_INIT;
+      g_value_init(&value, G_TYPE_INT);
+      g_value_set_int(&value, bitrate_kbps);
+      g_value_init(&converted, spec->value_type);
+      if (g_value_transform(&value, &converted)) {
+        g_object_set_property(G_OBJECT(element), prop, &converted);
+        found = true;
+      }
+      g_value_unset(&value);
+      g_value_unset(&converted);
+    }
+
+    if (found) {
+      WOLF_LOG(logs::debug, "[GSTREAMER] Set {} {} to {}kbps", GST_ELEMENT_NAME(element), prop, bitrate_kbps);
+      updated++;
+    } else {
+      logs::log(logs::warning, "[GSTREAMER] Unable to change bitrate, unknown encoder {}", GST_ELEMENT_NAME(element));
+    }
+  });
+  return updated;
+}
+
+/**
+ * Changes the width, height and framerate of all the video capsfilters in the pipeline (ex:
+ * `video/x-raw, width={width}, height={height}`), downstream elements will renegotiate on the next buffer.
+ *
+ * @return the number of capsfilters that have been updated
+ */
+static int set_video_resolution(GstElement *pipeline, int width, int height, int fps) {
+  int updated = 0;
+  for_each_element(pipeline, [&](GstElement *element) {
+    if (!is_factory(element, "capsfilter")) {
+      return;
+    }
+
+    GstCaps *caps = nullptr;
+    g_object_get(element, "caps", &caps, NULL);
+    if (caps && !gst_caps_is_any(caps) && gst_caps_get_size(caps) > 0 &&
+        gst_structure_has_field(gst_caps_get_structure(caps, 0), "width")) {
+      auto new_caps = gst_caps_copy(caps);
+      gst_caps_set_simple(new_caps, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+      if (gst_structure_has_field(gst_caps_get_structure(caps, 0), "framerate")) {
+        gst_caps_set_simple(new_caps, "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+      }
+      g_object_set(element, "caps", new_caps, NULL);
+      gst_caps_unref(new_caps);
+      updated++;
+    }
+    if (caps) {
+      gst_caps_unref(caps);
+    }
+  });
+  return updated;
+}
 } // namespace wolf::core::gstreamer
\ No newline at end of file
@@ -2,10 +2,14 @@
 #include <curl/curl.h>
 #include <docker/formatters.hpp>
 #include <docker/json_formatters.hpp>
+#include <functional>
 #include <helpers/logger.hpp>
 #include <helpers/utils.hpp>
+#include <memory>
+#include <mutex>
 #include <range/v3/view.hpp>
 #include <string_view>
+#include <vector>
 
 namespace wolf::core::docker {
 using namespace ranges;
@@ -25,18 +29,100 @@ void init() {
 using curl_ptr = std::unique_ptr<CURL, decltype(&curl_easy_cleanup)>;
 
 /**
- * Initialise the curl handle and connects it to the docker socket
+ * A curl handle to the docker socket together with the buffers used to parse its responses.
+ * Curl will keep the underlying connection open between requests made with the same handle.
  */
-std::optional<curl_ptr> docker_connect(const std::string &socket_path, bool debug = false) {
-  if (auto curl = curl_easy_init()) {
-    curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, socket_path.c_str()); // TODO: support also tcp://
-    if (debug)
-      curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-    return curl_ptr(curl, ::curl_easy_cleanup);
-  } else {
-    return {};
+class Connection {
+public:
+  explicit Connection(curl_ptr handle) : handle(std::move(handle)) {}
+
+  [[nodiscard]] CURL *get() const {
+    return handle.get();
   }
-}
+
+  /**
+   * Same as utils::parse_json() but without allocating for each message,
+   * the returned value is only valid until the connection goes back to the pool.
+   */
+  json::value parse_json(std::string_view msg) {
+    json::error_code ec;
+    parser.reset(&json_resource);
+    parser.write(msg.data(), msg.size(), ec);
+    if (ec) {
+      logs::log(logs::error, "Error while parsing JSON: {} \n {}", ec.message(), msg);
+      return json::object(); // Returning an empty object should allow us to continue most of the times
+    }
+    return parser.release();
+  }
+
+  /**
+   * Frees up the memory used by all the values returned by parse_json()
+   */
+  void release_json() {
+    parser.reset();
+    json_resource.release();
+  }
+
+private:
+  curl_ptr handle;
+  unsigned char json_buffer[4096];
+  json::monotonic_resource json_resource{json_buffer, sizeof(json_buffer)};
+  json::parser parser;
+};
+
+class ConnectionPool {
+public:
+  using lease = std::unique_ptr<Connection, std::function<void(Connection *)>>;
+
+  explicit ConnectionPool(std::string socket_path, std::size_t max_idle = 4)
+      : socket_path(std::move(socket_path)), max_idle(max_idle) {}
+
+  /**
+   * @return an idle connection (or a new one when there are none), it'll go back to the pool once the lease is gone;
+   *         nullptr if curl fails to initialise
+   */
+  lease acquire() {
+    std::unique_ptr<Connection> conn;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!idle.empty()) {
+        conn = std::move(idle.back());
+        idle.pop_back();
+      }
+    }
+    if (!conn) {
+      if (auto curl = curl_easy_init()) {
+        conn = std::make_unique<Connection>(curl_ptr(curl, ::curl_easy_cleanup));
+      } else {
+        return {nullptr, [](Connection *) {}};
+      }
+    }
+
+    // Clears all the options of the previous request, open connections are kept
+    curl_easy_reset(conn->get());
+    curl_easy_setopt(conn->get(), CURLOPT_UNIX_SOCKET_PATH, socket_path.c_str()); // TODO: support also tcp://
+    return {conn.release(), [this](Connection *conn) { this->release(conn); }};
+  }
+
+private:
+  void release(Connection *conn) {
+    conn->release_json();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (idle.size() < max_idle) {
+      idle.emplace_back(conn);
+    } else {
+      delete conn;
+    }
+  }
+
+  std::string socket_path;
+  std::size_t max_idle;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Connection>> idle;
+};
+
+DockerAPI::DockerAPI(std::string socket_path)
+    : socket_path(socket_path), connections(std::make_shared<ConnectionPool>(std::move(socket_path))) {}
 
 /**
  * Perform a HTTP request using curl
@@ -47,7 +133,7 @@ req(CURL *handle,
     std::string_view target,
     std::string_view post_body = {},
     const std::vector<std::string> &header_params = {}) {
-  logs::log(logs::trace, "[CURL] Sending [{}] -> {}", (int)method, target);
+  WOLF_LOG(logs::trace, "[CURL] Sending [{}] -> {}", (int)method, target);
   curl_easy_setopt(handle, CURLOPT_URL, target.data());
 
   /* Set method */
@@ -71,7 +157,7 @@ req(CURL *handle,
 
   /* Pass POST params (if present) */
   if (method == POST && !post_body.empty()) {
-    logs::log(logs::trace, "[CURL] POST: {}", post_body);
+    WOLF_LOG(logs::trace, "[CURL] POST: {}", post_body);
 
     curl_easy_setopt(handle, CURLOPT_POST, 1L);
     headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
@@ -100,17 +186,17 @@ req(CURL *handle,
   } else {
     long response_code;
     curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
-    logs::log(logs::trace, "[CURL] Received {} - {}", response_code, read_buf);
+    WOLF_LOG(logs::trace, "[CURL] Received {} - {}", response_code, read_buf);
     return {{response_code, read_buf}};
   }
 }
 
 std::optional<Container> DockerAPI::get_by_id(std::string_view id) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto url = fmt::format("http://localhost/{}/containers/{}/json", DOCKER_API_VERSION, id);
-    auto raw_msg = req(conn.value().get(), GET, url);
+    auto raw_msg = req(conn->get(), GET, url);
     if (raw_msg && raw_msg->first == 200) {
-      auto json = parse_json(raw_msg->second);
+      auto json = conn->parse_json(raw_msg->second);
       return json::value_to<Container>(json);
     } else if (raw_msg) {
       logs::log(logs::warning, "[CURL] error {} - {}", raw_msg->first, raw_msg->second);
@@ -121,11 +207,11 @@ std::optional<Container> DockerAPI::get_by_id(std::string_view id) const {
 }
 
 std::vector<Container> DockerAPI::get_containers(bool all) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto url = fmt::format("http://localhost/{}/containers/json{}", DOCKER_API_VERSION, all ? "?all=true" : "");
-    auto raw_msg = req(conn.value().get(), GET, url);
+    auto raw_msg = req(conn->get(), GET, url);
     if (raw_msg && raw_msg->first == 200) {
-      auto json = parse_json(raw_msg->second);
+      auto json = conn->parse_json(raw_msg->second);
       auto containers = json::value_to<std::vector<json::value>>(json);
       return containers                                                            //
              | ranges::views::transform([this](const json::value &container) {     //
@@ -155,7 +241,7 @@ std::optional<Container> DockerAPI::create(const Container &container,
                                            std::string_view custom_params,
                                            std::string_view registry_auth,
                                            bool force_recreate_if_present) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto url = fmt::format("http://localhost/{}/containers/create?name={}", DOCKER_API_VERSION, container.name);
     // See: https://stackoverflow.com/a/39149767 and https://github.com/moby/moby/issues/3039
     auto exposed_ports = json::object();
@@ -163,7 +249,7 @@ std::optional<Container> DockerAPI::create(const Container &container,
       exposed_ports[fmt::format("{}/{}", port.public_port, port.type == docker::TCP ? "tcp" : "udp")] = json::object();
     }
 
-    auto post_params = parse_json(custom_params).as_object();
+    auto post_params = conn->parse_json(custom_params).as_object();
     post_params["Image"] = container.image;
     merge_array(&post_params, "Env", json::value_from(container.env).as_array());
 
@@ -178,9 +264,9 @@ std::optional<Container> DockerAPI::create(const Container &container,
     }
 
     auto json_payload = json::serialize(post_params);
-    auto raw_msg = req(conn.value().get(), POST, url, json_payload);
+    auto raw_msg = req(conn->get(), POST, url, json_payload);
     if (raw_msg && raw_msg->first == 201) {
-      auto json = parse_json(raw_msg->second);
+      auto json = conn->parse_json(raw_msg->second);
       auto created_id = json.at("Id").as_string();
       return get_by_id(std::string_view{created_id.data(), created_id.size()});
     } else if (raw_msg && raw_msg->first == 404) { // 404 returned when the image is not present
@@ -205,9 +291,9 @@ std::optional<Container> DockerAPI::create(const Container &container,
 }
 
 bool DockerAPI::start_by_id(std::string_view id) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto raw_msg =
-        req(conn.value().get(), POST, fmt::format("http://localhost/{}/containers/{}/start", DOCKER_API_VERSION, id));
+        req(conn->get(), POST, fmt::format("http://localhost/{}/containers/{}/start", DOCKER_API_VERSION, id));
     if (raw_msg && (raw_msg->first == 204 || raw_msg->first == 304)) {
       return true;
     } else if (raw_msg) {
@@ -219,9 +305,9 @@ bool DockerAPI::start_by_id(std::string_view id) const {
 }
 
 bool DockerAPI::stop_by_id(std::string_view id, int timeout_seconds) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto raw_msg = req(
-        conn.value().get(),
+        conn->get(),
         POST,
         fmt::format("http://localhost/{}/containers/{}/stop?t={}", DOCKER_API_VERSION, id, timeout_seconds));
     if (raw_msg && (raw_msg->first == 204 || raw_msg->first == 304)) {
@@ -234,15 +320,52 @@ bool DockerAPI::stop_by_id(std::string_view id, int timeout_seconds) const {
   return false;
 }
 
+bool DockerAPI::rename_by_id(std::string_view id, std::string_view new_name, bool force_if_present) const {
+  if (auto conn = connections->acquire()) {
+    auto api_url = fmt::format("http://localhost/{}/containers/{}/rename?name={}", DOCKER_API_VERSION, id, new_name);
+    auto raw_msg = req(conn->get(), POST, api_url);
+    if (raw_msg && raw_msg->first == 204) {
+      return true;
+    } else if (raw_msg && force_if_present && raw_msg->first == 409) { // 409 returned when the name is already in use
+      logs::log(logs::warning, "[DOCKER] Container {} already present, removing first", new_name);
+      if (remove_by_name(new_name, true, true, false)) {
+        return rename_by_id(id, new_name, false);
+      }
+    } else if (raw_msg) {
+      logs::log(logs::warning, "[DOCKER] error {} - {}", raw_msg->first, raw_msg->second);
+    }
+  }
+
+  return false;
+}
+
+std::optional<int> DockerAPI::wait_by_id(std::string_view id) const {
+  if (auto conn = connections->acquire()) {
+    auto api_url =
+        fmt::format("http://localhost/{}/containers/{}/wait?condition=not-running", DOCKER_API_VERSION, id);
+    auto raw_msg = req(conn->get(), POST, api_url);
+    if (raw_msg && raw_msg->first == 200) {
+      auto json = conn->parse_json(raw_msg->second);
+      if (auto status_code = json.as_object().if_contains("StatusCode")) {
+        return static_cast<int>(status_code->as_int64());
+      }
+    } else if (raw_msg) {
+      logs::log(logs::warning, "[DOCKER] error {} - {}", raw_msg->first, raw_msg->second);
+    }
+  }
+
+  return {};
+}
+
 bool DockerAPI::remove_by_id(std::string_view id, bool remove_volumes, bool force, bool link) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto api_url = fmt::format("http://localhost/{}/containers/{}?v={}&force={}&link={}",
                                DOCKER_API_VERSION,
                                id,
                                remove_volumes,
                                force,
                                link);
-    auto raw_msg = req(conn.value().get(), DELETE, api_url);
+    auto raw_msg = req(conn->get(), DELETE, api_url);
     if (raw_msg && raw_msg->first == 204) {
       return true;
     } else if (raw_msg) {
@@ -268,13 +391,13 @@ bool DockerAPI::remove_by_name(std::string_view name, bool remove_volumes, bool
 }
 
 bool DockerAPI::pull_image(std::string_view image_name, std::string_view registry_auth) const {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto api_url = fmt::format("http://localhost/{}/images/create?fromImage={}", DOCKER_API_VERSION, image_name);
     std::vector<std::string> headers = {};
     if (!registry_auth.empty()) {
       headers.push_back(fmt::format("X-Registry-Auth: {}", registry_auth));
     }
-    auto raw_msg = req(conn.value().get(), POST, api_url, {}, headers);
+    auto raw_msg = req(conn->get(), POST, api_url, {}, headers);
     if (raw_msg && raw_msg->first == 200) {
       return true;
     } else if (raw_msg) {
@@ -290,7 +413,7 @@ bool DockerAPI::pull_image(std::string_view image_name, std::string_view registr
 
 std::string
 DockerAPI::get_logs(std::string_view id, bool get_stdout, bool get_stderr, int since, int until, bool timestamps) {
-  if (auto conn = docker_connect(socket_path)) {
+  if (auto conn = connections->acquire()) {
     auto api_url = fmt::format(
         "http://localhost/{}/containers/{}/logs?stdout={}&stderr={}&since={}&until={}&timestamps={}&follow=false",
         DOCKER_API_VERSION,
@@ -300,7 +423,7 @@ DockerAPI::get_logs(std::string_view id, bool get_stdout, bool get_stderr, int s
         since,
         until,
         timestamps);
-    auto raw_msg = req(conn.value().get(), GET, api_url);
+    auto raw_msg = req(conn->get(), GET, api_url);
     if (raw_msg && raw_msg->first == 200) {
       return raw_msg->second; // TODO: erase first 8 bytes from each line, see Stream format in the API docs
     } else if (raw_msg) {
@@ -311,33 +434,38 @@ DockerAPI::get_logs(std::string_view id, bool get_stdout, bool get_stderr, int s
   return "";
 }
 
-bool DockerAPI::exec(std::string_view id, const std::vector<std::string_view> &command, std::string_view user) const {
-  if (auto conn = docker_connect(socket_path)) {
+bool DockerAPI::exec(std::string_view id,
+                     const std::vector<std::string_view> &command,
+                     std::string_view user,
+                     bool detach) const {
+  if (auto conn = connections->acquire()) {
     auto api_url = fmt::format("http://localhost/{}/containers/{}/exec", DOCKER_API_VERSION, id);
     auto post_params = json::object{
         {"Cmd", command},
         {"User", user},
         {"AttachStdin", false},
-        {"AttachStdout", true},
-        {"AttachStderr", true},
+        {"AttachStdout", !detach},
+        {"AttachStderr", !detach},
     };
     auto json_payload = json::serialize(post_params);
-    auto raw_msg = req(conn.value().get(), POST, api_url, json_payload);
+    auto raw_msg = req(conn->get(), POST, api_url, json_payload);
     if (raw_msg && raw_msg->first == 201) {
       // Exec request created, start it
-      auto json = parse_json(raw_msg->second);
+      auto json = conn->parse_json(raw_msg->second);
       std::string exec_id = json.at("Id").as_string().data();
       api_url = fmt::format("http://localhost/{}/exec/{}/start", DOCKER_API_VERSION, exec_id);
-      post_params = json::object{{"Detach", false}, {"Tty", false}};
+      post_params = json::object{{"Detach", detach}, {"Tty", false}};
       json_payload = json::serialize(post_params);
-      raw_msg = req(conn.value().get(), POST, api_url, json_payload);
-      if (raw_msg && raw_msg->first == 200) {
+      raw_msg = req(conn->get(), POST, api_url, json_payload);
+      if (raw_msg && raw_msg->first == 200 && detach) {
+        return true;
+      } else if (raw_msg && raw_msg->first == 200) {
         auto console = raw_msg->second;
         // Exec request completed, inspect the results
         api_url = fmt::format("http://localhost/{}/exec/{}/json", DOCKER_API_VERSION, exec_id);
-        raw_msg = req(conn.value().get(), GET, api_url);
+        raw_msg = req(conn->get(), GET, api_url);
         if (raw_msg && raw_msg->first == 200) {
-          json = parse_json(raw_msg->second);
+          json = conn->parse_json(raw_msg->second);
           auto exit_code = json.at("ExitCode").as_int64();
           if (exit_code != 0) {
             logs::log(logs::warning, "Docker exec failed ({}), {}", exit_code, console);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <helpers/logger.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed pool of threads running a shared boost::asio::io_context.
+ *
+ * Short lived work (callbacks, timeouts, sockets) should be scheduled here instead of spawning a new thread;
+ * nothing posted here should block for long, otherwise it'll starve the other tasks.
+ */
+class Executor {
+public:
+  explicit Executor(std::size_t n_threads = std::max(2u, std::thread::hardware_concurrency()))
+      : work(boost::asio::make_work_guard(io)) {
+    threads.reserve(n_threads);
+    for (std::size_t i = 0; i < n_threads; i++) {
+      threads.emplace_back([this]() {
+        while (!io.stopped()) {
+          try {
+            io.run();
+          } catch (const std::exception &e) {
+            logs::log(logs::error, "[EXECUTOR] Uncaught exception in task: {}", e.what());
+          }
+        }
+      });
+    }
+    logs::log(logs::debug, "[EXECUTOR] Started {} threads", n_threads);
+  }
+
+  ~Executor() {
+    work.reset();
+    io.stop();
+    for (auto &thread : threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  boost::asio::io_context &io_context() {
+    return io;
+  }
+
+  /**
+   * Runs fn on one of the executor threads, as soon as possible
+   */
+  template <typename F> void post(F &&fn) {
+    boost::asio::post(io, std::forward<F>(fn));
+  }
+
+  /**
+   * Runs fn after the given delay, unless the returned timer is cancelled before that.
+   * fn will be called with a boost::system::error_code, set to operation_aborted if the timer has been cancelled.
+   */
+  template <typename F>
+  std::shared_ptr<boost::asio::steady_timer> run_after(std::chrono::steady_clock::duration delay, F &&fn) {
+    auto timer = std::make_shared<boost::asio::steady_timer>(io, delay);
+    timer->async_wait([timer, fn = std::forward<F>(fn)](const boost::system::error_code &ec) { fn(ec); });
+    return timer;
+  }
+
+private:
+  boost::asio::io_context io;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+  std::vector<std::thread> threads;
+};
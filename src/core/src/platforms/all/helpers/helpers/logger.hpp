@@ -20,14 +20,50 @@
 #include <boost/log/utility/exception_handler.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/console.hpp>
+#include <algorithm>
+#include <atomic>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <helpers/ring_buffer.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Compile time minimum log level, anything below this will be completely removed from the binary.
+ * Values follow boost::log::trivial::severity_level: 0 = trace, 1 = debug, 2 = info, ...
+ */
+#ifndef WOLF_LOG_COMPILE_MIN_LEVEL
+#define WOLF_LOG_COMPILE_MIN_LEVEL 0
+#endif
 
 namespace logs {
 
 using namespace boost::log::trivial;
 namespace src = boost::log::sources;
 
+/**
+ * The runtime minimum log level, set by init()
+ */
+inline std::atomic<int> runtime_min_level{trace};
+
+/**
+ * @return true if lvl is above the compile time threshold, can be used in `if constexpr`
+ */
+constexpr bool compiled_in(severity_level lvl) {
+  return static_cast<int>(lvl) >= WOLF_LOG_COMPILE_MIN_LEVEL;
+}
+
+/**
+ * @return true if a message with the given level will be reported
+ */
+inline bool is_enabled(severity_level lvl) {
+  return compiled_in(lvl) && static_cast<int>(lvl) >= runtime_min_level.load(std::memory_order_relaxed);
+}
+
 inline auto get_color(boost::log::trivial::severity_level level) {
   switch (level) {
   case debug:
@@ -70,16 +106,184 @@ inline auto get_name(boost::log::trivial::severity_level level) {
   }
 }
 
+inline std::string
+format_line(severity_level lvl, std::chrono::system_clock::time_point time, std::string_view msg, bool colors = true) {
+  return fmt::format("{}{:%T} {:<5} | {}{}",
+                     colors ? get_color(lvl) : "",
+                     time.time_since_epoch(),
+                     get_name(lvl),
+                     msg,
+                     colors ? "\033[0m" : "");
+}
+
+struct log_record {
+  severity_level lvl;
+  std::chrono::system_clock::time_point time;
+  std::string msg;
+};
+
+/**
+ * An asynchronous log backend: every thread that logs gets its own bounded lock-free ring buffer,
+ * a single writer thread drains all of them and writes to the output stream.
+ *
+ * Producers never block: when their ring buffer is full the message is dropped and counted,
+ * the writer thread will periodically report how many messages have been lost.
+ */
+class async_writer {
+public:
+  static constexpr std::size_t RING_SIZE = 1024;
+  using ring_t = SPSCRingBuffer<log_record, RING_SIZE>;
+
+  explicit async_writer(std::ostream &out) : out(out) {
+    writer_thread = std::thread([this]() { this->run(); });
+  }
+
+  /**
+   * Stops the writer thread once everything that has been pushed so far has been written
+   */
+  ~async_writer() {
+    stopping.store(true);
+    cv.notify_one();
+    writer_thread.join();
+  }
+
+  async_writer(const async_writer &) = delete;
+  async_writer &operator=(const async_writer &) = delete;
+
+  /**
+   * Pushes the record into the calling thread ring buffer, never blocks
+   */
+  void push(log_record &&record) {
+    // A new writer might get the address of a destroyed one, the ids are never reused
+    thread_local std::uint64_t ring_owner = 0;
+    thread_local std::shared_ptr<ring_t> ring;
+    if (ring_owner != id) {
+      ring = register_thread();
+      ring_owner = id;
+    }
+    if (ring->push(std::move(record))) {
+      queued.fetch_add(1, std::memory_order_relaxed);
+      if (!has_pending.exchange(true, std::memory_order_acq_rel)) {
+        cv.notify_one();
+      }
+    } else {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Blocks until all the messages queued so far have been written to the output stream (or the timeout expires)
+   */
+  void flush(std::chrono::milliseconds timeout = std::chrono::milliseconds(500)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto target = queued.load(std::memory_order_relaxed);
+    has_pending.store(true);
+    cv.notify_one();
+    while (written.load(std::memory_order_acquire) < target && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  [[nodiscard]] std::uint64_t dropped_messages() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::shared_ptr<ring_t> register_thread() {
+    auto ring = std::make_shared<ring_t>();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(ring);
+    return ring;
+  }
+
+  void run() {
+    std::uint64_t reported_drops = 0;
+    while (!stopping.load()) {
+      {
+        std::unique_lock<std::mutex> lock(rings_mutex);
+        // Producers might notify without holding the lock, the timeout makes sure we don't miss a wakeup
+        cv.wait_for(lock, std::chrono::milliseconds(50), [this]() { return has_pending.load() || stopping.load(); });
+        has_pending.store(false);
+
+        // Rings of threads that have exited can be released once they have been fully drained
+        rings.erase(std::remove_if(rings.begin(),
+                                   rings.end(),
+                                   [](const auto &ring) { return ring.use_count() == 1 && ring->empty(); }),
+                    rings.end());
+      }
+      drain(reported_drops);
+    }
+    // Whatever has been pushed before stopping
+    drain(reported_drops);
+  }
+
+  void drain(std::uint64_t &reported_drops) {
+    std::vector<std::shared_ptr<ring_t>> current_rings;
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex);
+      current_rings = rings;
+    }
+
+    std::uint64_t n_written = 0;
+    for (const auto &ring : current_rings) {
+      while (auto record = ring->pop()) {
+        out << format_line(record->lvl, record->time, record->msg) << '\n';
+        n_written++;
+      }
+    }
+
+    auto total_drops = dropped.load(std::memory_order_relaxed);
+    if (total_drops != reported_drops) {
+      out << format_line(warning,
+                         std::chrono::system_clock::now(),
+                         fmt::format("[LOGS] Log buffer overflow, dropped {} messages", total_drops - reported_drops))
+          << '\n';
+      reported_drops = total_drops;
+      out.flush();
+    }
+    // Don't touch the stream when there's nothing to write, once flush() returns it's safe to read it
+    if (n_written > 0) {
+      out.flush();
+      written.fetch_add(n_written, std::memory_order_release);
+    }
+  }
+
+  static inline std::atomic<std::uint64_t> next_id{1};
+  const std::uint64_t id = next_id++;
+
+  std::ostream &out;
+  std::thread writer_thread;
+  std::atomic<bool> stopping{false};
+
+  std::mutex rings_mutex; // only taken by producers the first time they log
+  std::vector<std::shared_ptr<ring_t>> rings;
+
+  std::condition_variable cv;
+  std::atomic<bool> has_pending{false};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint64_t> queued{0};  // successfully pushed by the producers
+  std::atomic<std::uint64_t> written{0}; // pushed messages that have been written by the writer thread
+};
+
+/**
+ * Set by init(), when not null all log messages will go through the async writer.
+ * This is intentionally never deleted so that it's safe to log during static destruction, messages that are still
+ * queued when the process crashes are lost: see WOLF_LOG_ASYNC.
+ */
+inline std::atomic<async_writer *> async_backend{nullptr};
+
 /**
  * @brief first time Boost log system initialization
  *
  * @param min_log_level: The minum log level to be reported, anything below this will not be printed
+ * @param use_async: if true, messages will be written by a separate thread, see: async_writer
  */
-inline void init(severity_level min_log_level) {
+inline void init(severity_level min_log_level, bool use_async = false) {
   /* init boost log
    * 1. Add common attributes
    * 2. set log filter to trace
    */
+  runtime_min_level = min_log_level;
   boost::log::add_common_attributes();
   boost::log::core::get()->set_filter(boost::log::trivial::severity >= min_log_level);
 
@@ -88,12 +292,32 @@ inline void init(severity_level min_log_level) {
   consoleSink->set_formatter([](boost::log::record_view const &rec, boost::log::formatting_ostream &strm) {
     auto severity = rec[boost::log::trivial::severity];
     auto msg = rec[boost::log::expressions::smessage];
-    auto now = std::chrono::system_clock::now();
 
-    strm << get_color(severity.get());
-    strm << fmt::format("{:%T} {:<5} | {}", now.time_since_epoch(), get_name(severity.get()), msg.get());
-    strm << "\033[0m";
+    strm << format_line(severity.get(), std::chrono::system_clock::now(), msg.get());
   });
+
+  if (use_async && async_backend.load() == nullptr) {
+    async_backend = new async_writer(std::clog);
+  }
+}
+
+/**
+ * Waits for any pending asynchronous log message to be written
+ */
+inline void flush() {
+  if (auto backend = async_backend.load()) {
+    backend->flush();
+  }
+}
+
+/**
+ * @return the number of log messages that have been dropped because of a full buffer
+ */
+inline std::uint64_t dropped_messages() {
+  if (auto backend = async_backend.load()) {
+    return backend->dropped_messages();
+  }
+  return 0;
 }
 
 /**
@@ -125,10 +349,19 @@ BOOST_LOG_INLINE_GLOBAL_LOGGER_INIT(my_logger, my_logger_mt) {
  * @param lv: log level
  * @param format_str: a valid fmt::format string
  * @param args: optional additional args to be formatted
+ *
+ * @note: args are always evaluated, use WOLF_LOG() when they are expensive to compute
  */
 template <typename S, typename... Args> inline void log(severity_level lvl, const S &format_str, const Args &...args) {
+  if (!is_enabled(lvl)) {
+    return;
+  }
   auto msg = fmt::format(format_str, args...);
-  BOOST_LOG_SEV(my_logger::get(), lvl) << msg;
+  if (auto backend = async_backend.load(std::memory_order_relaxed)) {
+    backend->push({lvl, std::chrono::system_clock::now(), std::move(msg)});
+  } else {
+    BOOST_LOG_SEV(my_logger::get(), lvl) << msg;
+  }
 }
 
 inline logs::severity_level parse_level(const std::string &level) {
@@ -148,4 +381,20 @@ inline logs::severity_level parse_level(const std::string &level) {
     return logs::fatal;
   }
 }
-} // namespace logs
\ No newline at end of file
+} // namespace logs
+
+/**
+ * Same as logs::log() but the arguments will only be evaluated when the level is enabled.
+ * Calls with a level below WOLF_LOG_COMPILE_MIN_LEVEL are removed at compile time; the threshold is read where the
+ * macro is expanded.
+ *
+ * Example: WOLF_LOG(logs::trace, "HEX: {}", crypto::str_to_hex(payload));
+ */
+#define WOLF_LOG(lvl, ...)                                                                                             \
+  do {                                                                                                                 \
+    if constexpr (static_cast<int>(lvl) >= WOLF_LOG_COMPILE_MIN_LEVEL) {                                               \
+      if (logs::is_enabled(lvl)) {                                                                                     \
+        logs::log(lvl, __VA_ARGS__);                                                                                   \
+      }                                                                                                                \
+    }                                                                                                                  \
+  } while (false)
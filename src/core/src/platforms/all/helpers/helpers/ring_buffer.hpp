@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+
+/**
+ * Bounded, lock-free, single producer single consumer ring buffer.
+ *
+ * Only one thread is allowed to push() and only one (possibly different) thread is allowed to pop().
+ * When full, push() will fail instead of blocking.
+ */
+template <typename T, std::size_t Capacity> class SPSCRingBuffer {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+private:
+  std::array<T, Capacity> m_buffer{};
+
+  // Written only by the consumer
+  alignas(64) std::atomic<std::size_t> m_head{0};
+
+  // Written only by the producer
+  alignas(64) std::atomic<std::size_t> m_tail{0};
+
+public:
+  SPSCRingBuffer() = default;
+
+  /**
+   * Pushes an element to the buffer
+   * @return false if the buffer is full, the element will not be pushed
+   */
+  bool push(T &&item) {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    m_buffer[tail & (Capacity - 1)] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Pops an element off the buffer
+   * @return the element if it was available, empty optional otherwise
+   */
+  std::optional<T> pop() {
+    auto head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return {};
+    }
+    auto item = std::move(m_buffer[head & (Capacity - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+  [[nodiscard]] bool empty() const {
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+  }
+};
@@ -20,6 +20,9 @@ private:
   // Condition variable for signalling
   std::condition_variable m_cond;
 
+  // Set by close()
+  bool m_closed = false;
+
 public:
   TSQueue() = default;
 
@@ -40,11 +43,11 @@ public:
   std::optional<T> pop(std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
     std::unique_lock<std::mutex> lock(m_mutex);
 
-    // wait until queue is not empty or timeout
-    auto res = m_cond.wait_for(lock, timeout, [this]() { return !m_queue.empty(); });
+    // wait until queue is not empty, closed or timeout
+    m_cond.wait_for(lock, timeout, [this]() { return !m_queue.empty() || m_closed; });
 
-    // if timeout returns empty optional
-    if (!res) {
+    // if timeout (or closed) returns empty optional
+    if (m_queue.empty()) {
       return {};
     }
 
@@ -53,4 +56,18 @@ public:
     m_queue.pop();
     return item;
   }
+
+  /**
+   * Wakes up all the threads waiting in pop(), from now on pop() will return straight away when the queue is empty
+   */
+  void close() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_cond.notify_all();
+  }
+
+  bool is_closed() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_closed;
+  }
 };
\ No newline at end of file
@@ -5,15 +5,18 @@
 #include <unistd.h>
 
 constexpr int UDEV_EVENT_MODE = 2;
+
 int main(int argc, char *argv[]) {
   InputParser input(argc, argv);
   int rc = -1;
 
   if (input.cmdOptionExists("-h") || input.cmdOptionExists("--help")) {
     std::cout << "Usage: fake-udev -m <base64 encoded message> [options]" << std::endl;
+    std::cout << "       fake-udev --listen <socket path> [options]" << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << "  -h, --help" << std::endl;
     std::cout << "  -m <base64 encoded message>" << std::endl;
+    std::cout << "  --listen <socket path>        | receive batches of messages on a UNIX socket" << std::endl;
     std::cout << "  --sock-domain <domain>        | default: AF_NETLINK" << std::endl;
     std::cout << "  --sock-type <type>            | default: SOCK_RAW" << std::endl;
     std::cout << "  --sock-protocol <protocol>    | default: NETLINK_KOBJECT_UEVENT" << std::endl;
@@ -30,6 +33,25 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  auto listen_path = input.getCmdOption("--listen");
+  if (!listen_path.empty()) {
+    netlink_connection conn{};
+    if (connect(conn,
+                input.getCmdOption("--sock-domain", AF_NETLINK),
+                input.getCmdOption("--sock-type", SOCK_RAW),
+                input.getCmdOption("--sock-protocol", NETLINK_KOBJECT_UEVENT),
+                input.getCmdOption("--sock-groups", UDEV_EVENT_MODE))) {
+      int server = listen_daemon(listen_path);
+      if (server >= 0) {
+        run_daemon(conn, server, input.getCmdOption("--udev-devtype", ""));
+        close(server);
+        unlink(listen_path.c_str());
+      }
+    }
+    cleanup(conn);
+    return rc;
+  }
+
   auto msg = input.getCmdOption("-m");
   if (msg.empty()) {
     std::string in;
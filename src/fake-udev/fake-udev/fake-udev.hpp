@@ -1,11 +1,23 @@
 #pragma once
 #include "MurmurHash2.h"
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <linux/major.h>
 #include <linux/netlink.h>
+#include <map>
+#include <optional>
+#include <sstream>
 #include <string.h>
 #include <string>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <vector>
 
@@ -53,6 +65,44 @@ static bool send_msgs(netlink_connection &conn, const std::vector<std::string /*
   }
 }
 
+/**
+ * Sends each element of datagrams as a separate netlink message (made of the given parts), using as few syscalls as
+ * possible: a netlink datagram carries a single udev event so they can't be merged into one sendmsg() call.
+ *
+ * @return the number of datagrams that have been sent
+ */
+static std::size_t send_batch(netlink_connection &conn, const std::vector<std::vector<std::string>> &datagrams) {
+  std::vector<iovec> iov;
+  std::vector<mmsghdr> msgs(datagrams.size());
+  for (const auto &parts : datagrams) {
+    for (const auto &part : parts) {
+      iov.push_back(iovec{.iov_base = (char *)part.data(), .iov_len = part.size()});
+    }
+  }
+
+  std::size_t iov_offset = 0;
+  for (std::size_t i = 0; i < datagrams.size(); ++i) {
+    msgs[i].msg_hdr = msghdr{
+        .msg_name = &conn.sa,
+        .msg_namelen = sizeof conn.sa,
+        .msg_iov = iov.data() + iov_offset,
+        .msg_iovlen = datagrams[i].size(),
+    };
+    iov_offset += datagrams[i].size();
+  }
+
+  std::size_t sent = 0;
+  while (sent < msgs.size()) {
+    int rc = sendmmsg(conn.fd, msgs.data() + sent, msgs.size() - sent, 0);
+    if (rc <= 0) {
+      std::cout << "Could not send message:" << strerror(errno) << std::endl;
+      break;
+    }
+    sent += rc;
+  }
+  return sent;
+}
+
 static void cleanup(netlink_connection &conn) {
   if (conn.fd >= 0) {
     close(conn.fd);
@@ -110,6 +160,66 @@ static uint32_t string_hash32(const std::string &str) {
   return MurmurHash2(str.c_str(), str.length(), 0);
 }
 
+/**
+ * Splits a raw udev message (`KEY=VALUE\0KEY=VALUE\0...`) into its properties
+ */
+static std::map<std::string, std::string> parse_udev_properties(const std::string &msg) {
+  std::map<std::string, std::string> properties;
+  std::size_t start = 0;
+  while (start < msg.size()) {
+    auto end = msg.find('\0', start);
+    if (end == std::string::npos) {
+      end = msg.size();
+    }
+    auto property = msg.substr(start, end - start);
+    auto separator = property.find('=');
+    if (separator != std::string::npos) {
+      properties[property.substr(0, separator)] = property.substr(separator + 1);
+    }
+    start = end + 1;
+  }
+  return properties;
+}
+
+/**
+ * Same as systemd string_bloom64(): sets 4 bits out of 64 based on the hash of the string
+ */
+static uint64_t string_bloom64(const std::string &str) {
+  uint64_t bits = 0;
+  uint32_t hash = string_hash32(str);
+  bits |= UINT64_C(1) << (hash & 63);
+  bits |= UINT64_C(1) << ((hash >> 6) & 63);
+  bits |= UINT64_C(1) << ((hash >> 12) & 63);
+  bits |= UINT64_C(1) << ((hash >> 18) & 63);
+  return bits;
+}
+
+/**
+ * The bloom filter of all the tags of the device (ex: `TAGS=:seat:uaccess:`), libudev consumers that filter by tag
+ * (see: udev_monitor_filter_add_match_tag) will drop messages that don't match it straight in the kernel.
+ */
+static uint64_t tags_bloom64(const std::string &full_opts) {
+  auto properties = parse_udev_properties(full_opts);
+  auto tags = properties.find("TAGS");
+  if (tags == properties.end()) {
+    return 0;
+  }
+
+  uint64_t bits = 0;
+  std::size_t start = 0;
+  while (start < tags->second.size()) {
+    auto end = tags->second.find(':', start);
+    if (end == std::string::npos) {
+      end = tags->second.size();
+    }
+    if (end > start) {
+      bits |= string_bloom64(tags->second.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return bits;
+}
+
 static std::string
 make_udev_header(const std::string &full_opts, const std::string &subsystem, const std::string &devtype) {
   monitor_netlink_header header{
@@ -117,9 +227,12 @@ make_udev_header(const std::string &full_opts, const std::string &subsystem, con
       .header_size = sizeof header,
       .properties_off = sizeof header,
       .properties_len = static_cast<unsigned int>(full_opts.size()),
-      .filter_tag_bloom_hi = 0, // TODO: ?
-      .filter_tag_bloom_lo = 0, // TODO: ?
   };
+  auto tag_bloom_bits = tags_bloom64(full_opts);
+  if (tag_bloom_bits > 0) {
+    header.filter_tag_bloom_hi = htobe32(tag_bloom_bits >> 32);
+    header.filter_tag_bloom_lo = htobe32(tag_bloom_bits & 0xffffffff);
+  }
   if (!subsystem.empty()) {
     header.filter_subsystem_hash = htobe32(string_hash32(subsystem));
   }
@@ -130,6 +243,236 @@ make_udev_header(const std::string &full_opts, const std::string &subsystem, con
   return {(char *)&header, sizeof header};
 }
 
+/**
+ * @return the major number of the given character device driver (ex: `hidraw`) as listed in /proc/devices
+ */
+static std::optional<unsigned> char_device_major(const std::string &driver) {
+  std::ifstream devices("/proc/devices");
+  std::string line;
+  while (std::getline(devices, line) && line != "Character devices:") {
+  }
+  unsigned major_nr;
+  std::string name;
+  while (std::getline(devices, line) && !line.empty()) {
+    std::istringstream entry(line);
+    if (entry >> major_nr >> name && name == driver) {
+      return major_nr;
+    }
+  }
+  return {};
+}
+
+/**
+ * fake-udev runs as root and takes requests from whatever is running in the container: it'll only manage the device
+ * nodes that Wolf creates (input devices, hidraw and uhid), with their expected major number.
+ * Anything else could be used to create or remove arbitrary files.
+ */
+static bool
+is_allowed_device_node(const std::string &devname, unsigned dev_major, const std::filesystem::path &dev_root = "/dev") {
+  std::filesystem::path path(devname);
+  std::error_code ec;
+  if (!path.is_absolute() || path.lexically_normal() != path || std::filesystem::is_symlink(path.parent_path(), ec)) {
+    return false;
+  }
+  auto filename = path.filename().string();
+  if (path.parent_path() == dev_root / "input") {
+    return dev_major == INPUT_MAJOR;
+  } else if (path.parent_path() == dev_root && filename == "uhid") {
+    return dev_major == MISC_MAJOR;
+  } else if (path.parent_path() == dev_root && filename.rfind("hidraw", 0) == 0) {
+    return dev_major == char_device_major("hidraw");
+  }
+  return false;
+}
+
+/**
+ * @return false if sync_device_node() must not touch the device node referenced by the event
+ * @throws std::invalid_argument when MAJOR is not a number
+ */
+static bool can_sync_device_node(const std::map<std::string, std::string> &properties,
+                                 const std::filesystem::path &dev_root = "/dev") {
+  auto devname = properties.find("DEVNAME");
+  auto action = properties.find("ACTION");
+  if (devname == properties.end() || action == properties.end()) {
+    return true;
+  }
+
+  if (action->second == "add") {
+    auto dev_major = properties.find("MAJOR");
+    return dev_major != properties.end() && properties.count("MINOR") &&
+           is_allowed_device_node(devname->second, std::stoul(dev_major->second), dev_root);
+  } else if (action->second == "remove") {
+    struct stat node = {};
+    if (lstat(devname->second.c_str(), &node) < 0) {
+      return errno == ENOENT; // Nothing to remove
+    }
+    return S_ISCHR(node.st_mode) && is_allowed_device_node(devname->second, major(node.st_rdev), dev_root);
+  }
+  return true;
+}
+
+/**
+ * Creates (on `add`) or removes (on `remove`) the device node referenced by DEVNAME, like udevd would do.
+ * Events without a DEVNAME don't have a device node and are ignored.
+ * @throws std::invalid_argument when MAJOR or MINOR are not numbers
+ */
+static bool sync_device_node(const std::map<std::string, std::string> &properties,
+                             const std::filesystem::path &dev_root = "/dev") {
+  auto devname = properties.find("DEVNAME");
+  auto action = properties.find("ACTION");
+  if (devname == properties.end() || action == properties.end()) {
+    return true;
+  }
+  if (!can_sync_device_node(properties, dev_root)) {
+    std::cout << "Refusing to " << action->second << " " << devname->second << std::endl;
+    return false;
+  }
+
+  std::error_code ec;
+  if (action->second == "add") {
+    std::filesystem::create_directories(std::filesystem::path(devname->second).parent_path(), ec);
+    auto dev = makedev(std::stoul(properties.at("MAJOR")), std::stoul(properties.at("MINOR")));
+    if (mknod(devname->second.c_str(), S_IFCHR | 0777, dev) < 0 && errno != EEXIST) {
+      std::cout << "Could not create " << devname->second << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    // mknod() is subject to the umask
+    chmod(devname->second.c_str(), 0777);
+  } else if (action->second == "remove") {
+    std::filesystem::remove(devname->second, ec);
+  }
+  return true;
+}
+
+/**
+ * Applies a batch of base64 encoded udev messages: device nodes are created before announcing them and they are
+ * removed only after the `remove` events have been sent, so that listeners never see a device that doesn't exist.
+ * All the messages are sent in one go, see: send_batch()
+ */
+static bool apply_udev_events(netlink_connection &conn,
+                              const std::vector<std::string> &b64_msgs,
+                              const std::string &default_subsystem = "input",
+                              const std::string &devtype = "",
+                              const std::filesystem::path &dev_root = "/dev") {
+  bool success = true;
+  std::vector<std::map<std::string, std::string>> removed;
+  std::vector<std::vector<std::string>> datagrams;
+  for (const auto &b64_msg : b64_msgs) {
+    auto msg = base64_decode(b64_msg);
+    auto properties = parse_udev_properties(msg);
+    auto subsystem = properties.count("SUBSYSTEM") ? properties["SUBSYSTEM"] : default_subsystem;
+    if (properties["ACTION"] == "remove") {
+      if (!can_sync_device_node(properties, dev_root)) {
+        std::cout << "Refusing to remove " << properties["DEVNAME"] << std::endl;
+        success = false;
+        continue;
+      }
+      removed.push_back(properties);
+    } else if (!sync_device_node(properties, dev_root)) {
+      success = false;
+      continue;
+    }
+    datagrams.push_back({make_udev_header(msg, subsystem, devtype), msg});
+  }
+
+  if (send_batch(conn, datagrams) != datagrams.size()) {
+    success = false;
+  }
+  for (const auto &properties : removed) {
+    success = sync_device_node(properties, dev_root) && success;
+  }
+  return success;
+}
+
+/**
+ * Creates the UNIX socket where run_daemon() will receive the batches of udev events.
+ * Only root (Wolf) can connect to it: the events will be applied as root.
+ * @return the listening socket, -1 on error
+ */
+static int listen_daemon(const std::string &socket_path) {
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cout << "Socket path too long: " << socket_path << std::endl;
+    return -1;
+  }
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) {
+    std::cout << "Could not create UNIX socket: " << strerror(errno) << std::endl;
+    return -1;
+  }
+  unlink(socket_path.c_str()); // Left over from a previous run
+  // Make sure that the socket is never reachable by others, not even before the chmod()
+  auto old_umask = umask(0177);
+  bool listening = bind(server, (sockaddr *)&addr, sizeof(addr)) == 0 && listen(server, 16) == 0;
+  umask(old_umask);
+  if (!listening || chmod(socket_path.c_str(), 0600) < 0) {
+    std::cout << "Could not listen on " << socket_path << ": " << strerror(errno) << std::endl;
+    close(server);
+    return -1;
+  }
+  std::cout << "Listening on " << socket_path << std::endl;
+  return server;
+}
+
+/**
+ * Receives batches of udev events on the given listening socket, until it's shut down.
+ * Each connection carries a single batch: newline separated base64 encoded messages, terminated by closing the write
+ * side of the socket. Once all the events have been applied we reply with `OK\n` (or `ERR\n`) and close the connection.
+ *
+ * Clients are served one at a time: a client that doesn't complete its batch within `client_timeout` gets an `ERR\n`.
+ */
+static void run_daemon(netlink_connection &conn,
+                       int server,
+                       const std::string &devtype,
+                       std::chrono::milliseconds client_timeout = std::chrono::seconds(1),
+                       const std::filesystem::path &dev_root = "/dev") {
+  constexpr std::size_t MAX_BATCH_SIZE = 1024 * 1024;
+  while (true) {
+    int client = accept(server, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cout << "Stopped accepting connections: " << strerror(errno) << std::endl;
+      return;
+    }
+    timeval tv = {.tv_sec = client_timeout.count() / 1000, .tv_usec = (client_timeout.count() % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string batch;
+    char buf[4096];
+    ssize_t n = 0;
+    while (batch.size() <= MAX_BATCH_SIZE && (n = read(client, buf, sizeof(buf))) > 0) {
+      batch.append(buf, n);
+    }
+
+    bool success = false;
+    if (n < 0 || batch.size() > MAX_BATCH_SIZE) {
+      std::cout << "Dropping incomplete batch: " << (n < 0 ? strerror(errno) : "too big") << std::endl;
+    } else {
+      std::vector<std::string> msgs;
+      std::istringstream lines(batch);
+      for (std::string line; std::getline(lines, line);) {
+        if (!line.empty()) {
+          msgs.push_back(line);
+        }
+      }
+      try {
+        success = apply_udev_events(conn, msgs, "input", devtype, dev_root);
+      } catch (const std::exception &e) {
+        std::cout << "Invalid batch: " << e.what() << std::endl;
+      }
+    }
+
+    std::string reply = success ? "OK\n" : "ERR\n";
+    send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+    close(client);
+  }
+}
+
 /**
  * Adapted from https://stackoverflow.com/questions/865668/parsing-command-line-arguments-in-c
  */
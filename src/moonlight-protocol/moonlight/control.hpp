@@ -343,6 +343,19 @@ struct ControlRGBLedPacket {
   std::uint8_t b;
 };
 
+/**
+ * Periodically sent by the client with the number of video packets that have been lost since the previous report.
+ * All fields are little endian.
+ */
+struct ControlLossStatsPacket {
+  ControlPacket header;
+
+  std::int32_t lost_packets; // Since the last report
+  std::int32_t interval_ms;  // Time since the last report
+  std::int32_t unknown;      // Always 1000
+  std::int64_t last_good_frame;
+};
+
 struct ControlEncryptedPacket {
   ControlPacket header; // Always 0x0001 (see PACKET_TYPE ENCRYPTED)
   std::uint32_t seq;    // Monotonically increasing sequence number (used as IV for AES-GCM)
@@ -1,7 +1,9 @@
 #include "core/input.hpp"
 #include <control/control.hpp>
 #include <control/input_handler.hpp>
+#include <chrono>
 #include <immer/box.hpp>
+#include <map>
 #include <state/sessions.hpp>
 #include <sys/socket.h>
 
@@ -70,7 +72,7 @@ std::pair<std::string /* ip */, int /* port */> get_ip(const sockaddr *const ip_
 }
 
 bool send_packet(std::string_view payload, ENetPeer *peer) {
-  logs::log(logs::trace, "[ENET] Sending packet");
+  WOLF_LOG(logs::trace, "[ENET] Sending packet");
   auto packet = enet_packet_create(payload.data(), payload.size(), ENET_PACKET_FLAG_RELIABLE);
   if (enet_peer_send(peer, 0, packet) < 0) {
     logs::log(logs::warning, "[ENET] Failed to send packet");
@@ -87,7 +89,7 @@ bool encrypt_and_send(std::string_view payload,
   auto clients = connected_clients.load();
   auto enet_peer = clients->find(session_id);
   if (enet_peer == nullptr) {
-    logs::log(logs::debug, "[ENET] Unable to find enet client {}", session_id);
+    WOLF_LOG(logs::debug, "[ENET] Unable to find enet client {}", session_id);
     return false;
   } else {
     auto encrypted = control::encrypt_packet(aes_key, 0, payload); // TODO: seq?
@@ -95,9 +97,17 @@ bool encrypt_and_send(std::string_view payload,
   }
 }
 
+/**
+ * What has been received from a client since its last NetworkStatsEvent
+ */
+struct network_report {
+  std::chrono::steady_clock::time_point last_report;
+  std::uint32_t recovery_requests = 0;
+};
+
 void run_control(int port,
                  const state::SessionsAtoms &running_sessions,
-                 const std::shared_ptr<dp::event_bus> &event_bus,
+                 const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
                  int peers,
                  std::chrono::milliseconds timeout,
                  const std::string &host_ip) {
@@ -108,6 +118,23 @@ void run_control(int port,
   ENetEvent event;
 
   immer::atom<enet_clients_map> connected_clients;
+  std::map<std::size_t /* session_id */, network_report> network_reports; // only accessed by this thread
+
+  /* The first report only starts the tracking, the client asks for an IDR when the stream starts */
+  auto report_network_stats = [&](std::size_t session_id, std::uint32_t lost_packets, ENetPeer *peer) {
+    auto now = std::chrono::steady_clock::now();
+    auto [report, first] = network_reports.try_emplace(session_id, network_report{.last_report = now});
+    if (!first) {
+      auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(now - report->second.last_report);
+      event_bus->fire_event(
+          immer::box<NetworkStatsEvent>(NetworkStatsEvent{.session_id = session_id,
+                                                          .lost_packets = lost_packets,
+                                                          .interval = interval,
+                                                          .rtt = std::chrono::milliseconds(peer->roundTripTime),
+                                                          .recovery_requests = report->second.recovery_requests}));
+    }
+    report->second = network_report{.last_report = now};
+  };
 
   auto stop_ev = event_bus->register_handler<immer::box<StopStreamEvent>>(
       [&connected_clients, &running_sessions](const immer::box<StopStreamEvent> &ev) {
@@ -139,6 +166,7 @@ void run_control(int port,
           logs::log(logs::debug, "[ENET] disconnected client: {}:{}", client_ip, client_port);
           connected_clients.update(
               [sess_id = client_session->session_id](const enet_clients_map &m) { return m.erase(sess_id); });
+          network_reports.erase(client_session->session_id);
           event_bus->fire_event(
               immer::box<PauseStreamEvent>(PauseStreamEvent{.session_id = client_session->session_id}));
           break;
@@ -147,13 +175,13 @@ void run_control(int port,
 
           auto type = ((ControlPacket *)packet->data)->type;
 
-          logs::log(logs::trace,
-                    "[ENET] received {} of {} bytes from: {}:{} HEX: {}",
-                    packet_type_to_str(type),
-                    packet->dataLength,
-                    client_ip,
-                    client_port,
-                    crypto::str_to_hex({(char *)packet->data, packet->dataLength}));
+          WOLF_LOG(logs::trace,
+                   "[ENET] received {} of {} bytes from: {}:{} HEX: {}",
+                   packet_type_to_str(type),
+                   packet->dataLength,
+                   client_ip,
+                   client_port,
+                   crypto::str_to_hex({(char *)packet->data, packet->dataLength}));
 
           if (type == ENCRYPTED) {
             try {
@@ -161,17 +189,36 @@ void run_control(int port,
               auto decrypted = decrypt_packet(*enc_pkt, client_session->aes_key);
               auto sub_type = ((ControlPacket *)decrypted.data())->type;
 
-              logs::log(logs::trace,
-                        "[ENET] decrypted sub_type: {} HEX: {}",
-                        packet_type_to_str(sub_type),
-                        crypto::str_to_hex(decrypted));
+              WOLF_LOG(logs::trace,
+                       "[ENET] decrypted sub_type: {} HEX: {}",
+                       packet_type_to_str(sub_type),
+                       crypto::str_to_hex(decrypted));
 
               if (sub_type == TERMINATION) {
                 event_bus->fire_event(
                     immer::box<PauseStreamEvent>(PauseStreamEvent{.session_id = client_session->session_id}));
               } else if (sub_type == INPUT_DATA) {
-                handle_input(client_session.value(), connected_clients, (INPUT_PKT *)decrypted.data());
+                if (client_session->input_allowed->load()) {
+                  handle_input(client_session.value(), connected_clients, (INPUT_PKT *)decrypted.data());
+                } else {
+                  WOLF_LOG(logs::trace, "[ENET] Ignoring input from spectator {}", client_session->session_id);
+                }
               } else {
+                if (sub_type == LOSS_STATS && decrypted.size() >= sizeof(ControlLossStatsPacket)) {
+                  auto loss_stats = (ControlLossStatsPacket *)decrypted.data();
+                  auto lost = boost::endian::little_to_native(loss_stats->lost_packets);
+                  report_network_stats(client_session->session_id,
+                                       static_cast<std::uint32_t>(std::max(0, lost)),
+                                       event.peer);
+                } else if (sub_type == PERIODIC_PING || sub_type == FRAME_STATS) {
+                  // We don't rely on the content of FRAME_STATS, it's just used as a clock like PERIODIC_PING
+                  report_network_stats(client_session->session_id, 0, event.peer);
+                } else if (sub_type == IDR_FRAME || sub_type == INVALIDATE_REF_FRAMES) {
+                  if (auto report = network_reports.find(client_session->session_id);
+                      report != network_reports.end()) {
+                    report->second.recovery_requests++;
+                  }
+                }
                 auto ev = ControlEvent{client_session->session_id, sub_type, decrypted};
                 event_bus->fire_event(immer::box<ControlEvent>{ev});
               }
@@ -33,11 +33,27 @@ struct StopStreamEvent {
   std::size_t session_id;
 };
 
+/**
+ * Fired periodically with what the client reported since the previous event
+ * together with the current round trip time of the control channel.
+ *
+ * Older clients report the video packets that have been lost (LOSS_STATS); recent ones only send a PERIODIC_PING,
+ * in that case we only know how many times the client asked to recover from a broken frame.
+ */
+struct NetworkStatsEvent {
+  std::size_t session_id;
+
+  std::uint32_t lost_packets;
+  std::chrono::milliseconds interval;
+  std::chrono::milliseconds rtt;
+  std::uint32_t recovery_requests = 0; // IDR_FRAME and INVALIDATE_REF_FRAMES
+};
+
 using namespace std::chrono_literals;
 
 void run_control(int port,
                  const state::SessionsAtoms &running_sessions,
-                 const std::shared_ptr<dp::event_bus> &event_bus,
+                 const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
                  int peers = 20,
                  std::chrono::milliseconds timeout = 1000ms,
                  const std::string &host_ip = "0.0.0.0");
@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <boost/endian/conversion.hpp>
 #include <boost/locale.hpp>
 #include <control/input_handler.hpp>
+#include <control/joypads-pool.hpp>
 #include <helpers/logger.hpp>
+#include <helpers/utils.hpp>
 #include <immer/box.hpp>
 #include <platforms/input.hpp>
 #include <string>
@@ -13,6 +16,84 @@ using namespace wolf::core::input;
 using namespace std::string_literals;
 using namespace moonlight::control;
 
+static std::string joypad_type_name(CONTROLLER_TYPE type) {
+  switch (type) {
+  case PS:
+    return "PS";
+  case NINTENDO:
+    return "Nintendo";
+  default:
+    return "Xbox";
+  }
+}
+
+std::shared_ptr<state::JoypadTypes> create_virtual_joypad(CONTROLLER_TYPE type) {
+  switch (type) {
+  case PS: {
+    auto result = PS5Joypad::create(
+        {.name = "Wolf DualSense (virtual) pad", .vendor_id = 0x054C, .product_id = 0x0CE6, .version = 0x8111});
+    if (!result) {
+      logs::log(logs::error, "Failed to create PS5 joypad: {}", result.getErrorMessage());
+      return {};
+    }
+    // Let's wait for the kernel to pick it up and mount the /dev/ devices
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return std::make_shared<state::JoypadTypes>(std::move(*result));
+  }
+  case NINTENDO: {
+    auto result = SwitchJoypad::create({.name = "Wolf Nintendo (virtual) pad",
+                                        // https://github.com/torvalds/linux/blob/master/drivers/hid/hid-ids.h#L981
+                                        .vendor_id = 0x057e,
+                                        .product_id = 0x2009,
+                                        .version = 0x8111});
+    if (!result) {
+      logs::log(logs::error, "Failed to create Switch joypad: {}", result.getErrorMessage());
+      return {};
+    }
+    return std::make_shared<state::JoypadTypes>(std::move(*result));
+  }
+  default: {
+    auto result =
+        XboxOneJoypad::create({.name = "Wolf X-Box One (virtual) pad",
+                               // https://github.com/torvalds/linux/blob/master/drivers/input/joystick/xpad.c#L147
+                               .vendor_id = 0x045E,
+                               .product_id = 0x02EA,
+                               .version = 0x0408});
+    if (!result) {
+      logs::log(logs::error, "Failed to create Xbox One joypad: {}", result.getErrorMessage());
+      return {};
+    }
+    return std::make_shared<state::JoypadTypes>(std::move(*result));
+  }
+  }
+}
+
+/**
+ * @return WOLF_JOYPADS_POOL_SIZE clamped to the number of controllers that a client can connect, 0 when not valid
+ */
+static std::size_t joypads_pool_size() {
+  constexpr int max_size = 16;
+  std::string value = utils::get_env("WOLF_JOYPADS_POOL_SIZE", "0");
+  try {
+    return std::clamp(std::stoi(value), 0, max_size);
+  } catch (const std::exception &e) {
+    logs::log(logs::warning, "Invalid WOLF_JOYPADS_POOL_SIZE: {}, joypads will not be pre-created", value);
+    return 0;
+  }
+}
+
+static std::shared_ptr<JoypadsPool<state::JoypadTypes>> joypads_pool() {
+  static auto pool = std::make_shared<JoypadsPool<state::JoypadTypes>>(
+      joypads_pool_size(),
+      std::vector<CONTROLLER_TYPE>{XBOX, PS, NINTENDO},
+      create_virtual_joypad);
+  return pool;
+}
+
+void init_joypads_pool() {
+  joypads_pool()->refill();
+}
+
 std::shared_ptr<state::JoypadTypes> create_new_joypad(const state::StreamSession &session,
                                                       const immer::atom<enet_clients_map> &connected_clients,
                                                       int controller_number,
@@ -46,72 +127,28 @@ std::shared_ptr<state::JoypadTypes> create_new_joypad(const state::StreamSession
     encrypt_and_send(plaintext, aes_key, *clients, session_id);
   });
 
-  std::shared_ptr<state::JoypadTypes> new_pad;
   CONTROLLER_TYPE final_type = session.app->joypad_type == AUTO ? type : session.app->joypad_type;
-  switch (final_type) {
-  case UNKNOWN:
-  case AUTO:
-  case XBOX: {
-    logs::log(logs::info, "Creating Xbox joypad for controller {}", controller_number);
-    auto result =
-        XboxOneJoypad::create({.name = "Wolf X-Box One (virtual) pad",
-                               // https://github.com/torvalds/linux/blob/master/drivers/input/joystick/xpad.c#L147
-                               .vendor_id = 0x045E,
-                               .product_id = 0x02EA,
-                               .version = 0x0408});
-    if (!result) {
-      logs::log(logs::error, "Failed to create Xbox One joypad: {}", result.getErrorMessage());
-      return {};
-    } else {
-      (*result).set_on_rumble(on_rumble_fn);
-      new_pad = std::make_shared<state::JoypadTypes>(std::move(*result));
-    }
-    break;
-  }
-  case PS: {
-    logs::log(logs::info, "Creating PS joypad for controller {}", controller_number);
-    auto result = PS5Joypad::create(
-        {.name = "Wolf DualSense (virtual) pad", .vendor_id = 0x054C, .product_id = 0x0CE6, .version = 0x8111});
-    if (!result) {
-      logs::log(logs::error, "Failed to create PS5 joypad: {}", result.getErrorMessage());
-      return {};
-    } else {
-      (*result).set_on_rumble(on_rumble_fn);
-      (*result).set_on_led(on_led_fn);
-      new_pad = std::make_shared<state::JoypadTypes>(std::move(*result));
-
-      // Let's wait for the kernel to pick it up and mount the /dev/ devices
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      std::visit(
-          [&session](auto &pad) {
-            if (auto wl = *session.wayland_display->load()) {
-              for (const auto node : pad.get_udev_events()) {
-                if (node.find("ID_INPUT_TOUCHPAD") != node.end()) {
-                  add_input_device(*wl, node.at("DEVNAME"));
-                }
-              }
-            }
-          },
-          *new_pad);
-    }
-    break;
-  }
-  case NINTENDO:
-    logs::log(logs::info, "Creating Nintendo joypad for controller {}", controller_number);
-    auto result = SwitchJoypad::create({.name = "Wolf Nintendo (virtual) pad",
-                                        // https://github.com/torvalds/linux/blob/master/drivers/hid/hid-ids.h#L981
-                                        .vendor_id = 0x057e,
-                                        .product_id = 0x2009,
-                                        .version = 0x8111});
-    if (!result) {
-      logs::log(logs::error, "Failed to create Switch joypad: {}", result.getErrorMessage());
-      return {};
-    } else {
-      (*result).set_on_rumble(on_rumble_fn);
-      new_pad = std::make_shared<state::JoypadTypes>(std::move(*result));
+  if (final_type == UNKNOWN || final_type == AUTO) {
+    final_type = XBOX;
+  }
+  logs::log(logs::info, "Creating {} joypad for controller {}", joypad_type_name(final_type), controller_number);
+  auto new_pad = joypads_pool()->claim(final_type);
+  if (new_pad) {
+    logs::log(logs::debug, "[INPUT] Using a pre-created {} joypad", joypad_type_name(final_type));
+  } else if (!(new_pad = create_virtual_joypad(final_type))) {
+    return {};
+  }
+
+  std::visit([&on_rumble_fn](auto &pad) { pad.set_on_rumble(on_rumble_fn); }, *new_pad);
+  if (auto ps_pad = std::get_if<PS5Joypad>(new_pad.get())) {
+    ps_pad->set_on_led(on_led_fn);
+    if (auto wl = *session.wayland_display->load()) {
+      for (const auto node : ps_pad->get_udev_events()) {
+        if (node.find("ID_INPUT_TOUCHPAD") != node.end()) {
+          add_input_device(*wl, node.at("DEVNAME"));
+        }
+      }
     }
-    break;
   }
 
   if (capabilities & ACCELEROMETER && final_type == PS) {
@@ -462,9 +499,9 @@ void controller_arrival(const CONTROLLER_ARRIVAL_PACKET &pkt,
   auto joypads = session.joypads->load();
   if (joypads->find(pkt.controller_number)) {
     // TODO: should we replace it instead?
-    logs::log(logs::debug,
-              "[INPUT] Received CONTROLLER_ARRIVAL for controller {} which is already present; skipping...",
-              pkt.controller_number);
+    WOLF_LOG(logs::debug,
+             "[INPUT] Received CONTROLLER_ARRIVAL for controller {} which is already present; skipping...",
+             pkt.controller_number);
   } else {
     create_new_joypad(session,
                       connected_clients,
@@ -484,7 +521,7 @@ void controller_multi(const CONTROLLER_MULTI_PACKET &pkt,
 
     // Check if Moonlight is sending the final packet for this pad
     if (!(pkt.active_gamepad_mask & (1 << pkt.controller_number))) {
-      logs::log(logs::debug, "Removing joypad {}", pkt.controller_number);
+      WOLF_LOG(logs::debug, "Removing joypad {}", pkt.controller_number);
       // Send the event downstream, Docker will pick it up and remove the device
       state::UnplugDeviceEvent unplug_ev{.session_id = session.session_id};
       std::visit(
@@ -608,93 +645,93 @@ void handle_input(state::StreamSession &session,
                   INPUT_PKT *pkt) {
   switch (pkt->type) {
   case MOUSE_MOVE_REL: {
-    logs::log(logs::trace, "[INPUT] Received input of type: MOUSE_MOVE_REL");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: MOUSE_MOVE_REL");
     auto move_pkt = static_cast<MOUSE_MOVE_REL_PACKET *>(pkt);
     mouse_move_rel(*move_pkt, session);
     break;
   }
   case MOUSE_MOVE_ABS: {
-    logs::log(logs::trace, "[INPUT] Received input of type: MOUSE_MOVE_ABS");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: MOUSE_MOVE_ABS");
     auto move_pkt = static_cast<MOUSE_MOVE_ABS_PACKET *>(pkt);
     mouse_move_abs(*move_pkt, session);
     break;
   }
   case MOUSE_BUTTON_PRESS:
   case MOUSE_BUTTON_RELEASE: {
-    logs::log(logs::trace, "[INPUT] Received input of type: MOUSE_BUTTON_PACKET");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: MOUSE_BUTTON_PACKET");
     auto btn_pkt = static_cast<MOUSE_BUTTON_PACKET *>(pkt);
     mouse_button(*btn_pkt, session);
     break;
   }
   case MOUSE_SCROLL: {
-    logs::log(logs::trace, "[INPUT] Received input of type: MOUSE_SCROLL_PACKET");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: MOUSE_SCROLL_PACKET");
     auto scroll_pkt = (static_cast<MOUSE_SCROLL_PACKET *>(pkt));
     mouse_scroll(*scroll_pkt, session);
     break;
   }
   case MOUSE_HSCROLL: {
-    logs::log(logs::trace, "[INPUT] Received input of type: MOUSE_HSCROLL_PACKET");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: MOUSE_HSCROLL_PACKET");
     auto scroll_pkt = (static_cast<MOUSE_HSCROLL_PACKET *>(pkt));
     mouse_h_scroll(*scroll_pkt, session);
     break;
   }
   case KEY_PRESS:
   case KEY_RELEASE: {
-    logs::log(logs::trace, "[INPUT] Received input of type: KEYBOARD_PACKET");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: KEYBOARD_PACKET");
     auto key_pkt = static_cast<KEYBOARD_PACKET *>(pkt);
     keyboard_key(*key_pkt, session);
     break;
   }
   case UTF8_TEXT: {
-    logs::log(logs::trace, "[INPUT] Received input of type: UTF8_TEXT");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: UTF8_TEXT");
     auto txt_pkt = static_cast<UTF8_TEXT_PACKET *>(pkt);
     utf8_text(*txt_pkt, session);
     break;
   }
   case TOUCH: {
-    logs::log(logs::trace, "[INPUT] Received input of type: TOUCH");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: TOUCH");
     auto touch_pkt = static_cast<TOUCH_PACKET *>(pkt);
     touch(*touch_pkt, session);
     break;
   }
   case PEN: {
-    logs::log(logs::trace, "[INPUT] Received input of type: PEN");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: PEN");
     auto pen_pkt = static_cast<PEN_PACKET *>(pkt);
     pen(*pen_pkt, session);
     break;
   }
   case CONTROLLER_ARRIVAL: {
-    logs::log(logs::trace, "[INPUT] Received input of type: CONTROLLER_ARRIVAL");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: CONTROLLER_ARRIVAL");
     auto new_controller = static_cast<CONTROLLER_ARRIVAL_PACKET *>(pkt);
     controller_arrival(*new_controller, session, connected_clients);
     break;
   }
   case CONTROLLER_MULTI: {
-    logs::log(logs::trace, "[INPUT] Received input of type: CONTROLLER_MULTI");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: CONTROLLER_MULTI");
     auto controller_pkt = static_cast<CONTROLLER_MULTI_PACKET *>(pkt);
     controller_multi(*controller_pkt, session, connected_clients);
     break;
   }
   case CONTROLLER_TOUCH: {
-    logs::log(logs::trace, "[INPUT] Received input of type: CONTROLLER_TOUCH");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: CONTROLLER_TOUCH");
     auto touch_pkt = static_cast<CONTROLLER_TOUCH_PACKET *>(pkt);
     controller_touch(*touch_pkt, session);
     break;
   }
   case CONTROLLER_MOTION: {
-    logs::log(logs::trace, "[INPUT] Received input of type: CONTROLLER_MOTION");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: CONTROLLER_MOTION");
     auto motion_pkt = static_cast<CONTROLLER_MOTION_PACKET *>(pkt);
     controller_motion(*motion_pkt, session);
     break;
   }
   case CONTROLLER_BATTERY: {
-    logs::log(logs::trace, "[INPUT] Received input of type: CONTROLLER_BATTERY");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: CONTROLLER_BATTERY");
     auto battery_pkt = static_cast<CONTROLLER_BATTERY_PACKET *>(pkt);
     controller_battery(*battery_pkt, session);
     break;
   }
   case HAPTICS:
-    logs::log(logs::trace, "[INPUT] Received input of type: HAPTICS");
+    WOLF_LOG(logs::trace, "[INPUT] Received input of type: HAPTICS");
     break;
   }
 }
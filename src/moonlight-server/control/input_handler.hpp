@@ -8,6 +8,16 @@ namespace control {
 
 using namespace moonlight::control::pkts;
 
+/**
+ * Creates a new virtual joypad of the given type, without any callback attached
+ */
+std::shared_ptr<state::JoypadTypes> create_virtual_joypad(CONTROLLER_TYPE type);
+
+/**
+ * Starts creating the virtual joypads that are kept ready for new controllers, see: WOLF_JOYPADS_POOL_SIZE
+ */
+void init_joypads_pool();
+
 /**
  * Side effect: session devices might be updated when hotplugging
  */
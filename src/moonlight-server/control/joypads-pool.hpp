@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <moonlight/control.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace control {
+
+using moonlight::control::pkts::CONTROLLER_TYPE;
+
+/**
+ * Keeps a few virtual joypads of each type ready to be handed out when a controller arrives, so that players don't
+ * have to wait for the device to be created (and picked up by the kernel) before their inputs go through.
+ *
+ * Pads are never given back to the pool: a claimed pad belongs to the session until it's unplugged.
+ * Creating a pad is left to the factory, this way the pool doesn't depend on the actual devices.
+ */
+template <typename Pad> class JoypadsPool : public std::enable_shared_from_this<JoypadsPool<Pad>> {
+public:
+  using factory_fn = std::function<std::shared_ptr<Pad>(CONTROLLER_TYPE type)>;
+
+  JoypadsPool(std::size_t size_per_type, std::vector<CONTROLLER_TYPE> types, factory_fn factory)
+      : size_per_type(size_per_type), types(std::move(types)), factory(std::move(factory)) {}
+
+  /**
+   * @return a ready to use pad of the given type, nullptr when none is available.
+   *         Either way, the pool will be refilled in the background.
+   */
+  std::shared_ptr<Pad> claim(CONTROLLER_TYPE type) {
+    std::shared_ptr<Pad> pad;
+    {
+      std::lock_guard lock(mutex);
+      auto &available = pads[type];
+      if (!available.empty()) {
+        pad = std::move(available.back());
+        available.pop_back();
+      }
+    }
+    refill();
+    return pad;
+  }
+
+  /**
+   * Creates, in the background, the missing pads until there are size_per_type pads for each type
+   */
+  void refill() {
+    if (size_per_type == 0) {
+      return;
+    }
+    // A running refill might have already checked the type that has just been claimed, it'll go for another round
+    dirty = true;
+    if (refilling.exchange(true)) {
+      return;
+    }
+    std::thread([self = this->shared_from_this()]() {
+      do {
+        self->dirty = false;
+        for (auto type : self->types) {
+          while (self->available(type) < self->size_per_type) {
+            auto pad = self->factory(type);
+            if (!pad) { // Creating more is likely to fail too, we'll try again on the next claim()
+              break;
+            }
+            std::lock_guard lock(self->mutex);
+            self->pads[type].push_back(std::move(pad));
+          }
+        }
+        self->refilling = false;
+      } while (self->dirty && !self->refilling.exchange(true));
+    }).detach();
+  }
+
+  std::size_t available(CONTROLLER_TYPE type) {
+    std::lock_guard lock(mutex);
+    return pads[type].size();
+  }
+
+private:
+  std::size_t size_per_type;
+  std::vector<CONTROLLER_TYPE> types;
+  factory_fn factory;
+
+  std::mutex mutex;
+  std::map<CONTROLLER_TYPE, std::vector<std::shared_ptr<Pad>>> pads;
+  std::atomic<bool> refilling = false;
+  std::atomic<bool> dirty = false;
+};
+
+} // namespace control
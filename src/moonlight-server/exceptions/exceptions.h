@@ -6,12 +6,14 @@
  */
 #pragma once
 
+#include <cerrno>
 #include <cpptrace/cpptrace.hpp>
 #include <csignal>
 #include <fcntl.h>
 #include <filesystem>
 #include <helpers/logger.hpp>
 #include <helpers/utils.hpp>
+#include <thread>
 #include <unistd.h>
 
 using namespace std::string_literals;
@@ -60,6 +62,11 @@ static std::string backtrace_file_src() {
   return std::string(utils::get_env("WOLF_CFG_FOLDER", ".")) + "/backtrace.dump"s;
 }
 
+/**
+ * Written by shutdown_handler(), read by the thread started in handle_shutdown_signals()
+ */
+static int shutdown_pipe[2] = {-1, -1};
+
 /**
  * Keep this as small as possible, make sure to only use async-signal-safe functions
  */
@@ -67,10 +74,34 @@ static void shutdown_handler(int signum) {
   if (signum == SIGABRT || signum == SIGSEGV) {
     auto stack_file = backtrace_file_src();
     safe_dump_stacktrace_to(stack_file);
+  } else if (shutdown_pipe[1] >= 0 && write(shutdown_pipe[1], &signum, sizeof(signum)) == sizeof(signum)) {
+    return; // The shutdown will be completed outside of the signal handler
   }
   exit(signum);
 }
 
+/**
+ * Graceful shutdown signals (SIGINT, SIGTERM, ...) are forwarded by shutdown_handler() to a separate thread so that
+ * we can safely flush the logs before exiting.
+ */
+static void handle_shutdown_signals() {
+  if (pipe(shutdown_pipe) != 0) {
+    logs::log(logs::warning, "Unable to create the shutdown pipe, logs might be lost on exit");
+    return;
+  }
+  std::thread([]() {
+    int signum = 0;
+    while (read(shutdown_pipe[0], &signum, sizeof(signum)) != sizeof(signum)) {
+      if (errno != EINTR) {
+        return;
+      }
+    }
+    logs::log(logs::info, "Received signal {}, shutting down", signum);
+    logs::flush();
+    exit(signum);
+  }).detach();
+}
+
 /**
  * @brief: if an exception was raised we should have created a dump file, here we can pretty print it
  */
@@ -95,6 +126,7 @@ static void on_terminate() {
       logs::log(logs::error, "Unhandled exception: {}", e.what());
     }
   }
+  logs::flush();
 
   shutdown_handler(SIGABRT);
 }
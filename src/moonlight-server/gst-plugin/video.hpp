@@ -86,7 +86,7 @@ static GstBuffer *prepend_video_header(const gst_rtp_moonlight_pay_video &rtpmoo
   bool is_key = !GST_BUFFER_FLAG_IS_SET(inbuf, GST_BUFFER_FLAG_DELTA_UNIT);
 
   if (is_key) {
-    logs::log(logs::trace, "[GStreamer] KEYFRAME!");
+    WOLF_LOG(logs::trace, "[GStreamer] KEYFRAME!");
   }
 
   /* get WRITE access to the memory */
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <immer/box.hpp>
+#include <map>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -22,4 +25,58 @@ enum GPU_VENDOR {
 
 GPU_VENDOR get_vendor(std::string_view gpu);
 
+/**
+ * Everything we need to know about a GPU in order to run an app on it
+ */
+struct GPUInfo {
+  std::string render_node;
+  std::string primary_node; // empty when not available
+  std::string pci_slot;     // ex: 0000:01:00.0, empty when it's not a PCI device
+  std::uint16_t vendor_id = 0;
+  std::uint16_t device_id = 0;
+  GPU_VENDOR vendor = UNKNOWN;
+  std::vector<std::string> linked_devices; // see: linked_devices()
+  std::string driver_version;              // see: get_driver_version()
+};
+
+using HardwareInventory = std::map<std::string /* render node */, GPUInfo>;
+
+/**
+ * All the GPUs on this host, probed once on first use (and again when they change, see: watch_hardware_changes()).
+ * The other methods in this file will just look up GPUs in here instead of going through libdrm, libpci and sysfs.
+ */
+immer::box<HardwareInventory> get_hardware_inventory();
+
+/**
+ * Starts listening on a background thread for DRM devices being added or removed, the hardware inventory will be
+ * probed again when that happens.
+ */
+void watch_hardware_changes();
+
+/**
+ * @return a description of the kernel driver (name and version) behind the given render node,
+ *         an empty string if it can't be detected
+ */
+std::string get_driver_version(std::string_view gpu);
+
+/**
+ * @return all the render nodes (ex: /dev/dri/renderD128) available on this host, sorted by name
+ */
+std::vector<std::string> get_render_nodes();
+
+/**
+ * @return true if both render nodes are backed by the same GPU model (same PCI vendor and device id)
+ */
+bool is_same_gpu_model(std::string_view gpu_a, std::string_view gpu_b);
+
+/**
+ * Reads the DRM usage stats (see: https://docs.kernel.org/gpu/drm-usage-stats.html) exposed in /proc/<pid>/fdinfo
+ * and adds up, for each engine of the given GPUs, the time that it has spent busy serving the clients that are
+ * currently running.
+ *
+ * GPUs whose driver doesn't expose usage stats will not be present in the returned map.
+ */
+std::map<std::string /* render node */, std::map<std::string /* engine */, std::uint64_t /* busy ns */>>
+get_gpu_busy_time(const std::vector<std::string> &render_nodes);
+
 std::string get_mac_address(std::string_view local_ip);
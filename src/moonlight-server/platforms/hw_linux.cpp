@@ -1,5 +1,8 @@
 #include "hw.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cctype>
+#include <cstring>
 #include <fcntl.h>
 #include <filesystem>
 #include <fmt/core.h>
@@ -7,12 +10,19 @@
 #include <helpers/logger.hpp>
 #include <helpers/utils.hpp>
 #include <ifaddrs.h>
+#include <immer/atom.hpp>
 #include <iostream>
+#include <libudev.h>
 #include <linux/if_packet.h>
+#include <memory>
 #include <net/ethernet.h>
 #include <netinet/in.h>
 #include <optional>
+#include <poll.h>
+#include <set>
+#include <sstream>
 #include <sys/socket.h>
+#include <thread>
 #include <unistd.h>
 
 extern "C" {
@@ -96,26 +106,22 @@ std::shared_ptr<drmDevice> drm_open_device(std::string_view device) {
   drmDevice *dev = nullptr;
   auto ret = drmGetDevice2(render_node_fd, 0, &dev);
   if (ret < 0) {
+    if (render_node_fd >= 0) {
+      close(render_node_fd);
+    }
     throw std::runtime_error(fmt::format("Error during drmGetDevice for {}, {}", device, strerror(-ret)));
   }
 
-  return {dev, [&render_node_fd](auto dev) {
+  return {dev, [render_node_fd](auto dev) {
             drmFreeDevice(&dev);
             close(render_node_fd);
           }};
 }
 
-std::vector<std::string> linked_devices(std::string_view gpu) {
+static std::vector<std::string> probe_linked_devices(std::string_view gpu, const drmDevice &device) {
   std::vector<std::string> found_devices;
-
-  if (!std::filesystem::exists(gpu)) {
-    logs::log(logs::warning, "{} doesn't exists, automatic device recognition failed", gpu);
-    return {};
-  }
-  auto device = drm_open_device(gpu);
-
-  if (device->available_nodes & (1 << DRM_NODE_PRIMARY)) {
-    std::string primary_node = device->nodes[DRM_NODE_PRIMARY];
+  if (device.available_nodes & (1 << DRM_NODE_PRIMARY)) {
+    std::string primary_node = device.nodes[DRM_NODE_PRIMARY];
     found_devices.emplace_back(primary_node);
     if (auto nvidia_node = get_nvidia_node(primary_node)) {
       found_devices.emplace_back(nvidia_node.value());
@@ -134,32 +140,15 @@ std::vector<std::string> linked_devices(std::string_view gpu) {
       }
     }
   } else {
-    logs::log(logs::warning, "{} doesn't have a primary node! Available nodes: {}", gpu, device->available_nodes);
+    logs::log(logs::warning, "{} doesn't have a primary node! Available nodes: {}", gpu, device.available_nodes);
   }
-
   return found_devices;
 }
 
-GPU_VENDOR get_vendor(std::string_view gpu) {
-  if (!std::filesystem::exists(gpu)) {
-    logs::log(logs::warning, "{} doesn't exists, automatic vendor recognition failed", gpu);
-    return UNKNOWN;
-  }
-  auto device = drm_open_device(gpu);
-
-  pci_access *pacc = pci_alloc();
-  pci_init(pacc);
-  pci_scan_bus(pacc);
+static GPU_VENDOR probe_vendor(pci_access *pacc, const drmPciDeviceInfo &pci_info) {
   char devbuf[256];
-  std::string vendor_name = pci_lookup_name(pacc,
-                                            devbuf,
-                                            sizeof(devbuf),
-                                            PCI_LOOKUP_VENDOR,
-                                            device->deviceinfo.pci->vendor_id,
-                                            device->deviceinfo.pci->device_id);
-  pci_cleanup(pacc);
-
-  logs::log(logs::debug, "{} vendor: {}", gpu, vendor_name);
+  std::string vendor_name =
+      pci_lookup_name(pacc, devbuf, sizeof(devbuf), PCI_LOOKUP_VENDOR, pci_info.vendor_id, pci_info.device_id);
 
   vendor_name = utils::to_lower(vendor_name);
   if (vendor_name.find("nvidia") != std::string::npos) {
@@ -174,6 +163,257 @@ GPU_VENDOR get_vendor(std::string_view gpu) {
   return UNKNOWN;
 }
 
+static std::string probe_driver_version(std::string_view gpu) {
+  std::string result;
+  auto fd = open(gpu.data(), O_RDWR | O_CLOEXEC);
+  if (fd >= 0) {
+    if (auto version = drmGetVersion(fd)) {
+      result = fmt::format("{} {}.{}.{}",
+                           version->name,
+                           version->version_major,
+                           version->version_minor,
+                           version->version_patchlevel);
+      drmFreeVersion(version);
+    }
+    close(fd);
+  }
+
+  // The version of the Nvidia proprietary driver is not the one reported by nvidia-drm
+  std::ifstream nvidia_version("/proc/driver/nvidia/version");
+  std::string line;
+  if (nvidia_version.is_open() && std::getline(nvidia_version, line)) {
+    result += " " + line;
+  }
+  return result;
+}
+
+static GPUInfo probe_gpu(pci_access *pacc, const std::string &render_node) {
+  auto device = drm_open_device(render_node);
+  GPUInfo gpu = {.render_node = render_node};
+  if (device->available_nodes & (1 << DRM_NODE_PRIMARY)) {
+    gpu.primary_node = device->nodes[DRM_NODE_PRIMARY];
+  }
+  if (device->bustype == DRM_BUS_PCI) {
+    auto bus = device->businfo.pci;
+    gpu.pci_slot = fmt::format("{:04x}:{:02x}:{:02x}.{:x}", bus->domain, bus->bus, bus->dev, bus->func);
+    gpu.vendor_id = device->deviceinfo.pci->vendor_id;
+    gpu.device_id = device->deviceinfo.pci->device_id;
+    gpu.vendor = probe_vendor(pacc, *device->deviceinfo.pci);
+  }
+  gpu.linked_devices = probe_linked_devices(render_node, *device);
+  gpu.driver_version = probe_driver_version(render_node);
+  logs::log(logs::debug,
+            "[HW] {} pci: {} driver: {} linked devices: {}",
+            gpu.render_node,
+            gpu.pci_slot,
+            gpu.driver_version,
+            gpu.linked_devices);
+  return gpu;
+}
+
+static HardwareInventory probe_gpus(const std::vector<std::string> &render_nodes) {
+  HardwareInventory inventory;
+  // Scanning the PCI bus is slow, let's do it only once for all the GPUs
+  pci_access *pacc = pci_alloc();
+  pci_init(pacc);
+  pci_scan_bus(pacc);
+  for (const auto &render_node : render_nodes) {
+    try {
+      inventory[render_node] = probe_gpu(pacc, render_node);
+    } catch (const std::exception &e) {
+      logs::log(logs::warning, "[HW] Unable to probe {}: {}", render_node, e.what());
+    }
+  }
+  pci_cleanup(pacc);
+  return inventory;
+}
+
+static std::vector<std::string> list_render_nodes() {
+  std::vector<std::string> render_nodes;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator("/dev/dri", ec)) {
+    if (entry.path().filename().string().rfind("renderD", 0) == 0) {
+      render_nodes.push_back(entry.path().string());
+    }
+  }
+  std::sort(render_nodes.begin(), render_nodes.end());
+  return render_nodes;
+}
+
+static immer::atom<HardwareInventory> &inventory_atom() {
+  static immer::atom<HardwareInventory> inventory{probe_gpus(list_render_nodes())};
+  return inventory;
+}
+
+static void refresh_hardware_inventory() {
+  auto inventory = probe_gpus(list_render_nodes());
+  logs::log(logs::info, "[HW] Hardware changed, found {} GPUs", inventory.size());
+  inventory_atom().store(std::move(inventory));
+}
+
+immer::box<HardwareInventory> get_hardware_inventory() {
+  return inventory_atom().load();
+}
+
+void watch_hardware_changes() {
+  std::thread([]() {
+    std::unique_ptr<udev, decltype(&udev_unref)> udev_ctx(udev_new(), udev_unref);
+    std::unique_ptr<udev_monitor, decltype(&udev_monitor_unref)> monitor(
+        udev_ctx ? udev_monitor_new_from_netlink(udev_ctx.get(), "udev") : nullptr,
+        udev_monitor_unref);
+    if (!monitor || udev_monitor_filter_add_match_subsystem_devtype(monitor.get(), "drm", nullptr) < 0 ||
+        udev_monitor_enable_receiving(monitor.get()) < 0) {
+      logs::log(logs::warning, "[HW] Unable to monitor udev, GPUs hotplug will not be detected");
+      return;
+    }
+
+    pollfd monitor_fd = {.fd = udev_monitor_get_fd(monitor.get()), .events = POLLIN};
+    while (true) {
+      if (poll(&monitor_fd, 1, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logs::log(logs::warning, "[HW] Stopped monitoring udev: {}", strerror(errno));
+        return;
+      }
+
+      bool changed = false;
+      while (auto device = udev_monitor_receive_device(monitor.get())) {
+        auto action = udev_device_get_action(device);
+        // Connectors hotplug on the primary nodes will show up as "change", the GPUs stay the same
+        if (action && (std::strcmp(action, "add") == 0 || std::strcmp(action, "remove") == 0)) {
+          logs::log(logs::debug, "[HW] {} {}", action, udev_device_get_syspath(device));
+          changed = true;
+        }
+        udev_device_unref(device);
+      }
+      if (changed) {
+        refresh_hardware_inventory();
+      }
+    }
+  }).detach();
+}
+
+/**
+ * @return the cached GPU, falls back to probing it directly when it's not a render node known to the inventory
+ */
+static std::optional<GPUInfo> find_gpu(std::string_view gpu) {
+  auto inventory = get_hardware_inventory();
+  auto found = inventory->find(std::string(gpu));
+  if (found != inventory->end()) {
+    return found->second;
+  }
+  if (!std::filesystem::exists(gpu)) {
+    return {};
+  }
+  auto probed = probe_gpus({std::string(gpu)});
+  if (probed.empty()) {
+    return {};
+  }
+  return probed.begin()->second;
+}
+
+std::vector<std::string> linked_devices(std::string_view gpu) {
+  if (auto found = find_gpu(gpu)) {
+    return found->linked_devices;
+  }
+  logs::log(logs::warning, "{} doesn't exists, automatic device recognition failed", gpu);
+  return {};
+}
+
+GPU_VENDOR get_vendor(std::string_view gpu) {
+  if (auto found = find_gpu(gpu)) {
+    return found->vendor;
+  }
+  logs::log(logs::warning, "{} doesn't exists, automatic vendor recognition failed", gpu);
+  return UNKNOWN;
+}
+
+std::string get_driver_version(std::string_view gpu) {
+  if (auto found = find_gpu(gpu)) {
+    return found->driver_version;
+  }
+  return probe_driver_version(gpu);
+}
+
+std::vector<std::string> get_render_nodes() {
+  std::vector<std::string> render_nodes;
+  for (const auto &[render_node, gpu] : *get_hardware_inventory()) {
+    render_nodes.push_back(render_node);
+  }
+  return render_nodes;
+}
+
+bool is_same_gpu_model(std::string_view gpu_a, std::string_view gpu_b) {
+  if (gpu_a == gpu_b) {
+    return true;
+  }
+  auto a = find_gpu(gpu_a);
+  auto b = find_gpu(gpu_b);
+  return a && b && !a->pci_slot.empty() && !b->pci_slot.empty() && a->vendor_id == b->vendor_id &&
+         a->device_id == b->device_id;
+}
+
+std::map<std::string, std::map<std::string, std::uint64_t>> get_gpu_busy_time(const std::vector<std::string> &gpus) {
+  std::map<std::string /* pci slot */, std::string /* render node */> render_nodes;
+  for (const auto &gpu : gpus) {
+    if (auto found = find_gpu(gpu); found && !found->pci_slot.empty()) {
+      render_nodes[found->pci_slot] = gpu;
+    }
+  }
+
+  std::map<std::string, std::map<std::string, std::uint64_t>> busy_time;
+  // The same DRM client can be shared by multiple file descriptors (and processes), it should only be counted once
+  std::set<std::pair<std::string /* pci slot */, std::string /* client id */>> seen_clients;
+  std::error_code ec;
+  for (const auto &proc : std::filesystem::directory_iterator("/proc", ec)) {
+    auto pid = proc.path().filename().string();
+    if (!std::all_of(pid.begin(), pid.end(), [](unsigned char c) { return std::isdigit(c); })) {
+      continue;
+    }
+
+    try {
+      std::error_code fd_ec; // We can't look into processes owned by other users, or that just exited
+      for (const auto &fdinfo : std::filesystem::directory_iterator(proc.path() / "fdinfo", fd_ec)) {
+        std::ifstream file(fdinfo.path());
+        std::string line, pdev, client_id;
+        std::map<std::string, std::uint64_t> engines;
+        while (std::getline(file, line)) {
+          auto separator = line.find(':');
+          if (separator == std::string::npos) {
+            continue;
+          }
+          auto key = line.substr(0, separator);
+          std::istringstream value(line.substr(separator + 1));
+          if (key == "drm-pdev") {
+            value >> pdev;
+          } else if (key == "drm-client-id") {
+            value >> client_id;
+          } else if (key.rfind("drm-engine-", 0) == 0 && key.rfind("drm-engine-capacity-", 0) != 0) {
+            std::uint64_t ns = 0;
+            value >> ns;
+            engines[key.substr(std::strlen("drm-engine-"))] = ns;
+          }
+        }
+
+        auto render_node = render_nodes.find(pdev);
+        if (client_id.empty()) { // Older kernels, we can't tell if this has already been counted
+          client_id = fdinfo.path().string();
+        }
+        if (render_node != render_nodes.end() && seen_clients.insert({pdev, client_id}).second) {
+          auto &gpu_time = busy_time[render_node->second];
+          for (const auto &[engine, ns] : engines) {
+            gpu_time[engine] += ns;
+          }
+        }
+      }
+    } catch (const std::filesystem::filesystem_error &err) {
+      logs::log(logs::trace, "Unable to read {}: {}", proc.path().string(), err.what());
+    }
+  }
+  return busy_time;
+}
+
 std::string get_ip_address(ifaddrs *ifa) {
   if (ifa->ifa_addr->sa_family == AF_INET) { // IP4
     auto tmpAddrPtr = &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
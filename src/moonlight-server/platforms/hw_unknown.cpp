@@ -8,6 +8,28 @@ GPU_VENDOR get_vendor(std::string_view gpu) {
   return UNKNOWN;
 }
 
+immer::box<HardwareInventory> get_hardware_inventory() {
+  return {};
+}
+
+void watch_hardware_changes() {}
+
+std::string get_driver_version(std::string_view gpu) {
+  return "";
+}
+
+std::vector<std::string> get_render_nodes() {
+  return {};
+}
+
+bool is_same_gpu_model(std::string_view gpu_a, std::string_view gpu_b) {
+  return gpu_a == gpu_b;
+}
+
+std::map<std::string, std::map<std::string, std::uint64_t>> get_gpu_busy_time(const std::vector<std::string> &) {
+  return {};
+}
+
 std::string get_mac_address(std::string_view local_ip) {
   return "00:00:00:00:00:00"
 }
\ No newline at end of file
@@ -41,7 +41,7 @@ static const std::map<short, short> key_mappings = {
 void paste_utf(state::KeyboardTypes &keyboard, const std::basic_string<char32_t> &utf32) {
   /* To HEX string */
   auto hex_unicode = to_hex(utf32);
-  logs::log(logs::debug, "[INPUT] Typing U+{}", hex_unicode);
+  WOLF_LOG(logs::debug, "[INPUT] Typing U+{}", hex_unicode);
 
   std::visit(
       [hex_unicode](auto &kb) {
@@ -12,8 +12,8 @@
 #include <range/v3/view.hpp>
 #include <rest/helpers.hpp>
 #include <rest/rest.hpp>
-#include <rtp/udp-ping.hpp>
 #include <state/config.hpp>
+#include <state/gpu-scheduler.hpp>
 #include <state/sessions.hpp>
 #include <utility>
 
@@ -238,8 +238,9 @@ void applist(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>:
 state::StreamSession
 create_run_session(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>::Request> &request,
                    const state::PairedClient &current_client,
-                   std::shared_ptr<dp::event_bus> event_bus,
-                   const state::App &run_app) {
+                   std::shared_ptr<events::EventBus> event_bus,
+                   const state::App &run_app,
+                   const state::SessionPorts &ports) {
   SimpleWeb::CaseInsensitiveMultimap headers = request->parse_query_string();
   auto display_mode_str = utils::split(get_header(headers, "mode").value_or("1920x1080x60"), 'x');
   moonlight::DisplayMode display_mode = {std::stoi(display_mode_str[0].data()),
@@ -268,28 +269,30 @@ create_run_session(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::H
 
                               // client info
                               .session_id = get_client_id(current_client),
-                              .ip = get_client_ip<SimpleWeb::HTTPS>(request)};
+                              .ip = get_client_ip<SimpleWeb::HTTPS>(request),
+
+                              // leased ports
+                              .video_port = ports.video,
+                              .audio_port = ports.audio};
 }
 
-void start_rtp_ping(const immer::box<state::AppState> &state) {
-  auto number_of_sessions = state->running_sessions->load()->size() - 1;
-  unsigned short video_port = state::VIDEO_PING_PORT + number_of_sessions;
-
-  // Video RTP Ping
-  rtp::wait_for_ping(video_port, [state](unsigned short client_port, const std::string &client_ip) {
-    logs::log(logs::trace, "[PING] video from {}:{}", client_ip, client_port);
-    auto ev = state::RTPVideoPingEvent{.client_ip = client_ip, .client_port = client_port};
-    state->event_bus->fire_event(immer::box<state::RTPVideoPingEvent>(ev));
-  });
-
-  unsigned short audio_port = state::AUDIO_PING_PORT + number_of_sessions;
-
-  // Audio RTP Ping
-  rtp::wait_for_ping(audio_port, [state](unsigned short client_port, const std::string &client_ip) {
-    logs::log(logs::trace, "[PING] audio from {}:{}", client_ip, client_port);
-    auto ev = state::RTPAudioPingEvent{.client_ip = client_ip, .client_port = client_port};
-    state->event_bus->fire_event(immer::box<state::RTPAudioPingEvent>(ev));
-  });
+/**
+ * A spectator shares everything with the host session (app, display, devices) except for the network side:
+ * ports, encryption keys and client address are its own.
+ */
+state::StreamSession make_spectator_session(state::StreamSession spectator, const state::StreamSession &host) {
+  spectator.host_session_id = host.session_id;
+  spectator.app = host.app;
+  spectator.display_mode = host.display_mode;
+  spectator.wayland_display = host.wayland_display;
+  spectator.mouse = host.mouse;
+  spectator.keyboard = host.keyboard;
+  spectator.joypads = host.joypads;
+  spectator.pen_tablet = host.pen_tablet;
+  spectator.touch_screen = host.touch_screen;
+  // Input has to be explicitly granted, see: state::SpectatorInputEvent
+  spectator.input_allowed = std::make_shared<std::atomic<bool>>(false);
+  return spectator;
 }
 
 void launch(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>::Response> &response,
@@ -300,12 +303,34 @@ void launch(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>::
 
   SimpleWeb::CaseInsensitiveMultimap headers = request->parse_query_string();
   auto app = state::get_app_by_id(state->config, get_header(headers, "appid").value());
-  auto new_session = create_run_session(request, current_client, state->event_bus, app);
-  state->event_bus->fire_event(immer::box<state::StreamSession>(new_session));
-  state->running_sessions->update(
-      [&new_session](const immer::vector<state::StreamSession> &ses_v) { return ses_v.push_back(new_session); });
-
-  start_rtp_ping(state);
+  auto ports = lease_ports(state->port_leases, get_client_id(current_client));
+  if (!ports) {
+    logs::log(logs::warning, "[HTTPS] Unable to launch a new session, all the streaming ports are already in use");
+    server_error<SimpleWeb::HTTPS>(response);
+    return;
+  }
+  auto new_session = create_run_session(request, current_client, state->event_bus, app, *ports);
+  auto host_session = app->allow_spectators ? get_host_session_by_app(state->running_sessions->load(), app->base.id)
+                                            : std::optional<state::StreamSession>();
+  if (host_session && host_session->session_id != new_session.session_id) {
+    logs::log(logs::info,
+              "[HTTPS] Session {} joined session {} as a spectator",
+              new_session.session_id,
+              host_session->session_id);
+    // No need to start the app, the spectator will be attached to the host video pipeline
+    new_session = make_spectator_session(new_session, *host_session);
+    state->running_sessions->update(
+        [&new_session](const immer::vector<state::StreamSession> &ses_v) { return ses_v.push_back(new_session); });
+  } else {
+    // The app is a copy owned by this session, it's safe to pin it to a specific GPU.
+    // Picking the GPU while adding the session means that concurrent launches will account for each other.
+    state->running_sessions->update([&new_session, &app](const immer::vector<state::StreamSession> &ses_v) {
+      new_session.app->render_node = state::schedule_render_node(ses_v, *app);
+      return ses_v.push_back(new_session);
+    });
+    logs::log(logs::info, "[HTTPS] Session {} will run on {}", new_session.session_id, new_session.app->render_node);
+    state->event_bus->fire_event(immer::box<state::StreamSession>(new_session));
+  }
 
   auto xml =
       moonlight::launch_success(get_host_ip<SimpleWeb::HTTPS>(request, state), std::to_string(state::RTSP_SETUP_PORT));
@@ -321,7 +346,9 @@ void resume(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>::
   auto client_ip = get_client_ip<SimpleWeb::HTTPS>(request);
   auto old_session = get_session_by_ip(state->running_sessions->load(), client_ip);
   if (old_session) {
-    auto new_session = create_run_session(request, current_client, state->event_bus, *old_session->app);
+    // The session keeps the ports that have been leased on launch
+    auto ports = state::SessionPorts{.video = old_session->video_port, .audio = old_session->audio_port};
+    auto new_session = create_run_session(request, current_client, state->event_bus, *old_session->app, ports);
     // Carry over the old session display handle
     new_session.wayland_display = std::move(old_session->wayland_display);
     // Carry over the old session devices, they'll be already plugged into the container
@@ -330,8 +357,9 @@ void resume(const std::shared_ptr<typename SimpleWeb::Server<SimpleWeb::HTTPS>::
     new_session.joypads = std::move(old_session->joypads);
     new_session.pen_tablet = std::move(old_session->pen_tablet);
     new_session.touch_screen = std::move(old_session->touch_screen);
-
-    start_rtp_ping(state);
+    // Spectators will keep watching the same host session
+    new_session.host_session_id = old_session->host_session_id;
+    new_session.input_allowed = std::move(old_session->input_allowed);
 
     state->running_sessions->update([&old_session, &new_session](const immer::vector<state::StreamSession> ses_v) {
       return remove_session(ses_v, old_session.value()).push_back(new_session);
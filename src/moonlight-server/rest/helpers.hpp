@@ -25,14 +25,14 @@ template <class T> std::string get_client_ip(std::shared_ptr<typename SimpleWeb:
  * @brief Log the request
  */
 template <class T> inline void log_req(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
-  logs::log(logs::debug,
-            "{} [{}] {}://{}{}",
-            get_client_ip<T>(request),
-            request->method,
-            std::is_same_v<SimpleWeb::HTTP, T> ? "HTTP" : "HTTPS",
-            request->local_endpoint().address().to_string(),
-            request->path);
-  logs::log(logs::trace, "Header: {}", request->parse_query_string());
+  WOLF_LOG(logs::debug,
+           "{} [{}] {}://{}{}",
+           get_client_ip<T>(request),
+           request->method,
+           std::is_same_v<SimpleWeb::HTTP, T> ? "HTTP" : "HTTPS",
+           request->local_endpoint().address().to_string(),
+           request->path);
+  WOLF_LOG(logs::trace, "Header: {}", request->parse_query_string());
 }
 
 /**
@@ -44,7 +44,7 @@ inline void send_xml(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response
                      const XML &xml) {
   std::ostringstream data;
   pt::write_xml(data, xml);
-  logs::log(logs::trace, "Response: {}", xml_to_str(xml));
+  WOLF_LOG(logs::trace, "Response: {}", data.str());
   response->write(status_code, data.str());
   response->close_connection_after_response = true;
 }
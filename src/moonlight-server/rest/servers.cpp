@@ -42,7 +42,7 @@ void startServer(HttpServer *server, const immer::box<state::AppState> state, in
 
       auto pin = pt.get<std::string>("pin");
       auto secret = pt.get<std::string>("secret");
-      logs::log(logs::debug, "Received POST /pin/ pin:{} secret:{}", pin, secret);
+      WOLF_LOG(logs::debug, "Received POST /pin/ pin:{} secret:{}", pin, secret);
 
       auto pair_request = pairing_atom->load()->at(secret);
       pair_request->user_pin->set_value(pin);
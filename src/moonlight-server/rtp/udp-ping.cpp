@@ -1,71 +1,87 @@
-#include <boost/bind/bind.hpp>
-#include <boost/enable_shared_from_this.hpp>
 #include <rtp/udp-ping.hpp>
-#include <thread>
 
 namespace rtp {
 
-UDP_Server::UDP_Server(
-    unsigned short port,
-    const std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> &callback)
-    : io_context(), socket_(io_context, udp::endpoint(udp::v4(), port)), callback(callback) {
-  // We have to enable this because we'll bind additional sockets as udpsink in the audio/video pipelines
-  socket_.set_option(udp::socket::reuse_address(true));
-  start_receive();
+PingListener::PingListener(boost::asio::io_context &io_context,
+                           unsigned short first_port,
+                           unsigned short n_ports,
+                           ping_callback on_ping)
+    : on_ping(std::move(on_ping)) {
+  for (unsigned short port = first_port; port < first_port + n_ports; port++) {
+    try {
+      auto sock = std::make_unique<port_socket>(port_socket{.port = port, .socket = udp::socket(io_context)});
+      sock->socket.open(udp::v4());
+      // We have to enable this because we'll bind additional sockets as udpsink in the audio/video pipelines
+      sock->socket.set_option(udp::socket::reuse_address(true));
+      sock->socket.bind(udp::endpoint(udp::v4(), port));
+      sockets.push_back(std::move(sock));
+    } catch (std::exception &e) {
+      logs::log(logs::warning, "[RTP] Unable to start RTP server on {}: {}", port, e.what());
+    }
+  }
+  logs::log(logs::info, "RTP server started on ports: {}-{}", first_port, first_port + n_ports - 1);
 }
 
-UDP_Server::~UDP_Server() {
-  socket_.close();
-  io_context.stop();
+PingListener::~PingListener() {
+  for (auto &sock : sockets) {
+    boost::system::error_code ec;
+    sock->socket.close(ec);
+  }
 }
 
-void UDP_Server::run(std::chrono::milliseconds timeout) {
-  io_context.run_for(timeout);
+void PingListener::start() {
+  for (auto &sock : sockets) {
+    start_receive(*sock);
+  }
 }
 
-void UDP_Server::start_receive() {
-  socket_.async_receive_from(boost::asio::buffer(recv_buffer_),
-                             remote_endpoint_,
-                             boost::bind(&UDP_Server::handle_receive,
-                                         this,
-                                         boost::asio::placeholders::error,
-                                         boost::asio::placeholders::bytes_transferred));
+std::size_t PingListener::expect(unsigned short host_port, const std::string &client_ip) {
+  std::lock_guard<std::mutex> lock(pending_m);
+  auto expect_id = next_expect_id++;
+  pending[{host_port, client_ip}] = expect_id;
+  return expect_id;
 }
 
-void UDP_Server::handle_receive(const boost::system::error_code &error, std::size_t /*bytes_transferred*/) {
-  if (!error) {
-    auto client_ip = remote_endpoint_.address().to_string();
-    auto client_port = remote_endpoint_.port();
-
-    logs::log(logs::trace, "[RTP] Received ping from {}:{}", client_ip, client_port);
-    callback(client_port, client_ip);
-    // We'll keep receiving pings and sending callback events until the timeout elapsed.
-    // This is because we don't know if downstream they are ready to start the session.
-    // Downstream will make sure to only send one ping per session
-    std::this_thread::sleep_for(std::chrono::milliseconds(500)); // let's avoid spamming though
-    start_receive();
+void PingListener::forget(unsigned short host_port, const std::string &client_ip, std::size_t expect_id) {
+  std::lock_guard<std::mutex> lock(pending_m);
+  auto it = pending.find({host_port, client_ip});
+  if (it != pending.end() && it->second == expect_id) {
+    pending.erase(it);
   }
 }
 
-void wait_for_ping(
-    unsigned short port,
-    const std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> &callback) {
-  auto thread = std::thread(
-      [port](
-          const std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> &callback) {
-        try {
-          auto server = UDP_Server(port, callback);
+void PingListener::start_receive(port_socket &sock) {
+  sock.socket.async_receive_from(boost::asio::buffer(sock.recv_buffer),
+                                 sock.remote_endpoint,
+                                 [self = shared_from_this(), &sock](const boost::system::error_code &error,
+                                                                    std::size_t /*bytes_transferred*/) {
+                                   self->handle_receive(sock, error);
+                                 });
+}
+
+void PingListener::handle_receive(port_socket &sock, const boost::system::error_code &error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+
+  if (!error) {
+    auto client_ip = sock.remote_endpoint.address().to_string();
+    auto client_port = sock.remote_endpoint.port();
+    WOLF_LOG(logs::trace, "[RTP] Received ping from {}:{} on port {}", client_ip, client_port, sock.port);
+
+    bool expected = false;
+    {
+      std::lock_guard<std::mutex> lock(pending_m);
+      expected = pending.erase({sock.port, client_ip}) > 0;
+    }
 
-          logs::log(logs::info, "RTP server started on port: {}", port);
-          server.run(std::chrono::seconds(4));
-          logs::log(logs::debug, "RTP server on port: {} stopped", port);
+    // Moonlight will keep sending PINGs until the stream starts, we only care about the first one
+    if (expected) {
+      on_ping(sock.port, client_port, client_ip);
+    }
+  }
 
-        } catch (std::exception &e) {
-          logs::log(logs::warning, "[RTP] Unable to start RTP server on {}: {}", port, e.what());
-        }
-      },
-      callback);
-  thread.detach();
+  start_receive(sock);
 }
 
-} // namespace rtp
\ No newline at end of file
+} // namespace rtp
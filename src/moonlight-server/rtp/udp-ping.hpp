@@ -3,38 +3,70 @@
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <helpers/logger.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace rtp {
 
 using boost::asio::ip::udp;
 
 /**
- * Generic UDP server, adapted from:
- * https://www.boost.org/doc/libs/1_81_0/doc/html/boost_asio/tutorial/tutdaytime6/src.html
+ * A long lived UDP listener for the RTP PING packets that Moonlight sends before starting a stream.
+ *
+ * A single instance listens on a whole range of ports using a shared io_context (no dedicated threads).
+ * Sessions that are waiting for a PING have to call expect(), the first PING coming from the expected
+ * client IP on the expected port will call on_ping straight away; any other PING is ignored.
  */
-class UDP_Server : public boost::enable_shared_from_this<UDP_Server> {
+class PingListener : public std::enable_shared_from_this<PingListener> {
 public:
-  UDP_Server(
-      unsigned short port,
-      const std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> &callback);
+  using ping_callback = std::function<void(unsigned short /* host_port */,
+                                           unsigned short /* client_port */,
+                                           const std::string & /* client_ip */)>;
 
-  ~UDP_Server();
+  PingListener(boost::asio::io_context &io_context,
+               unsigned short first_port,
+               unsigned short n_ports,
+               ping_callback on_ping);
 
-  void run(std::chrono::milliseconds timeout);
+  ~PingListener();
+
+  /**
+   * Start listening, has to be called once the listener is owned by a shared_ptr
+   */
+  void start();
+
+  /**
+   * Wait for a PING from client_ip on host_port
+   * @return an id that can be used to stop waiting, see: forget()
+   */
+  std::size_t expect(unsigned short host_port, const std::string &client_ip);
+
+  /**
+   * Stop waiting for a PING, does nothing if the PING has already been received or if
+   * a newer expect() call has been made for the same host_port and client_ip
+   */
+  void forget(unsigned short host_port, const std::string &client_ip, std::size_t expect_id);
 
 private:
-  void start_receive();
-  void handle_receive(const boost::system::error_code &error, std::size_t /*bytes_transferred*/);
-
-  boost::asio::io_context io_context;
-  udp::socket socket_;
-  udp::endpoint remote_endpoint_;
-  boost::array<char, 1> recv_buffer_{};
-  std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> callback;
-};
+  struct port_socket {
+    unsigned short port;
+    udp::socket socket;
+    udp::endpoint remote_endpoint;
+    boost::array<char, 1> recv_buffer{};
+  };
 
-void wait_for_ping(
-    unsigned short port,
-    const std::function<void(unsigned short /* client_port */, const std::string & /* client_ip */)> &callback);
+  void start_receive(port_socket &sock);
+  void handle_receive(port_socket &sock, const boost::system::error_code &error);
+
+  std::vector<std::unique_ptr<port_socket>> sockets;
+  ping_callback on_ping;
+
+  std::mutex pending_m;
+  std::map<std::pair<unsigned short /* host_port */, std::string /* client_ip */>, std::size_t /* expect_id */>
+      pending;
+  std::size_t next_expect_id = 0;
+};
 
-} // namespace rtp
\ No newline at end of file
+} // namespace rtp
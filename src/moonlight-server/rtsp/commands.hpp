@@ -65,18 +65,18 @@ describe(const RTSP_PACKET &req, const state::StreamSession &session) {
   return ok_msg(req.seq_number, {}, payloads);
 }
 
-RTSP_PACKET setup(const RTSP_PACKET &req, unsigned short number_of_sessions) {
+RTSP_PACKET setup(const RTSP_PACKET &req, const state::StreamSession &session) {
 
   int service_port;
   auto type = req.request.stream.type;
-  logs::log(logs::trace, "[RTSP] setup type: {}", type);
+  WOLF_LOG(logs::trace, "[RTSP] setup type: {}", type);
 
   switch (utils::hash(type)) {
   case utils::hash("audio"):
-    service_port = state::AUDIO_PING_PORT + number_of_sessions;
+    service_port = session.audio_port;
     break;
   case utils::hash("video"):
-    service_port = state::VIDEO_PING_PORT + number_of_sessions;
+    service_port = session.video_port;
     break;
   case utils::hash("control"):
     service_port = state::CONTROL_PORT;
@@ -113,8 +113,7 @@ std::pair<std::string, std::optional<int>> parse_arg_line(const std::pair<std::s
 RTSP_PACKET
 announce(const RTSP_PACKET &req,
          const state::StreamSession &session,
-         std::shared_ptr<dp::event_bus> event_bus,
-         unsigned short number_of_sessions) {
+         std::shared_ptr<wolf::core::events::EventBus> event_bus) {
 
   auto args = req.payloads //
               | views::filter([](const std::pair<std::string, std::string> &line) {
@@ -136,25 +135,25 @@ announce(const RTSP_PACKET &req,
 
   std::string gst_pipeline;
   if (video_format_av1) {
-    logs::log(logs::debug, "[RTSP] Moonlight requested video format AV1");
+    WOLF_LOG(logs::debug, "[RTSP] Moonlight requested video format AV1");
     gst_pipeline = session.app->av1_gst_pipeline;
   } else if (video_format_hevc) {
-    logs::log(logs::debug, "[RTSP] Moonlight requested video format HEVC");
+    WOLF_LOG(logs::debug, "[RTSP] Moonlight requested video format HEVC");
     gst_pipeline = session.app->hevc_gst_pipeline;
   } else {
-    logs::log(logs::debug, "[RTSP] Moonlight requested video format H264");
+    WOLF_LOG(logs::debug, "[RTSP] Moonlight requested video format H264");
     gst_pipeline = session.app->h264_gst_pipeline;
   }
 
   // Video session
-  unsigned short video_port = state::VIDEO_PING_PORT + number_of_sessions;
   state::VideoSession video = {
       .display_mode = {.width = display.width, .height = display.height, .refreshRate = display.refreshRate},
       .gst_pipeline = gst_pipeline,
+      .render_node = session.app->render_node,
 
       .session_id = session.session_id,
 
-      .port = video_port,
+      .port = session.video_port,
       .timeout = std::chrono::milliseconds(args["x-nv-video[0].timeoutLengthMs"].value_or(7000)),
       .packet_size = args["x-nv-video[0].packetSize"].value_or(1024),
       .frames_with_invalid_ref_threshold = args["x-nv-video[0].framesWithInvalidRefThreshold"].value_or(0),
@@ -166,11 +165,11 @@ announce(const RTSP_PACKET &req,
       .color_range = (csc & 0x1) ? state::JPEG : state::MPEG,
       .color_space = state::ColorSpace(csc >> 1),
 
-      .client_ip = session.ip};
+      .client_ip = session.ip,
+      .host_session_id = session.host_session_id};
   event_bus->fire_event(immer::box<state::VideoSession>(video));
 
   // Audio session
-  unsigned short audio_port = state::AUDIO_PING_PORT + number_of_sessions;
   state::AudioSession audio = {
       .gst_pipeline = session.app->opus_gst_pipeline,
 
@@ -180,11 +179,12 @@ announce(const RTSP_PACKET &req,
       .aes_key = session.aes_key,
       .aes_iv = session.aes_iv,
 
-      .port = audio_port,
+      .port = session.audio_port,
       .client_ip = session.ip,
 
       .packet_duration = args["x-nv-aqos.packetDuration"].value_or(5),
-      .channels = args["x-nv-audio.surround.numChannels"].value_or(2)};
+      .channels = args["x-nv-audio.surround.numChannels"].value_or(2),
+      .host_session_id = session.host_session_id};
   event_bus->fire_event(immer::box<state::AudioSession>(audio));
 
   return ok_msg(req.seq_number);
@@ -193,10 +193,9 @@ announce(const RTSP_PACKET &req,
 RTSP_PACKET
 message_handler(const RTSP_PACKET &req,
                 const state::StreamSession &session,
-                std::shared_ptr<dp::event_bus> event_bus,
-                unsigned short number_of_sessions) {
+                std::shared_ptr<wolf::core::events::EventBus> event_bus) {
   auto cmd = req.request.cmd;
-  logs::log(logs::debug, "[RTSP] received command {}", cmd);
+  WOLF_LOG(logs::debug, "[RTSP] received command {}", cmd);
 
   switch (utils::hash(cmd)) {
   case utils::hash("OPTIONS"):
@@ -204,9 +203,9 @@ message_handler(const RTSP_PACKET &req,
   case utils::hash("DESCRIBE"):
     return describe(req, session);
   case utils::hash("SETUP"):
-    return setup(req, number_of_sessions);
+    return setup(req, session);
   case utils::hash("ANNOUNCE"):
-    return announce(req, session, event_bus, number_of_sessions);
+    return announce(req, session, event_bus);
   case utils::hash("PLAY"):
     return ok_msg(req.seq_number);
   default:
@@ -30,7 +30,7 @@ public:
 
   static pointer create(boost::asio::io_context &io_context,
                         const state::SessionsAtoms &stream_sessions,
-                        const std::shared_ptr<dp::event_bus> &event_bus) {
+                        const std::shared_ptr<wolf::core::events::EventBus> &event_bus) {
     return pointer(new tcp_connection(io_context, stream_sessions, event_bus));
   }
 
@@ -51,7 +51,7 @@ public:
    * - @cgutman
    */
   void close() {
-    logs::log(logs::trace, "[RTSP] closing socket");
+    WOLF_LOG(logs::trace, "[RTSP] closing socket");
     socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
     socket_.close();
   }
@@ -64,14 +64,13 @@ public:
    *  4- send back the response message
    */
   void start() {
-    logs::log(logs::trace, "[RTSP] received connection from IP: {}", socket().remote_endpoint().address().to_string());
+    WOLF_LOG(logs::trace, "[RTSP] received connection from IP: {}", socket().remote_endpoint().address().to_string());
     receive_message([self = shared_from_this()](auto parsed_msg) {
       if (parsed_msg) {
         auto user_ip = self->socket().remote_endpoint().address().to_string();
         auto session = get_session_by_ip(self->stream_sessions->load(), user_ip);
         if (session) {
-          auto session_idx = self->stream_sessions->load()->size() - 1;
-          auto response = commands::message_handler(parsed_msg.value(), session.value(), self->event_bus, session_idx);
+          auto response = commands::message_handler(parsed_msg.value(), session.value(), self->event_bus);
           self->send_message(response, [self](auto bytes) { self->close(); });
         } else {
           logs::log(logs::warning, "[RTSP] received packet from unrecognised client: {}", user_ip);
@@ -101,7 +100,7 @@ public:
   void receive_message(const std::function<void(std::optional<RTSP_PACKET>)> &on_msg_read) {
     deadline_.async_wait([self = shared_from_this()](auto error) {
       if (!error && self->deadline_.expiry() <= asio::steady_timer::clock_type::now()) { // The deadline has passed
-        logs::log(logs::trace, "[RTSP] deadline over");
+        WOLF_LOG(logs::trace, "[RTSP] deadline over");
         self->socket_.cancel();
         self->deadline_.cancel();
       }
@@ -121,7 +120,7 @@ public:
           }
           self->deadline_.cancel(); // stop the deadline
           std::string raw_msg = {std::istreambuf_iterator<char>(&self->streambuf_), {}};
-          logs::log(logs::trace, "[RTSP] received message {} bytes \n{}", bytes_transferred, raw_msg);
+          WOLF_LOG(logs::trace, "[RTSP] received message {} bytes \n{}", bytes_transferred, raw_msg);
 
           auto full_raw_msg = self->prev_read_ + raw_msg;
           auto total_bytes_transferred = self->prev_read_bytes_ + bytes_transferred;
@@ -157,14 +156,14 @@ public:
   void send_message(const rtsp::RTSP_PACKET &response,
                     const std::function<void(int /* bytes_transferred */)> &on_sent) {
     auto raw_response = rtsp::to_string(response);
-    logs::log(logs::trace, "[RTSP] sending reply: \n{}", raw_response);
+    WOLF_LOG(logs::trace, "[RTSP] sending reply: \n{}", raw_response);
     boost::asio::async_write(socket(),
                              boost::asio::buffer(raw_response),
                              [on_sent](auto error_code, auto bytes_transferred) {
                                if (error_code) {
                                  logs::log(logs::error, "[RTSP] error during transmission: {}", error_code.message());
                                }
-                               logs::log(logs::trace, "[RTSP] sent reply of size: {}", bytes_transferred);
+                               WOLF_LOG(logs::trace, "[RTSP] sent reply of size: {}", bytes_transferred);
                                on_sent(bytes_transferred);
                              });
   }
@@ -172,7 +171,7 @@ public:
 protected:
   explicit tcp_connection(boost::asio::io_context &io_context,
                           state::SessionsAtoms stream_sessions,
-                          const std::shared_ptr<dp::event_bus> &event_bus)
+                          const std::shared_ptr<wolf::core::events::EventBus> &event_bus)
       : socket_(io_context), streambuf_(max_msg_size), deadline_(io_context),
         stream_sessions(std::move(stream_sessions)), prev_read_bytes_(0), event_bus(event_bus) {}
   tcp::socket socket_;
@@ -186,7 +185,7 @@ protected:
   int prev_read_bytes_;
 
   state::SessionsAtoms stream_sessions;
-  std::shared_ptr<dp::event_bus> event_bus;
+  std::shared_ptr<wolf::core::events::EventBus> event_bus;
 };
 
 /**
@@ -198,7 +197,7 @@ public:
   tcp_server(boost::asio::io_context &io_context,
              int port,
              state::SessionsAtoms state,
-             const std::shared_ptr<dp::event_bus> &event_bus)
+             const std::shared_ptr<wolf::core::events::EventBus> &event_bus)
       : io_context_(io_context), acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
         stream_sessions(std::move(state)), event_bus(event_bus) {
     acceptor_.set_option(boost::asio::socket_base::reuse_address{true});
@@ -234,7 +233,7 @@ private:
   boost::asio::io_context &io_context_;
   tcp::acceptor acceptor_;
   state::SessionsAtoms stream_sessions;
-  std::shared_ptr<dp::event_bus> event_bus;
+  std::shared_ptr<wolf::core::events::EventBus> event_bus;
 };
 
 /**
@@ -242,7 +241,7 @@ private:
  */
 void run_server(int port,
                 const state::SessionsAtoms &running_sessions,
-                const std::shared_ptr<dp::event_bus> &event_bus) {
+                const std::shared_ptr<wolf::core::events::EventBus> &event_bus) {
   try {
     boost::asio::io_context io_context;
     tcp_server server(io_context, port, running_sessions, event_bus);
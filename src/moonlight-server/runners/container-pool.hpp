@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <core/docker.hpp>
+#include <filesystem>
+#include <fmt/core.h>
+#include <helpers/logger.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wolf::core::docker {
+
+/**
+ * A container that has been created ahead of time and that is waiting to be claimed by a session
+ */
+struct WarmContainer {
+  std::string id;
+  std::string shape; // see: ContainerPool::shape_of()
+  std::filesystem::path placeholders_folder;
+};
+
+/**
+ * A set of containers (for a single runner) that are created, but not started, ahead of time so that launching an
+ * app doesn't have to wait for Docker to create them.
+ *
+ * Docker doesn't allow changing the mounts or the devices of a container after it's been created: warm containers
+ * use placeholders instead, symlinks in the pool folder that Docker will only resolve once the container is started.
+ * Claiming a container points the placeholders to the paths of the session.
+ * The env can't be changed either, a warm container can only be claimed by a session with the very same env: runners
+ * have to keep session specific values out of it (see: RunDocker::make_container()).
+ */
+class ContainerPool : public std::enable_shared_from_this<ContainerPool> {
+public:
+  ContainerPool(DockerAPI docker_api, std::string name, std::size_t size, std::filesystem::path folder)
+      : docker_api(std::move(docker_api)), name(std::move(name)), size(size), folder(std::move(folder)) {}
+
+  /**
+   * Only absolute paths can be replaced by a placeholder, anything else is a Docker volume name.
+   */
+  static bool has_placeholder(const MountPoint &mount) {
+    return std::filesystem::path(mount.source).is_absolute();
+  }
+
+  /**
+   * Two containers with the same shape only differ in what can be changed by moving the placeholders
+   */
+  static std::string shape_of(const Container &container, std::string_view custom_params) {
+    std::string shape = fmt::format("{}\n{}\n", container.image, custom_params);
+    for (const auto &env : container.env) {
+      shape += fmt::format("env:{}\n", env);
+    }
+    for (const auto &mount : container.mounts) {
+      auto source = has_placeholder(mount) ? "" : mount.source;
+      shape += fmt::format("mount:{}:{}:{}\n", source, mount.destination, mount.mode);
+    }
+    for (const auto &device : container.devices) {
+      shape += fmt::format("device:{}:{}\n", device.path_in_container, device.cgroup_permission);
+    }
+    for (const auto &port : container.ports) {
+      shape += fmt::format("port:{}:{}:{}\n", port.private_port, port.public_port, static_cast<int>(port.type));
+    }
+    return shape;
+  }
+
+  /**
+   * @return a warm container that can be started in place of `container`, if available.
+   *         The container will be renamed to `container.name` and its placeholders will point to the session paths;
+   *         the placeholders folder has to be kept until the container is removed.
+   */
+  std::optional<WarmContainer> claim(const Container &container, std::string_view custom_params) {
+    auto shape = shape_of(container, custom_params);
+    std::optional<WarmContainer> warm;
+    {
+      std::lock_guard lock(mutex);
+      auto found = std::find_if(available.begin(), available.end(), [&](const auto &c) { return c.shape == shape; });
+      if (found != available.end()) {
+        warm = std::move(*found);
+        available.erase(found);
+      }
+    }
+    if (!warm) {
+      return {};
+    }
+
+    bool bound = true;
+    for (std::size_t i = 0; i < container.mounts.size(); i++) {
+      if (has_placeholder(container.mounts[i])) {
+        bound = bind_placeholder(warm->placeholders_folder / fmt::format("mount-{}", i), container.mounts[i].source) &&
+                bound;
+      }
+    }
+    for (std::size_t i = 0; i < container.devices.size(); i++) {
+      auto placeholder = warm->placeholders_folder / fmt::format("device-{}", i);
+      bound = bind_placeholder(placeholder, container.devices[i].path_on_host) && bound;
+    }
+
+    if (!bound || !docker_api.rename_by_id(warm->id, container.name)) {
+      logs::log(logs::warning, "[DOCKER] Unable to claim warm container {}, discarding it", warm->id);
+      discard({*warm});
+      return {};
+    }
+    logs::log(logs::debug, "[DOCKER] Claimed warm container {} as {}", warm->id, container.name);
+    return warm;
+  }
+
+  /**
+   * Creates, in the background, new warm containers shaped like `container` until the pool is full.
+   * Warm containers of a different shape will be removed.
+   */
+  void refill(const Container &container, std::string custom_params) {
+    auto shape = shape_of(container, custom_params);
+    std::vector<WarmContainer> outdated;
+    std::size_t missing = 0;
+    bool in_flight = false;
+    {
+      std::lock_guard lock(mutex);
+      auto split = std::stable_partition(available.begin(), available.end(), [&](const auto &c) {
+        return c.shape == shape;
+      });
+      outdated.insert(outdated.end(), std::make_move_iterator(split), std::make_move_iterator(available.end()));
+      available.erase(split, available.end());
+      missing = size > available.size() ? size - available.size() : 0;
+      in_flight = refilling.exchange(true);
+    }
+
+    if (in_flight) { // The running refill might be using an old shape, this will be fixed on the next launch
+      std::thread([self = shared_from_this(), outdated]() { self->discard(outdated); }).detach();
+      return;
+    }
+
+    std::thread([self = shared_from_this(), container, custom_params, shape, outdated, missing]() {
+      self->discard(outdated);
+      for (std::size_t i = 0; i < missing; i++) {
+        if (auto warm = self->create_warm(container, custom_params, shape)) {
+          std::lock_guard lock(self->mutex);
+          self->available.push_back(std::move(*warm));
+        }
+      }
+      self->refilling = false;
+    }).detach();
+  }
+
+  std::size_t available_containers() {
+    std::lock_guard lock(mutex);
+    return available.size();
+  }
+
+protected:
+  /**
+   * Atomically points the placeholder symlink to target
+   */
+  static bool bind_placeholder(const std::filesystem::path &placeholder, const std::string &target) {
+    std::error_code ec;
+    auto tmp = placeholder.string() + ".tmp";
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::create_symlink(target, tmp, ec);
+    if (!ec) {
+      std::filesystem::rename(tmp, placeholder, ec);
+    }
+    if (ec) {
+      logs::log(logs::warning,
+                "[DOCKER] Unable to bind placeholder {} to {}: {}",
+                placeholder.string(),
+                target,
+                ec.message());
+      return false;
+    }
+    return true;
+  }
+
+  std::optional<WarmContainer>
+  create_warm(const Container &container, std::string_view custom_params, const std::string &shape) {
+    auto warm_name = fmt::format("{}_pool_{}", name, next_slot++);
+    auto placeholders_folder = folder / warm_name;
+    std::filesystem::create_directories(placeholders_folder);
+
+    // Until claimed, the placeholders point to the paths of the session that we are copying
+    Container warm_container = container;
+    warm_container.name = warm_name;
+    bool bound = true;
+    for (std::size_t i = 0; i < warm_container.mounts.size(); i++) {
+      auto &mount = warm_container.mounts[i];
+      if (has_placeholder(mount)) {
+        auto placeholder = placeholders_folder / fmt::format("mount-{}", i);
+        bound = bind_placeholder(placeholder, mount.source) && bound;
+        mount.source = placeholder.string();
+      }
+    }
+    for (std::size_t i = 0; i < warm_container.devices.size(); i++) {
+      auto &device = warm_container.devices[i];
+      auto placeholder = placeholders_folder / fmt::format("device-{}", i);
+      bound = bind_placeholder(placeholder, device.path_on_host) && bound;
+      device.path_on_host = placeholder.string();
+    }
+
+    if (bound) {
+      if (auto created = docker_api.create(warm_container, custom_params)) {
+        logs::log(logs::debug, "[DOCKER] Created warm container {}", warm_name);
+        return WarmContainer{.id = created->id, .shape = shape, .placeholders_folder = placeholders_folder};
+      }
+    }
+    std::filesystem::remove_all(placeholders_folder);
+    return {};
+  }
+
+  void discard(const std::vector<WarmContainer> &containers) {
+    for (const auto &warm : containers) {
+      docker_api.remove_by_id(warm.id, true, true);
+      std::filesystem::remove_all(warm.placeholders_folder);
+    }
+  }
+
+  DockerAPI docker_api;
+  std::string name;
+  std::size_t size;
+  std::filesystem::path folder;
+
+  std::mutex mutex;
+  std::vector<WarmContainer> available;
+  std::atomic<bool> refilling = false;
+  std::atomic<std::size_t> next_slot = 0;
+};
+
+} // namespace wolf::core::docker
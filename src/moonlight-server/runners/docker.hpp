@@ -3,13 +3,19 @@
 #include <chrono>
 #include <control/control.hpp>
 #include <core/docker.hpp>
+#include <cstring>
 #include <docker/formatters.hpp>
 #include <fmt/core.h>
 #include <helpers/logger.hpp>
 #include <helpers/utils.hpp>
 #include <platforms/hw.hpp>
 #include <range/v3/view.hpp>
+#include <runners/container-pool.hpp>
 #include <state/data-structures.hpp>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
 
 namespace wolf::core::docker {
@@ -22,7 +28,7 @@ using namespace wolf::core;
 
 class RunDocker : public state::Runner {
 public:
-  static RunDocker from_toml(std::shared_ptr<dp::event_bus> ev_bus, const toml::value &runner_obj) {
+  static RunDocker from_toml(std::shared_ptr<events::EventBus> ev_bus, const toml::value &runner_obj) {
     std::vector<std::string> rec_mounts = toml::find_or<std::vector<std::string>>(runner_obj, "mounts", {});
     std::vector<MountPoint> mounts =
         rec_mounts                                  //
@@ -71,6 +77,7 @@ public:
 
     auto default_socket = utils::get_env("WOLF_DOCKER_SOCKET", "/var/run/docker.sock");
     auto docker_socket = toml::find_or<std::string>(runner_obj, "docker_socket", default_socket);
+    auto warm_containers = toml::find_or<std::size_t>(runner_obj, "warm_containers", 0);
 
     return RunDocker(std::move(ev_bus),
                      toml::find_or<std::string>(runner_obj, "base_create_json", R"({
@@ -86,7 +93,8 @@ public:
                                .mounts = mounts,
                                .devices = devices,
                                .env = toml::find_or<std::vector<std::string>>(runner_obj, "env", {})},
-                     docker_socket);
+                     docker_socket,
+                     warm_containers);
   }
 
   void run(std::size_t session_id,
@@ -97,6 +105,20 @@ public:
            const immer::map<std::string, std::string> &env_variables,
            std::string_view render_node) override;
 
+  /**
+   * @return the container that run() will start for the given session, along with its create params.
+   *
+   * What changes on every session is kept out of the container so that warm containers can be claimed by any session
+   * of the app (see: ContainerPool::shape_of()): the wayland socket always has the same name in the container and the
+   * PulseAudio sink is picked through a client.conf, mounted from the session folder (see: pulse_client_config()).
+   */
+  std::pair<Container, std::string> make_container(std::size_t session_id,
+                                                   std::string_view app_state_folder,
+                                                   const immer::array<std::string> &virtual_inputs,
+                                                   const immer::array<std::pair<std::string, std::string>> &paths,
+                                                   const immer::map<std::string, std::string> &env_variables,
+                                                   std::string_view render_node);
+
   toml::value serialise() override {
     return {{"type", "docker"},
             {"name", container.name},
@@ -108,21 +130,39 @@ public:
             {"devices",
              container.devices | transform([](const auto &el) { return fmt::format("{}", el); }) | ranges::to_vector},
             {"env", container.env},
-            {"base_create_json", base_create_json}};
+            {"base_create_json", base_create_json},
+            {"warm_containers", warm_containers}};
   }
 
 protected:
-  RunDocker(std::shared_ptr<dp::event_bus> ev_bus,
+  RunDocker(std::shared_ptr<events::EventBus> ev_bus,
             std::string base_create_json,
             docker::Container base_container,
-            std::string docker_socket)
+            std::string docker_socket,
+            std::size_t warm_containers = 0)
       : ev_bus(std::move(ev_bus)), container(std::move(base_container)), base_create_json(std::move(base_create_json)),
-        docker_api(std::move(docker_socket)) {}
+        docker_api(std::move(docker_socket)), warm_containers(warm_containers) {
+    if (warm_containers > 0) {
+      auto pool_folder = std::filesystem::path(utils::get_env("HOST_APPS_STATE_FOLDER", "/etc/wolf")) /
+                         "warm-containers" / container.name;
+      pool = std::make_shared<ContainerPool>(docker_api, container.name, warm_containers, pool_folder);
+    }
+  }
+
+  /**
+   * Sends the udev events to the fake-udev daemon running in the container, falling back to docker exec when the
+   * daemon isn't reachable (ex: it hasn't started yet)
+   */
+  void apply_udev_events(std::string_view container_id,
+                         const std::filesystem::path &fake_udev_socket,
+                         const std::vector<std::map<std::string, std::string>> &udev_events);
 
-  std::shared_ptr<dp::event_bus> ev_bus;
+  std::shared_ptr<events::EventBus> ev_bus;
   docker::Container container;
   std::string base_create_json;
   docker::DockerAPI docker_api;
+  std::size_t warm_containers;
+  std::shared_ptr<ContainerPool> pool; // only when warm_containers > 0
 };
 
 void create_udev_hw_files(std::filesystem::path base_hw_db_path,
@@ -136,18 +176,127 @@ void create_udev_hw_files(std::filesystem::path base_hw_db_path,
   }
 }
 
-void RunDocker::run(std::size_t session_id,
-                    std::string_view app_state_folder,
-                    std::shared_ptr<state::devices_atom_queue> plugged_devices_queue,
-                    const immer::array<std::string> &virtual_inputs,
-                    const immer::array<std::pair<std::string, std::string>> &paths,
-                    const immer::map<std::string, std::string> &env_variables,
-                    std::string_view render_node) {
+/**
+ * The path (in the container) where the fake-udev daemon will listen for udev events, see: fake-udev --listen
+ */
+static constexpr auto FAKE_UDEV_SOCKET = "/run/udev/fake-udev.sock";
+
+/**
+ * The name of the wayland socket in the container, see: RunDocker::make_container()
+ */
+static constexpr auto CONTAINER_WAYLAND_DISPLAY = "wayland-wolf";
+
+/**
+ * Where the PulseAudio client.conf of the session is mounted in the container, see: RunDocker::make_container()
+ */
+static constexpr auto CONTAINER_PULSE_CLIENT_CONFIG = "/run/wolf/pulse-client.conf";
+
+/**
+ * @return the path on the host of the PulseAudio client.conf for the session
+ */
+inline std::filesystem::path pulse_client_config(std::string_view app_state_folder) {
+  return std::filesystem::path(app_state_folder) / "pulse" / "client.conf";
+}
+
+/**
+ * @return the path on the host of the fake-udev CLI, empty when it's not available
+ */
+inline std::string fake_udev_cli_path() {
+  return utils::get_env("WOLF_DOCKER_FAKE_UDEV_PATH", "");
+}
+
+/**
+ * Sends a batch of udev events to a fake-udev daemon, it'll create the device nodes and send the events
+ * @return true when all the events have been applied
+ */
+inline bool send_fake_udev_batch(const std::filesystem::path &socket_path,
+                                 const std::vector<std::map<std::string, std::string>> &udev_events,
+                                 std::chrono::milliseconds timeout = 1s) {
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (socket_path.string().size() >= sizeof(addr.sun_path) || !std::filesystem::exists(socket_path)) {
+    return false;
+  }
+  std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  timeval tv = {.tv_sec = timeout.count() / 1000, .tv_usec = (timeout.count() % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  std::string batch;
+  for (const auto &udev_ev : udev_events) {
+    batch.append(base64_encode(map_to_string(udev_ev))).push_back('\n');
+  }
+
+  char reply[8] = {};
+  bool success = connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+                 send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(batch.size()) &&
+                 shutdown(fd, SHUT_WR) == 0 && //
+                 recv(fd, reply, sizeof(reply) - 1, MSG_WAITALL) > 0 && std::string_view(reply) == "OK\n";
+  close(fd);
+  return success;
+}
+
+inline std::string fake_udev_exec_cmd(const std::map<std::string, std::string> &udev_ev) {
+  std::string udev_msg = base64_encode(map_to_string(udev_ev));
+  auto devname = udev_ev.find("DEVNAME");
+  auto action = udev_ev.find("ACTION");
+  if (devname == udev_ev.end()) {
+    return fmt::format("fake-udev -m {}", udev_msg);
+  } else if (action != udev_ev.end() && action->second == "remove") {
+    return fmt::format("fake-udev -m {} && rm {}", udev_msg, devname->second);
+  } else {
+    return fmt::format("mkdir -p /dev/input && mknod {} c {} {} && chmod 777 {} && fake-udev -m {}",
+                       devname->second,
+                       udev_ev.at("MAJOR"),
+                       udev_ev.at("MINOR"),
+                       devname->second,
+                       udev_msg);
+  }
+}
+
+void RunDocker::apply_udev_events(std::string_view container_id,
+                                  const std::filesystem::path &fake_udev_socket,
+                                  const std::vector<std::map<std::string, std::string>> &udev_events) {
+  if (udev_events.empty()) {
+    return;
+  }
+  if (send_fake_udev_batch(fake_udev_socket, udev_events)) {
+    logs::log(logs::debug, "[DOCKER] Sent {} udev events to fake-udev", udev_events.size());
+    return;
+  }
+
+  auto cmd = udev_events | transform(fake_udev_exec_cmd) | ranges::to_vector;
+  logs::log(logs::debug, "[DOCKER] Executing command: {}", utils::join(cmd, "; "));
+  docker_api.exec(container_id, {"/bin/bash", "-c", utils::join(cmd, "; ")}, "root");
+}
+
+std::pair<Container, std::string>
+RunDocker::make_container(std::size_t session_id,
+                          std::string_view app_state_folder,
+                          const immer::array<std::string> &virtual_inputs,
+                          const immer::array<std::pair<std::string, std::string>> &paths,
+                          const immer::map<std::string, std::string> &env_variables,
+                          std::string_view render_node) {
+  auto wayland_display = env_variables.find("WAYLAND_DISPLAY");
+  bool use_pulse_config = env_variables.find("PULSE_SINK") != nullptr;
 
   std::vector<std::string> full_env;
   full_env.insert(full_env.end(), this->container.env.begin(), this->container.env.end());
   for (const auto &env_var : env_variables) {
-    full_env.push_back(fmt::format("{}={}", env_var.first, env_var.second));
+    if (env_var.first == "WAYLAND_DISPLAY") {
+      full_env.push_back(fmt::format("WAYLAND_DISPLAY={}", CONTAINER_WAYLAND_DISPLAY));
+    } else if (use_pulse_config && (env_var.first == "PULSE_SINK" || env_var.first == "PULSE_SOURCE")) {
+      continue; // The env would take precedence over client.conf
+    } else {
+      full_env.push_back(fmt::format("{}={}", env_var.first, env_var.second));
+    }
+  }
+  if (use_pulse_config) {
+    full_env.push_back(fmt::format("PULSE_CLIENTCONFIG={}", CONTAINER_PULSE_CLIENT_CONFIG));
   }
 
   std::vector<Device> devices;
@@ -161,32 +310,22 @@ void RunDocker::run(std::size_t session_id,
   std::vector<MountPoint> mounts;
   mounts.insert(mounts.end(), this->container.mounts.begin(), this->container.mounts.end());
   for (const auto &path : paths) {
-    mounts.insert(mounts.end(), MountPoint{.source = path.first, .destination = path.second, .mode = "rw"});
+    auto destination = std::filesystem::path(path.second);
+    if (wayland_display && destination.filename() == *wayland_display) {
+      destination.replace_filename(CONTAINER_WAYLAND_DISPLAY);
+    }
+    mounts.insert(mounts.end(), MountPoint{.source = path.first, .destination = destination.string(), .mode = "rw"});
+  }
+  if (use_pulse_config) {
+    mounts.push_back(MountPoint{.source = pulse_client_config(app_state_folder).string(),
+                                .destination = CONTAINER_PULSE_CLIENT_CONFIG,
+                                .mode = "ro"});
   }
 
-  // Fake udev
-  auto udev_base_path = std::filesystem::path(app_state_folder) / "udev";
-  auto hw_db_path = udev_base_path / "data";
-  auto fake_udev_cli_path = std::string(utils::get_env("WOLF_DOCKER_FAKE_UDEV_PATH", ""));
-  bool use_fake_udev = !fake_udev_cli_path.empty() || std::filesystem::exists(fake_udev_cli_path);
-  if (use_fake_udev) {
-    logs::log(logs::debug, "[DOCKER] Using fake-udev, creating {}", hw_db_path.string());
-    std::filesystem::create_directories(hw_db_path);
-
-    // Check if /run/udev/control exists
-    auto udev_ctrl_path = udev_base_path / "control";
-    if (!std::filesystem::exists(udev_ctrl_path)) {
-      if (auto control_file = std::ofstream(udev_ctrl_path)) {
-        control_file.close();
-        std::filesystem::permissions(udev_ctrl_path, std::filesystem::perms::all); // set 777
-      }
-    }
+  if (auto fake_udev_cli = fake_udev_cli_path(); !fake_udev_cli.empty()) {
+    auto udev_base_path = std::filesystem::path(app_state_folder) / "udev";
     mounts.push_back(MountPoint{.source = udev_base_path.string(), .destination = "/run/udev/", .mode = "rw"});
-    mounts.push_back(MountPoint{.source = fake_udev_cli_path, .destination = "/usr/bin/fake-udev", .mode = "ro"});
-  } else {
-    logs::log(logs::warning,
-              "[DOCKER] Unable to use fake-udev, check the env variable WOLF_DOCKER_FAKE_UDEV_PATH and the file at {}",
-              fake_udev_cli_path);
+    mounts.push_back(MountPoint{.source = fake_udev_cli, .destination = "/usr/bin/fake-udev", .mode = "ro"});
   }
 
   // Add equivalent of --gpu=all if on NVIDIA without the custom driver volume
@@ -243,72 +382,123 @@ void RunDocker::run(std::size_t session_id,
                              .devices = devices,
                              .env = full_env};
 
-  if (auto docker_container = docker_api.create(new_container, final_json_opts)) {
+  return {new_container, final_json_opts};
+}
+
+void RunDocker::run(std::size_t session_id,
+                    std::string_view app_state_folder,
+                    std::shared_ptr<state::devices_atom_queue> plugged_devices_queue,
+                    const immer::array<std::string> &virtual_inputs,
+                    const immer::array<std::pair<std::string, std::string>> &paths,
+                    const immer::map<std::string, std::string> &env_variables,
+                    std::string_view render_node) {
+
+  // Fake udev
+  auto udev_base_path = std::filesystem::path(app_state_folder) / "udev";
+  auto hw_db_path = udev_base_path / "data";
+  auto fake_udev_socket = udev_base_path / std::filesystem::path(FAKE_UDEV_SOCKET).filename();
+  bool use_fake_udev = !fake_udev_cli_path().empty();
+  if (use_fake_udev) {
+    logs::log(logs::debug, "[DOCKER] Using fake-udev, creating {}", hw_db_path.string());
+    std::filesystem::create_directories(hw_db_path);
+
+    // Check if /run/udev/control exists
+    auto udev_ctrl_path = udev_base_path / "control";
+    if (!std::filesystem::exists(udev_ctrl_path)) {
+      if (auto control_file = std::ofstream(udev_ctrl_path)) {
+        control_file.close();
+        std::filesystem::permissions(udev_ctrl_path, std::filesystem::perms::all); // set 777
+      }
+    }
+  } else {
+    logs::log(logs::warning,
+              "[DOCKER] Unable to use fake-udev, check the env variable WOLF_DOCKER_FAKE_UDEV_PATH and the file at {}",
+              fake_udev_cli_path());
+  }
+
+  if (auto sink = env_variables.find("PULSE_SINK")) {
+    auto client_config = pulse_client_config(app_state_folder);
+    std::filesystem::create_directories(client_config.parent_path());
+    std::ofstream client_conf(client_config);
+    client_conf << fmt::format("default-sink = {}\n", *sink);
+    if (auto source = env_variables.find("PULSE_SOURCE")) {
+      client_conf << fmt::format("default-source = {}\n", *source);
+    }
+  }
+
+  auto [new_container, final_json_opts] =
+      make_container(session_id, app_state_folder, virtual_inputs, paths, env_variables, render_node);
+
+  std::optional<WarmContainer> warm_container;
+  if (pool) {
+    warm_container = pool->claim(new_container, final_json_opts);
+    pool->refill(new_container, final_json_opts);
+  }
+  auto docker_container = warm_container ? docker_api.get_by_id(warm_container->id)
+                                         : docker_api.create(new_container, final_json_opts);
+  if (docker_container) {
     auto container_id = docker_container->id;
     docker_api.start_by_id(container_id);
+    if (use_fake_udev) {
+      docker_api.exec(container_id, {"fake-udev", "--listen", FAKE_UDEV_SOCKET}, "root", true);
+    }
 
     logs::log(logs::info, "[DOCKER] Starting container: {}", docker_container->name);
     logs::log(logs::debug, "[DOCKER] Starting container: {}", *docker_container);
 
-    auto terminate_handler = this->ev_bus->register_handler<immer::box<StopStreamEvent>>(
-        [session_id, container_id, this](const immer::box<StopStreamEvent> &terminate_ev) {
-          if (terminate_ev->session_id == session_id) {
-            docker_api.stop_by_id(container_id);
-          }
-        });
-
-    auto unplug_device_handler = this->ev_bus->register_handler<immer::box<state::UnplugDeviceEvent>>(
-        [session_id, container_id, hw_db_path, this](const immer::box<state::UnplugDeviceEvent> &ev) {
-          if (ev->session_id == session_id) {
-            for (const auto &[filename, content] : ev->udev_hw_db_entries) {
-              std::filesystem::remove(hw_db_path / filename);
-            }
+    auto terminate_handler = this->ev_bus->register_session_handler<immer::box<StopStreamEvent>>(
+        session_id,
+        [container_id, this](const immer::box<StopStreamEvent> &terminate_ev) { docker_api.stop_by_id(container_id); });
 
-            for (auto udev_ev : ev->udev_events) {
-              udev_ev["ACTION"] = "remove";
-              std::string udev_msg = base64_encode(map_to_string(udev_ev));
-              std::string cmd;
-              if (udev_ev.count("DEVNAME") == 0) {
-                cmd = fmt::format("fake-udev -m {}", udev_msg);
-              } else {
-                cmd = fmt::format("fake-udev -m {} && rm {}", udev_msg, udev_ev["DEVNAME"]);
-              }
-              logs::log(logs::debug, "[DOCKER] Executing command: {}", cmd);
-              docker_api.exec(container_id, {"/bin/bash", "-c", cmd}, "root");
-            }
+    auto unplug_device_handler = this->ev_bus->register_session_handler<immer::box<state::UnplugDeviceEvent>>(
+        session_id,
+        [container_id, hw_db_path, fake_udev_socket, this](const immer::box<state::UnplugDeviceEvent> &ev) {
+          for (const auto &[filename, content] : ev->udev_hw_db_entries) {
+            std::filesystem::remove(hw_db_path / filename);
           }
-        });
 
-    do {
-      // Plug all devices that are waiting in the queue
-      while (auto device_ev = plugged_devices_queue->pop(50ms)) {
-        if (device_ev->get().session_id == session_id) {
-          if (use_fake_udev) {
-            create_udev_hw_files(hw_db_path, device_ev->get().udev_hw_db_entries);
+          auto udev_events = ev->udev_events;
+          for (auto &udev_ev : udev_events) {
+            udev_ev["ACTION"] = "remove";
           }
+          apply_udev_events(container_id, fake_udev_socket, udev_events);
+        });
 
-          for (auto udev_ev : device_ev->get().udev_events) {
-            std::string cmd;
-            std::string udev_msg = base64_encode(map_to_string(udev_ev));
-            if (udev_ev.count("DEVNAME") == 0) {
-              cmd = fmt::format("fake-udev -m {}", udev_msg);
-            } else {
-              cmd = fmt::format("mkdir -p /dev/input && mknod {} c {} {} && chmod 777 {} && fake-udev -m {}",
-                                udev_ev["DEVNAME"],
-                                udev_ev["MAJOR"],
-                                udev_ev["MINOR"],
-                                udev_ev["DEVNAME"],
-                                udev_msg);
+    // Closing the queue will wake up the loop below as soon as the container exits
+    std::thread exit_watcher([this, container_id, plugged_devices_queue]() {
+      while (true) {
+        if (auto exit_code = docker_api.wait_by_id(container_id)) {
+          logs::log(logs::debug, "[DOCKER] Container {} exited with status code: {}", container_id, *exit_code);
+          break;
+        }
+        // The request failed (ex: the docker daemon restarted), make sure that the container is gone before giving up
+        auto current_container = docker_api.get_by_id(container_id);
+        if (!current_container || current_container->status != RUNNING) {
+          break;
+        }
+        std::this_thread::sleep_for(500ms);
+      }
+      plugged_devices_queue->close();
+    });
+
+    // Plug devices as soon as they are queued, until the container exits
+    while (!plugged_devices_queue->is_closed()) {
+      if (auto device_ev = plugged_devices_queue->pop(1h)) {
+        // Devices tend to be plugged in bursts (ex: a joypad and its motion sensors), send them all in one go
+        std::vector<std::map<std::string, std::string>> udev_events;
+        for (; device_ev; device_ev = plugged_devices_queue->pop(0ms)) {
+          if (device_ev->get().session_id == session_id) {
+            if (use_fake_udev) {
+              create_udev_hw_files(hw_db_path, device_ev->get().udev_hw_db_entries);
             }
-            logs::log(logs::debug, "[DOCKER] Executing command: {}", cmd);
-            docker_api.exec(container_id, {"/bin/bash", "-c", cmd}, "root");
+            const auto &events = device_ev->get().udev_events;
+            udev_events.insert(udev_events.end(), events.begin(), events.end());
           }
         }
+        apply_udev_events(container_id, fake_udev_socket, udev_events);
       }
-
-      std::this_thread::sleep_for(500ms);
-
-    } while (docker_api.get_by_id(container_id)->status == RUNNING);
+    }
+    exit_watcher.join();
 
     logs::log(logs::debug, "[DOCKER] Container logs: \n{}", docker_api.get_logs(container_id));
     logs::log(logs::debug, "[DOCKER] Stopping container: {}", docker_container->name);
@@ -316,11 +506,15 @@ void RunDocker::run(std::size_t session_id,
       if (std::string(env) == "TRUE") {
         docker_api.stop_by_id(container_id);
         docker_api.remove_by_id(container_id);
+        if (warm_container) {
+          std::filesystem::remove_all(warm_container->placeholders_folder);
+        }
       }
     }
     logs::log(logs::info, "Stopped container: {}", docker_container->name);
     std::filesystem::remove_all(udev_base_path);
     terminate_handler.unregister();
+    unplug_device_handler.unregister();
   }
 }
 
@@ -1,7 +1,7 @@
 #pragma once
 #include <boost/process.hpp>
+#include <core/events.hpp>
 #include <core/input.hpp>
-#include <eventbus/event_bus.hpp>
 #include <immer/box.hpp>
 #include <memory>
 #include <state/data-structures.hpp>
@@ -15,7 +15,7 @@ using namespace wolf::core;
 
 class RunProcess : public state::Runner {
 public:
-  explicit RunProcess(std::shared_ptr<dp::event_bus> ev_bus, std::string run_cmd)
+  explicit RunProcess(std::shared_ptr<events::EventBus> ev_bus, std::string run_cmd)
       : run_cmd(std::move(run_cmd)), ev_bus(std::move(ev_bus)) {}
 
   void run(std::size_t session_id,
@@ -32,7 +32,7 @@ public:
 
 protected:
   std::string run_cmd;
-  std::shared_ptr<dp::event_bus> ev_bus;
+  std::shared_ptr<events::EventBus> ev_bus;
 };
 namespace bp = boost::process;
 
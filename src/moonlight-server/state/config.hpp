@@ -13,7 +13,16 @@ namespace state {
  *
  * If the source is not present, it'll provide some sensible defaults
  */
-Config load_or_default(const std::string &source, const std::shared_ptr<dp::event_bus> &ev_bus);
+Config load_or_default(const std::string &source, const std::shared_ptr<events::EventBus> &ev_bus);
+
+/**
+ * Pushes synthetic frames through all the available encoders, at each of the given display modes, and ranks them
+ * by their encoding latency. The ranking is stored alongside the encoders cache and will be used by load_or_default()
+ * to pick the fastest encoder instead of the first available one in config order.
+ *
+ * @return false if the encoders had already been ranked (the ranking is reset when drivers or plugins change)
+ */
+bool benchmark_encoders(const std::string &source, const immer::array<moonlight::DisplayMode> &display_modes);
 
 /**
  * Side effect, will atomically update the paired clients list in cfg
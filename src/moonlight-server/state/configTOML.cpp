@@ -1,10 +1,16 @@
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <gst/gstelementfactory.h>
 #include <gst/gstregistry.h>
+#include <map>
+#include <platforms/hw.hpp>
 #include <range/v3/view.hpp>
 #include <runners/docker.hpp>
 #include <runners/process.hpp>
+#include <set>
 #include <state/config.hpp>
+#include <streaming/encoder-benchmark.hpp>
 #include <toml.hpp>
 #include <utility>
 
@@ -101,7 +107,7 @@ void create_default(const std::string &source) {
   out_file.close();
 }
 
-std::shared_ptr<state::Runner> get_runner(const toml::value &item, const std::shared_ptr<dp::event_bus> &ev_bus) {
+std::shared_ptr<state::Runner> get_runner(const toml::value &item, const std::shared_ptr<events::EventBus> &ev_bus) {
   auto runner_obj = toml::find_or(item, "runner", {{"type", "process"}});
   auto runner_type = toml::find_or(runner_obj, "type", "process");
   if (runner_type == "process") {
@@ -115,21 +121,172 @@ std::shared_ptr<state::Runner> get_runner(const toml::value &item, const std::sh
   }
 }
 
-static bool is_available(const GstEncoder &settings) {
-  if (auto plugin = gst_registry_find_plugin(gst_registry_get(), settings.plugin_name.c_str())) {
+/**
+ * Results of the encoder checks: element name -> can be created
+ */
+using probe_results = std::map<std::string, bool>;
+
+static std::optional<std::string> plugin_fingerprint(const std::string &plugin_name) {
+  if (auto plugin = gst_registry_find_plugin(gst_registry_get(), plugin_name.c_str())) {
+    std::string filename = gst_plugin_get_filename(plugin) ? gst_plugin_get_filename(plugin) : "";
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+    auto fingerprint = fmt::format("{}:{}:{}", plugin_name, gst_plugin_get_version(plugin), ec ? 0 : mtime);
     gst_object_unref(plugin);
-    return std::all_of(settings.check_elements.begin(), settings.check_elements.end(), [](const auto &el_name) {
-      if (auto el = gst_element_factory_make(el_name.c_str(), nullptr)) {
-        gst_object_unref(el);
-        return true;
-      } else {
-        return false;
+    return fingerprint;
+  }
+  return {};
+}
+
+/**
+ * The cached results are only valid as long as nothing changed in GStreamer, its plugins and the GPU driver
+ */
+static std::string probe_cache_key(const std::vector<GstEncoder> &encoders, const std::string &render_node) {
+  std::set<std::string> plugins;
+  for (const auto &encoder : encoders) {
+    plugins.insert(plugin_fingerprint(encoder.plugin_name).value_or(encoder.plugin_name + ":missing"));
+  }
+  return fmt::format("gstreamer={};plugins={};render_node={};driver={}",
+                     gst_version_string(),
+                     fmt::join(plugins, ","),
+                     render_node,
+                     get_driver_version(render_node));
+}
+
+/**
+ * What we know about the encoders of this host, persisted between runs. Only valid as long as `key` matches.
+ */
+struct EncodersCache {
+  std::string key;
+  probe_results elements;
+  std::map<std::string /* codec */, std::vector<std::string> /* plugin names, fastest first */> ranking;
+};
+
+static EncodersCache load_encoders_cache(const std::string &cache_file, const std::string &key) {
+  if (!file_exist(cache_file)) {
+    return {.key = key};
+  }
+  try {
+    auto cache = toml::parse(cache_file);
+    if (toml::find_or<std::string>(cache, "key", "") != key) {
+      logs::log(logs::info, "[TOML] Encoders cache is out of date, probing again");
+      return {.key = key};
+    }
+    return {.key = key,
+            .elements = toml::find_or<probe_results>(cache, "elements", {}),
+            .ranking = toml::find_or<std::map<std::string, std::vector<std::string>>>(cache, "ranking", {})};
+  } catch (const std::exception &e) {
+    logs::log(logs::warning, "[TOML] Unable to read encoders cache {}: {}", cache_file, e.what());
+    return {.key = key};
+  }
+}
+
+static void save_encoders_cache(const std::string &cache_file, const EncodersCache &cache) {
+  toml::table elements;
+  for (const auto &[element, available] : cache.elements) {
+    elements[element] = available;
+  }
+  toml::table ranking;
+  for (const auto &[codec, plugins] : cache.ranking) {
+    ranking[codec] = toml::array(plugins.begin(), plugins.end());
+  }
+  write(toml::value{{"key", cache.key}, {"elements", elements}, {"ranking", ranking}}, cache_file);
+}
+
+/**
+ * Checks that all the `check_elements` of the given encoders can be created.
+ * Creating an encoder element might open the GPU driver, which is slow: the checks are run in parallel and the same
+ * element is only checked once, even when it's shared by multiple encoders.
+ *
+ * Results are persisted in cache_file, later runs will skip the checks unless the GStreamer version, the encoders
+ * plugins, the render node or the driver version changed.
+ */
+static EncodersCache
+probe_encoders(const std::vector<GstEncoder> &encoders, const std::string &cache_file, const std::string &render_node) {
+  auto cache = load_encoders_cache(cache_file, probe_cache_key(encoders, render_node));
+
+  std::map<std::string, std::future<bool>> checks;
+  for (const auto &encoder : encoders) {
+    for (const auto &el_name : encoder.check_elements) {
+      if (cache.elements.find(el_name) == cache.elements.end() && checks.find(el_name) == checks.end()) {
+        checks[el_name] = std::async(std::launch::async, [el_name]() {
+          if (auto el = gst_element_factory_make(el_name.c_str(), nullptr)) {
+            gst_object_unref(el);
+            return true;
+          }
+          return false;
+        });
       }
-    });
+    }
+  }
+
+  if (!checks.empty()) {
+    for (auto &[el_name, check] : checks) {
+      auto available = check.get();
+      cache.elements[el_name] = available;
+      logs::log(logs::debug, "[TOML] Probed {}: {}", el_name, available ? "available" : "not available");
+    }
+    save_encoders_cache(cache_file, cache);
+  } else {
+    logs::log(logs::debug, "[TOML] Using cached encoders probe results from {}", cache_file);
+  }
+  return cache;
+}
+
+static bool is_available(const GstEncoder &settings, const probe_results &probed) {
+  if (auto plugin = gst_registry_find_plugin(gst_registry_get(), settings.plugin_name.c_str())) {
+    gst_object_unref(plugin);
+    return std::all_of(settings.check_elements.begin(),
+                       settings.check_elements.end(),
+                       [&probed](const auto &el_name) {
+                         auto result = probed.find(el_name);
+                         return result != probed.end() && result->second;
+                       });
   }
   return false;
 }
 
+/**
+ * Sorts the encoders by their benchmark ranking, encoders that haven't been ranked keep the config order after the
+ * ranked ones. See: benchmark_encoders()
+ */
+static std::vector<GstEncoder> by_ranking(std::vector<GstEncoder> encoders, const std::vector<std::string> &ranking) {
+  auto position = [&ranking](const GstEncoder &encoder) {
+    return std::distance(ranking.begin(), std::find(ranking.begin(), ranking.end(), encoder.plugin_name));
+  };
+  std::stable_sort(encoders.begin(), encoders.end(), [&position](const GstEncoder &a, const GstEncoder &b) {
+    return position(a) < position(b);
+  });
+  return encoders;
+}
+
+static std::vector<GstEncoder> candidate_encoders(const GstVideoCfg &video_cfg, bool support_av1) {
+  std::vector<GstEncoder> encoders;
+  encoders.insert(encoders.end(), video_cfg.h264_encoders.begin(), video_cfg.h264_encoders.end());
+  encoders.insert(encoders.end(), video_cfg.hevc_encoders.begin(), video_cfg.hevc_encoders.end());
+  if (support_av1) {
+    encoders.insert(encoders.end(), video_cfg.av1_encoders.begin(), video_cfg.av1_encoders.end());
+  }
+  return encoders;
+}
+
+static std::string encoders_cache_file(const std::string &source) {
+  auto default_cache_file = std::filesystem::path(source).replace_filename("encoders.cache.toml").string();
+  return utils::get_env("WOLF_ENCODERS_CACHE_FILE", default_cache_file.c_str());
+}
+
+/**
+ * When set to AUTO_RENDER_NODE each session will run on the least loaded GPU, see: state::schedule_render_node()
+ * Encoders and devices will be checked against the first render node found, which is used as the reference model.
+ */
+static std::string resolve_render_node(const std::string &render_node) {
+  if (render_node != AUTO_RENDER_NODE) {
+    return render_node;
+  }
+  auto render_nodes = get_render_nodes();
+  return render_nodes.empty() ? "/dev/dri/renderD128" : render_nodes.front();
+}
+
 static state::Encoder encoder_type(const std::string &gstreamer_plugin_name) {
   switch (utils::hash(gstreamer_plugin_name)) {
   case (utils::hash("nvcodec")):
@@ -182,7 +339,7 @@ toml::value v2_to_v3(const toml::value &v2, const std::string &source) {
   return v3;
 }
 
-Config load_or_default(const std::string &source, const std::shared_ptr<dp::event_bus> &ev_bus) {
+Config load_or_default(const std::string &source, const std::shared_ptr<events::EventBus> &ev_bus) {
   if (!file_exist(source)) {
     logs::log(logs::warning, "Unable to open config file: {}, creating one using defaults", source);
     create_default(source);
@@ -218,31 +375,38 @@ Config load_or_default(const std::string &source, const std::shared_ptr<dp::even
   GstVideoCfg default_gst_video_settings = toml::find<GstVideoCfg>(cfg, "gstreamer", "video");
   GstAudioCfg default_gst_audio_settings = toml::find<GstAudioCfg>(cfg, "gstreamer", "audio");
 
+  /* Check all the available encoders at once */
+  std::string default_render_node_setting = utils::get_env("WOLF_RENDER_NODE", "/dev/dri/renderD128");
+  auto default_app_render_node = resolve_render_node(default_render_node_setting);
+  auto encoders_cache = probe_encoders(candidate_encoders(default_gst_video_settings, support_av1),
+                                       encoders_cache_file(source),
+                                       default_app_render_node);
+  auto is_encoder_available = [&encoders_cache](const GstEncoder &encoder) {
+    return is_available(encoder, encoders_cache.elements);
+  };
+
   /* Automatic pick best H264 encoder */
-  auto h264_encoder = std::find_if(default_gst_video_settings.h264_encoders.begin(),
-                                   default_gst_video_settings.h264_encoders.end(),
-                                   is_available);
-  if (h264_encoder == std::end(default_gst_video_settings.h264_encoders)) {
+  auto h264_candidates = by_ranking(default_gst_video_settings.h264_encoders, encoders_cache.ranking["h264"]);
+  auto h264_encoder = std::find_if(h264_candidates.begin(), h264_candidates.end(), is_encoder_available);
+  if (h264_encoder == std::end(h264_candidates)) {
     throw std::runtime_error("Unable to find a compatible H264 encoder, please check [[gstreamer.video.h264_encoders]] "
                              "in your config.toml or your Gstreamer installation");
   }
   logs::log(logs::info, "Selected H264 encoder: {}", h264_encoder->plugin_name);
 
   /* Automatic pick best HEVC encoder */
-  auto hevc_encoder = std::find_if(default_gst_video_settings.hevc_encoders.begin(),
-                                   default_gst_video_settings.hevc_encoders.end(),
-                                   is_available);
-  if (hevc_encoder == std::end(default_gst_video_settings.hevc_encoders)) {
+  auto hevc_candidates = by_ranking(default_gst_video_settings.hevc_encoders, encoders_cache.ranking["hevc"]);
+  auto hevc_encoder = std::find_if(hevc_candidates.begin(), hevc_candidates.end(), is_encoder_available);
+  if (hevc_encoder == std::end(hevc_candidates)) {
     throw std::runtime_error("Unable to find a compatible HEVC encoder, please check [[gstreamer.video.hevc_encoders]] "
                              "in your config.toml or your Gstreamer installation");
   }
   logs::log(logs::info, "Selected HEVC encoder: {}", hevc_encoder->plugin_name);
 
   /* Automatic pick best AV1 encoder */
-  auto av1_encoder = std::find_if(default_gst_video_settings.av1_encoders.begin(),
-                                  default_gst_video_settings.av1_encoders.end(),
-                                  is_available);
-  if (support_av1 && av1_encoder == std::end(default_gst_video_settings.av1_encoders)) {
+  auto av1_candidates = by_ranking(default_gst_video_settings.av1_encoders, encoders_cache.ranking["av1"]);
+  auto av1_encoder = std::find_if(av1_candidates.begin(), av1_candidates.end(), is_encoder_available);
+  if (support_av1 && av1_encoder == std::end(av1_candidates)) {
     throw std::runtime_error("Unable to find a compatible AV1 encoder, please check [[gstreamer.video.av1_encoders]] "
                              "in your config.toml or your Gstreamer installation");
   } else if (support_av1) {
@@ -256,7 +420,6 @@ Config load_or_default(const std::string &source, const std::shared_ptr<dp::even
       | ranges::views::transform([](const PairedClient &client) { return immer::box<PairedClient>{client}; }) //
       | ranges::to<immer::vector<immer::box<PairedClient>>>();
 
-  std::string default_app_render_node = utils::get_env("WOLF_RENDER_NODE", "/dev/dri/renderD128");
   /* Get apps, here we'll merge the default gstreamer settings with the app specific overrides */
   auto cfg_apps = toml::find<std::vector<toml::value>>(cfg, "apps");
   auto apps =
@@ -264,23 +427,26 @@ Config load_or_default(const std::string &source, const std::shared_ptr<dp::even
       ranges::views::enumerate |                                               //
       ranges::views::transform([&](std::pair<int, const toml::value &> pair) { //
         auto [idx, item] = pair;
+        auto render_node_setting = toml::find_or(item, "render_node", default_render_node_setting);
+        auto allow_spectators = toml::find_or<bool>(item, "allow_spectators", false);
+        // Spectators will be attached to this tee, each with its own payloader, see: streaming::attach_spectator()
+        auto video_sink = (allow_spectators ? "tee name="s + SPECTATORS_TEE_NAME + " allow-not-linked=true ! " : ""s) +
+                          toml::find_or(item, "video", " sink ", default_gst_video_settings.default_sink);
         auto h264_gst_pipeline = toml::find_or(item, "video", "source", default_gst_video_settings.default_source) +
                                  " ! " + toml::find_or(item, "video", "video_params", h264_encoder->video_params) +
                                  " ! " + toml::find_or(item, "video", "h264_encoder", h264_encoder->encoder_pipeline) +
-                                 " ! " +
-                                 toml::find_or(item, "video", " sink ", default_gst_video_settings.default_sink);
+                                 " ! " + video_sink;
 
         auto hevc_gst_pipeline = toml::find_or(item, "video", "source", default_gst_video_settings.default_source) +
                                  " ! " + toml::find_or(item, "video", "video_params", hevc_encoder->video_params) +
                                  " ! " + toml::find_or(item, "video", "hevc_encoder", hevc_encoder->encoder_pipeline) +
-                                 " ! " +
-                                 toml::find_or(item, "video", " sink ", default_gst_video_settings.default_sink);
+                                 " ! " + video_sink;
 
         auto av1_gst_pipeline =
             support_av1 ? toml::find_or(item, "video", "source", default_gst_video_settings.default_source) + " ! " +
                               toml::find_or(item, "video", "video_params", av1_encoder->video_params) + " ! " +
                               toml::find_or(item, "video", "av1_encoder", av1_encoder->encoder_pipeline) + " ! " +
-                              toml::find_or(item, "video", " sink ", default_gst_video_settings.default_sink)
+                              video_sink
                         : "";
 
         auto opus_gst_pipeline =
@@ -310,12 +476,14 @@ Config load_or_default(const std::string &source, const std::shared_ptr<dp::even
                           .hevc_encoder = encoder_type(hevc_encoder->plugin_name),
                           .av1_gst_pipeline = av1_gst_pipeline,
                           .av1_encoder = support_av1 ? encoder_type(av1_encoder->plugin_name) : UNKNOWN,
-                          .render_node = toml::find_or(item, "render_node", default_app_render_node),
+                          .render_node = resolve_render_node(render_node_setting),
 
                           .opus_gst_pipeline = opus_gst_pipeline,
                           .start_virtual_compositor = toml::find_or<bool>(item, "start_virtual_compositor", true),
                           .runner = get_runner(item, ev_bus),
-                          .joypad_type = joypad_type_enum};
+                          .joypad_type = joypad_type_enum,
+                          .allow_spectators = allow_spectators,
+                          .schedule_render_node = render_node_setting == AUTO_RENDER_NODE};
       }) |                                     //
       ranges::to<immer::vector<state::App>>(); //
 
@@ -329,6 +497,83 @@ Config load_or_default(const std::string &source, const std::shared_ptr<dp::even
                 .apps = apps};
 }
 
+bool benchmark_encoders(const std::string &source, const immer::array<moonlight::DisplayMode> &display_modes) {
+  if (!file_exist(source)) {
+    create_default(source);
+  }
+
+  auto cfg = toml::parse<toml::preserve_comments>(source);
+  bool support_av1 = toml::find_or<bool>(cfg, "support_av1", false);
+  if (toml::find_or(cfg, "config_version", 2) < 3) {
+    // The config will be migrated by load_or_default(), the encoders will be benchmarked on the next run
+    logs::log(logs::warning, "[BENCHMARK] Old config file found, skipping encoders benchmark");
+    return false;
+  }
+  GstVideoCfg video_cfg = toml::find<GstVideoCfg>(cfg, "gstreamer", "video");
+  auto render_node = resolve_render_node(utils::get_env("WOLF_RENDER_NODE", "/dev/dri/renderD128"));
+  auto cache_file = encoders_cache_file(source);
+  auto cache = probe_encoders(candidate_encoders(video_cfg, support_av1), cache_file, render_node);
+  if (!cache.ranking.empty()) {
+    logs::log(logs::debug, "[BENCHMARK] Encoders have already been ranked, see: {}", cache_file);
+    return false;
+  }
+
+  std::vector<std::pair<std::string, const std::vector<GstEncoder> *>> codecs = {{"h264", &video_cfg.h264_encoders},
+                                                                                   {"hevc", &video_cfg.hevc_encoders}};
+  if (support_av1) {
+    codecs.emplace_back("av1", &video_cfg.av1_encoders);
+  }
+
+  for (const auto &[codec, encoders] : codecs) {
+    std::vector<std::pair<double /* avg latency */, std::string /* plugin */>> scores;
+    for (const auto &encoder : *encoders) {
+      if (!is_available(encoder, cache.elements)) {
+        continue;
+      }
+
+      double total_latency = 0;
+      bool completed = true;
+      for (const auto &mode : display_modes) {
+        auto result = streaming::benchmark_encoder(encoder.video_params,
+                                                   encoder.encoder_pipeline,
+                                                   {mode.width, mode.height, mode.refreshRate},
+                                                   render_node);
+        if (!result) {
+          completed = false;
+          break;
+        }
+        logs::log(logs::info,
+                  "[BENCHMARK] {} {} {}x{}@{}: avg latency {:.2f}ms, max latency {:.2f}ms, {:.0f} fps",
+                  codec,
+                  encoder.plugin_name,
+                  mode.width,
+                  mode.height,
+                  mode.refreshRate,
+                  result->avg_latency_ms,
+                  result->max_latency_ms,
+                  result->fps);
+        total_latency += result->avg_latency_ms;
+      }
+
+      if (completed && !display_modes.empty()) {
+        scores.emplace_back(total_latency / display_modes.size(), encoder.plugin_name);
+      } else {
+        logs::log(logs::warning, "[BENCHMARK] {} {} failed, it will not be ranked", codec, encoder.plugin_name);
+      }
+    }
+
+    std::stable_sort(scores.begin(), scores.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    auto &ranking = cache.ranking[codec];
+    for (const auto &[latency, plugin_name] : scores) {
+      ranking.push_back(plugin_name);
+    }
+    logs::log(logs::info, "[BENCHMARK] {} encoders ranking: {}", codec, fmt::join(ranking, ", "));
+  }
+
+  save_encoders_cache(cache_file, cache);
+  return true;
+}
+
 void pair(const Config &cfg, const PairedClient &client) {
   // Update CFG
   cfg.paired_clients.update(
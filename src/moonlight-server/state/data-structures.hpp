@@ -1,12 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
 #include <chrono>
 #include <core/audio.hpp>
+#include <core/events.hpp>
 #include <core/input.hpp>
 #include <core/virtual-display.hpp>
 #include <deque>
-#include <eventbus/event_bus.hpp>
+#include <helpers/executor.hpp>
 #include <helpers/tsqueue.hpp>
 #include <immer/array.hpp>
 #include <immer/atom.hpp>
@@ -64,6 +66,11 @@ enum STANDARD_PORTS_MAPPING {
   RTSP_SETUP_PORT = 48010
 };
 
+/**
+ * Each session gets its own video and audio port, starting from VIDEO_PING_PORT and AUDIO_PING_PORT
+ */
+static constexpr unsigned short MAX_PING_PORTS = AUDIO_PING_PORT - VIDEO_PING_PORT;
+
 struct PairedClient {
   std::string client_cert;
   std::string app_state_folder;
@@ -80,11 +87,13 @@ struct PairSignal {
 struct RTPVideoPingEvent {
   std::string client_ip;
   unsigned short client_port;
+  unsigned short host_port; // the port that received the PING, each session has its own
 };
 
 struct RTPAudioPingEvent {
   std::string client_ip;
   unsigned short client_port;
+  unsigned short host_port; // the port that received the PING, each session has its own
 };
 
 using PairedClientList = immer::vector<immer::box<PairedClient>>;
@@ -114,8 +123,31 @@ struct App {
   bool start_virtual_compositor;
   std::shared_ptr<Runner> runner;
   moonlight::control::pkts::CONTROLLER_TYPE joypad_type;
+
+  /**
+   * When set, other paired clients can join a running session of this app as spectators:
+   * they'll receive the same encoded video as the host without starting a new app or encoder.
+   */
+  bool allow_spectators = false;
+
+  /**
+   * When set, each new session will run on the least loaded of the GPUs that are the same model as render_node,
+   * see: schedule_render_node()
+   */
+  bool schedule_render_node = false;
 };
 
+/**
+ * The name of the tee that sits right after the video encoder when an App allows spectators,
+ * each spectator will be attached to it with its own payloader and udpsink
+ */
+static constexpr auto SPECTATORS_TEE_NAME = "spectators_tee";
+
+/**
+ * Setting an App render_node to this value will enable App::schedule_render_node
+ */
+static constexpr auto AUTO_RENDER_NODE = "auto";
+
 /**
  * The stored (and user modifiable) configuration
  */
@@ -201,7 +233,7 @@ struct StreamSession {
   moonlight::DisplayMode display_mode;
   AudioMode audio_mode;
 
-  std::shared_ptr<dp::event_bus> event_bus;
+  std::shared_ptr<events::EventBus> event_bus;
   std::shared_ptr<App> app;
   std::string app_state_folder;
 
@@ -213,6 +245,10 @@ struct StreamSession {
   std::size_t session_id;
   std::string ip;
 
+  // ports leased to this session, see: lease_ports()
+  unsigned short video_port;
+  unsigned short audio_port;
+
   /**
    * Optional: the wayland display for the current session.
    * Will be only set during an active streaming and destroyed on stream end.
@@ -230,12 +266,42 @@ struct StreamSession {
       std::make_shared<std::optional<input::PenTablet>>(); /* Optional, will be set on first use */
   std::shared_ptr<std::optional<input::TouchScreen>> touch_screen =
       std::make_shared<std::optional<input::TouchScreen>>(); /* Optional, will be set on first use */
+
+  /**
+   * Optional: set when this is a spectator of another running session.
+   * Spectators share the host app, display and devices; they only get their own ports, keys and payloaders.
+   */
+  std::optional<std::size_t> host_session_id = {};
+
+  /**
+   * Input coming from this session will be ignored when false, see: SpectatorInputEvent
+   */
+  std::shared_ptr<std::atomic<bool>> input_allowed = std::make_shared<std::atomic<bool>>(true);
+};
+
+/**
+ * Fire this in order to grant (or revoke) a spectator the ability to control the host session
+ */
+struct SpectatorInputEvent {
+  std::size_t session_id;
+  bool allowed;
 };
 
 // TODO: unplug device event? Or should this be tied to the session?
 
 using SessionsAtoms = std::shared_ptr<immer::atom<immer::vector<StreamSession>>>;
 
+struct SessionPorts {
+  unsigned short video;
+  unsigned short audio;
+};
+
+/**
+ * Each running session leases a slot in [0, MAX_PING_PORTS) for its whole lifetime,
+ * the slot maps to the ports: VIDEO_PING_PORT + slot and AUDIO_PING_PORT + slot
+ */
+using PortLeases = std::shared_ptr<immer::atom<immer::map<std::size_t /* session_id */, unsigned short /* slot */>>>;
+
 /**
  * The whole application state as a composition of immutable datastructures
  */
@@ -259,12 +325,22 @@ struct AppState {
   /**
    * A shared bus of events so that we can decouple modules
    */
-  std::shared_ptr<dp::event_bus> event_bus;
+  std::shared_ptr<events::EventBus> event_bus;
 
   /**
    * A list of all currently running (and paused) streaming sessions
    */
   SessionsAtoms running_sessions;
+
+  /**
+   * The video and audio ports currently in use by the running sessions
+   */
+  PortLeases port_leases;
+
+  /**
+   * Shared thread pool for short lived async work (PING timeouts, session setup, ...)
+   */
+  std::shared_ptr<Executor> executor;
 };
 
 } // namespace state
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <helpers/executor.hpp>
+#include <helpers/logger.hpp>
+#include <immer/atom.hpp>
+#include <immer/map.hpp>
+#include <immer/vector.hpp>
+#include <map>
+#include <memory>
+#include <platforms/hw.hpp>
+#include <state/data-structures.hpp>
+#include <string>
+#include <vector>
+
+namespace state {
+
+using namespace std::chrono_literals;
+
+struct RenderNodeLoad {
+  std::string render_node;
+  std::size_t sessions; // running sessions (spectators excluded) on this render node
+  double utilization;   // [0, 1] how busy the most loaded engine of the GPU is, 0 when unknown
+};
+
+/**
+ * A fully busy GPU weighs as much as an additional session: usage stats take a while to account for a session
+ * that has just been started, so the number of sessions is what matters the most.
+ * Ties go to the first render node.
+ */
+inline std::string least_loaded_render_node(const std::vector<RenderNodeLoad> &loads) {
+  auto least_loaded = std::min_element(loads.begin(), loads.end(), [](const auto &a, const auto &b) {
+    return a.sessions + a.utilization < b.sessions + b.utilization;
+  });
+  return least_loaded->render_node;
+}
+
+/**
+ * @return the utilization of the most loaded engine, given two samples of get_gpu_busy_time() taken `elapsed` apart
+ */
+inline double engines_utilization(const std::map<std::string, std::uint64_t> &before,
+                                  const std::map<std::string, std::uint64_t> &after,
+                                  std::chrono::nanoseconds elapsed) {
+  double max_utilization = 0;
+  for (const auto &[engine, busy_ns] : after) {
+    auto prev = before.find(engine);
+    auto prev_ns = prev != before.end() ? prev->second : 0;
+    // Clients that exited in between are gone from the second sample
+    if (busy_ns > prev_ns && elapsed.count() > 0) {
+      max_utilization = std::max(max_utilization, static_cast<double>(busy_ns - prev_ns) / elapsed.count());
+    }
+  }
+  return std::min(max_utilization, 1.0);
+}
+
+/**
+ * The GPUs utilization as last sampled by watch_gpu_utilization(), GPUs that don't expose usage stats are missing
+ */
+inline immer::atom<immer::map<std::string /* render node */, double>> &gpu_utilization() {
+  static immer::atom<immer::map<std::string, double>> utilization;
+  return utilization;
+}
+
+/**
+ * Samples the usage stats of all the GPUs every `interval` on the executor, so that scheduling a session doesn't
+ * have to wait for (nor pay for) going through /proc; stops once the executor is gone.
+ * The utilization is computed between two consecutive samples, see: gpu_utilization()
+ */
+inline void watch_gpu_utilization(const std::weak_ptr<Executor> &executor,
+                                  std::chrono::milliseconds interval = 1s,
+                                  std::map<std::string, std::map<std::string, std::uint64_t>> busy_time =
+                                      get_gpu_busy_time(get_render_nodes()),
+                                  std::chrono::steady_clock::time_point sampled_at = std::chrono::steady_clock::now()) {
+  auto running = executor.lock();
+  if (!running) {
+    return;
+  }
+  running->run_after(interval, [executor, interval, busy_time = std::move(busy_time), sampled_at](const auto &ec) {
+    if (ec) {
+      return;
+    }
+    auto new_busy_time = get_gpu_busy_time(get_render_nodes());
+    auto now = std::chrono::steady_clock::now();
+    immer::map<std::string, double> utilization;
+    for (const auto &[render_node, engines] : new_busy_time) {
+      auto before = busy_time.find(render_node);
+      utilization = utilization.set(render_node,
+                                    before != busy_time.end()
+                                        ? engines_utilization(before->second, engines, now - sampled_at)
+                                        : 0.0);
+    }
+    gpu_utilization().store(utilization);
+    watch_gpu_utilization(executor, interval, std::move(new_busy_time), now);
+  });
+}
+
+inline std::vector<RenderNodeLoad> get_render_nodes_load(const immer::vector<StreamSession> &sessions,
+                                                         const std::vector<std::string> &render_nodes,
+                                                         const immer::map<std::string, double> &utilization) {
+  std::vector<RenderNodeLoad> loads;
+  for (const auto &render_node : render_nodes) {
+    auto n_sessions = std::count_if(sessions.begin(), sessions.end(), [&render_node](const StreamSession &session) {
+      return !session.host_session_id && session.app && session.app->render_node == render_node;
+    });
+    auto gpu_utilization = utilization.find(render_node);
+    loads.push_back({.render_node = render_node,
+                     .sessions = static_cast<std::size_t>(n_sessions),
+                     .utilization = gpu_utilization ? *gpu_utilization : 0.0});
+  }
+  return loads;
+}
+
+/**
+ * @return the render node where a new session of the given app should run; when App::schedule_render_node is set
+ *         this is the least loaded GPU among the ones that are the same model as App::render_node
+ *
+ * Doesn't block: in order to account for concurrent launches this should be called while adding the new session to
+ * running_sessions, see: endpoints::launch()
+ */
+inline std::string schedule_render_node(const immer::vector<StreamSession> &running_sessions, const App &app) {
+  if (!app.schedule_render_node) {
+    return app.render_node;
+  }
+
+  std::vector<std::string> candidates;
+  for (const auto &render_node : get_render_nodes()) {
+    if (is_same_gpu_model(app.render_node, render_node)) {
+      candidates.push_back(render_node);
+    }
+  }
+  if (candidates.size() <= 1) {
+    return app.render_node;
+  }
+
+  auto loads = get_render_nodes_load(running_sessions, candidates, *gpu_utilization().load());
+  for (const auto &load : loads) {
+    logs::log(logs::debug,
+              "[GPU] {} sessions: {} utilization: {:.0f}%",
+              load.render_node,
+              load.sessions,
+              load.utilization * 100);
+  }
+  return least_loaded_render_node(loads);
+}
+
+} // namespace state
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <bitset>
 #include <helpers/logger.hpp>
+#include <immer/map.hpp>
 #include <immer/vector.hpp>
 #include <optional>
 #include <range/v3/view.hpp>
@@ -39,6 +41,31 @@ inline std::optional<state::StreamSession> get_session_by_id(const immer::vector
   }
 }
 
+/**
+ * @return the first running session (that isn't a spectator itself) of the given app, if any
+ */
+inline std::optional<state::StreamSession> get_host_session_by_app(const immer::vector<state::StreamSession> &sessions,
+                                                                   const std::string &app_id) {
+  for (const auto &session : sessions) {
+    if (!session.host_session_id && session.app && session.app->base.id == app_id) {
+      return session;
+    }
+  }
+  return {};
+}
+
+/**
+ * @return all the sessions that are spectating the given host session
+ */
+inline immer::vector<state::StreamSession> get_spectators(const immer::vector<state::StreamSession> &sessions,
+                                                          std::size_t host_session_id) {
+  return sessions                                                                         //
+         | ranges::views::filter([host_session_id](const state::StreamSession &session) { //
+             return session.host_session_id == host_session_id;                           //
+           })                                                                             //
+         | ranges::to<immer::vector<state::StreamSession>>();                             //
+}
+
 inline immer::vector<state::StreamSession> remove_session(const immer::vector<state::StreamSession> &sessions,
                                                           const state::StreamSession &session) {
   return sessions                                                                                          //
@@ -46,4 +73,42 @@ inline immer::vector<state::StreamSession> remove_session(const immer::vector<st
              return cur_ses.session_id != remove_hash;                                                     //
            })                                                                                              //
          | ranges::to<immer::vector<state::StreamSession>>();                                              //
-}
\ No newline at end of file
+}
+
+/**
+ * Leases a (video, audio) pair of ports to the given session, calling this multiple times with the same session_id
+ * will return the same ports until release_ports() is called.
+ *
+ * @return an empty optional when all the ports are already in use
+ */
+inline std::optional<state::SessionPorts> lease_ports(const state::PortLeases &leases, std::size_t session_id) {
+  leases->update([session_id](const immer::map<std::size_t, unsigned short> &slots) {
+    if (slots.find(session_id)) {
+      return slots;
+    }
+    std::bitset<state::MAX_PING_PORTS> used;
+    for (const auto &[id, slot] : slots) {
+      used.set(slot);
+    }
+    for (unsigned short slot = 0; slot < state::MAX_PING_PORTS; slot++) {
+      if (!used.test(slot)) {
+        return slots.set(session_id, slot);
+      }
+    }
+    return slots;
+  });
+
+  if (auto slot = leases->load()->find(session_id)) {
+    return state::SessionPorts{.video = static_cast<unsigned short>(state::VIDEO_PING_PORT + *slot),
+                               .audio = static_cast<unsigned short>(state::AUDIO_PING_PORT + *slot)};
+  }
+  return {};
+}
+
+/**
+ * Returns the ports leased by the session back to the pool
+ */
+inline void release_ports(const state::PortLeases &leases, std::size_t session_id) {
+  leases->update(
+      [session_id](const immer::map<std::size_t, unsigned short> &slots) { return slots.erase(session_id); });
+}
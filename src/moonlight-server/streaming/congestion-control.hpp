@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <helpers/logger.hpp>
+#include <mutex>
+#include <optional>
+
+namespace streaming {
+
+using namespace std::chrono_literals;
+
+struct CongestionControlSettings {
+  int min_bitrate_kbps;
+  int max_bitrate_kbps;
+  int packet_size; // Used to estimate how many packets have been sent in each report interval
+
+  // Stats will be accumulated for this long before taking a decision
+  std::chrono::milliseconds window = 500ms;
+  // The bitrate will not be increased more often than this
+  std::chrono::milliseconds increase_interval = 1s;
+  // Loss ratio above which the bitrate will be decreased
+  double high_loss = 0.10;
+  // Loss ratio below which the bitrate can be increased
+  double low_loss = 0.02;
+  double increase_factor = 1.08;
+  // Decrease applied when the round trip time grows above the baseline, a sign that queues are building up
+  double delay_decrease_factor = 0.85;
+  // Decrease applied when the client had to ask for a new IDR or to invalidate reference frames
+  double recovery_decrease_factor = 0.85;
+  std::chrono::milliseconds rtt_tolerance = 30ms;
+  // The baseline round trip time is the minimum one seen in this window, so that a permanent change of route is
+  // eventually accepted as the new baseline instead of being treated as congestion forever
+  std::chrono::milliseconds min_rtt_window = 10s;
+};
+
+struct CongestionControlStats {
+  int bitrate_kbps;
+  std::size_t increases;
+  std::size_t decreases;
+  double last_loss_ratio;
+  std::chrono::milliseconds last_rtt;
+  std::uint32_t last_recovery_requests;
+};
+
+/**
+ * A loss and delay based bitrate controller, loosely modelled after the Google Congestion Control (GCC):
+ *  - when more than `high_loss` packets are lost the bitrate is decreased proportionally: rate * (1 - 0.5 * loss)
+ *  - when the client had to recover from broken frames the bitrate is decreased by `recovery_decrease_factor`, recent
+ *    clients don't report lost packets anymore and this is the only loss signal that we get
+ *  - when the round trip time grows above the minimum observed in the last `min_rtt_window` the bitrate is decreased by
+ *    `delay_decrease_factor`
+ *  - when there's no loss (below `low_loss`) and the delay is stable the bitrate is slowly increased
+ *
+ * The bitrate will always be in the [min_bitrate_kbps, max_bitrate_kbps] range.
+ */
+class CongestionController {
+public:
+  CongestionController(std::size_t session_id, int initial_bitrate_kbps, CongestionControlSettings settings)
+      : session_id(session_id), settings(settings),
+        bitrate_kbps(std::clamp(initial_bitrate_kbps, settings.min_bitrate_kbps, settings.max_bitrate_kbps)) {}
+
+  /**
+   * Feeds a new client report into the controller
+   *
+   * @return the new bitrate when it has to be changed
+   */
+  std::optional<int> on_network_stats(std::uint32_t lost_packets,
+                                      std::chrono::milliseconds interval,
+                                      std::chrono::milliseconds rtt,
+                                      std::uint32_t recovery_requests,
+                                      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+    std::lock_guard<std::mutex> lock(m);
+    if (window_start == std::chrono::steady_clock::time_point{}) {
+      window_start = now;
+      last_increase = now;
+    }
+
+    auto bytes_per_ms = (bitrate_kbps * 1000.0 / 8.0) / 1000.0;
+    window_sent += bytes_per_ms * static_cast<double>(interval.count()) / std::max(1, settings.packet_size);
+    window_lost += lost_packets;
+    window_recovery_requests += recovery_requests;
+    window_rtt = std::max(window_rtt, rtt);
+    update_min_rtt(rtt, now);
+
+    if (now - window_start < settings.window) {
+      return {};
+    }
+
+    auto loss_ratio = std::min(1.0, window_lost / std::max(1.0, window_sent + window_lost));
+    auto min_rtt = rtt_samples.front().second;
+    auto delay_increase = window_rtt - min_rtt;
+    auto target = static_cast<double>(bitrate_kbps);
+    const char *reason = nullptr;
+    if (loss_ratio > settings.high_loss) {
+      target *= 1.0 - 0.5 * loss_ratio;
+      reason = "packet loss";
+    } else if (window_recovery_requests > 0) {
+      target *= settings.recovery_decrease_factor;
+      reason = "frame loss";
+    } else if (delay_increase > settings.rtt_tolerance) {
+      target *= settings.delay_decrease_factor;
+      reason = "growing delay";
+    } else if (loss_ratio < settings.low_loss && now - last_increase >= settings.increase_interval) {
+      target *= settings.increase_factor;
+      last_increase = now;
+      reason = "stable network";
+    }
+
+    stats.last_loss_ratio = loss_ratio;
+    stats.last_rtt = window_rtt;
+    stats.last_recovery_requests = window_recovery_requests;
+    window_start = now;
+    window_sent = 0;
+    window_lost = 0;
+    window_recovery_requests = 0;
+    window_rtt = 0ms;
+
+    auto new_bitrate = std::clamp(static_cast<int>(target), settings.min_bitrate_kbps, settings.max_bitrate_kbps);
+    // Avoid re-configuring the encoder for negligible changes
+    if (!reason || std::abs(new_bitrate - bitrate_kbps) < std::max(1, bitrate_kbps / 50)) {
+      return {};
+    }
+
+    logs::log(logs::info,
+              "[ABR] Session {} bitrate {} -> {} kbps ({}, loss: {:.1f}%, rtt: {}ms, min rtt: {}ms)",
+              session_id,
+              bitrate_kbps,
+              new_bitrate,
+              reason,
+              loss_ratio * 100,
+              stats.last_rtt.count(),
+              min_rtt.count());
+    (new_bitrate > bitrate_kbps ? stats.increases : stats.decreases)++;
+    bitrate_kbps = new_bitrate;
+    return bitrate_kbps;
+  }
+
+  /**
+   * The bitrate has been changed by someone else, start from there
+   */
+  void set_bitrate(int new_bitrate_kbps) {
+    std::lock_guard<std::mutex> lock(m);
+    bitrate_kbps = std::clamp(new_bitrate_kbps, settings.min_bitrate_kbps, settings.max_bitrate_kbps);
+  }
+
+  CongestionControlStats get_stats() {
+    std::lock_guard<std::mutex> lock(m);
+    auto result = stats;
+    result.bitrate_kbps = bitrate_kbps;
+    return result;
+  }
+
+private:
+  /**
+   * Sliding window minimum: samples are kept in increasing order of RTT (any older sample with a higher or equal RTT
+   * can never be the minimum again) and dropped once they are older than `min_rtt_window`, the front is the minimum.
+   */
+  void update_min_rtt(std::chrono::milliseconds rtt, std::chrono::steady_clock::time_point now) {
+    while (!rtt_samples.empty() && rtt_samples.back().second >= rtt) {
+      rtt_samples.pop_back();
+    }
+    rtt_samples.emplace_back(now, rtt);
+    while (now - rtt_samples.front().first > settings.min_rtt_window) {
+      rtt_samples.pop_front();
+    }
+  }
+
+  std::size_t session_id;
+  CongestionControlSettings settings;
+  std::mutex m;
+
+  int bitrate_kbps;
+  CongestionControlStats stats{};
+
+  std::chrono::steady_clock::time_point window_start{};
+  std::chrono::steady_clock::time_point last_increase{};
+  double window_sent = 0;
+  double window_lost = 0;
+  std::uint32_t window_recovery_requests = 0;
+  std::chrono::milliseconds window_rtt = 0ms;
+  std::deque<std::pair<std::chrono::steady_clock::time_point, std::chrono::milliseconds>> rtt_samples;
+};
+
+} // namespace streaming
@@ -1,9 +1,9 @@
 #pragma once
 
 #include <chrono>
+#include <core/events.hpp>
 #include <core/input.hpp>
 #include <core/virtual-display.hpp>
-#include <eventbus/event_bus.hpp>
 #include <gst/gst.h>
 #include <immer/array.hpp>
 #include <immer/box.hpp>
@@ -29,6 +29,8 @@ enum ColorSpace : int {
 struct VideoSession {
   wolf::core::virtual_display::DisplayMode display_mode;
   std::string gst_pipeline;
+  // The GPU where the frames are rendered, available in gst_pipeline as {render_node}
+  std::string render_node = "/dev/dri/renderD128";
 
   // A unique ID that identifies this session
   std::size_t session_id;
@@ -47,6 +49,35 @@ struct VideoSession {
   ColorSpace color_space;
 
   std::string client_ip;
+
+  // When set, instead of starting a new pipeline this will be attached to the pipeline of the given session
+  std::optional<std::size_t> host_session_id = {};
+};
+
+/**
+ * Fire this in order to change the encoding parameters of a running video session without re-creating the pipeline.
+ * Parameters that are not set will be left untouched.
+ */
+struct VideoReconfigureEvent {
+  std::size_t session_id;
+
+  std::optional<int> bitrate_kbps;
+  std::optional<wolf::core::virtual_display::DisplayMode> display_mode;
+};
+
+/**
+ * Fired by the adaptive bitrate controller every time it changes the bitrate of a session,
+ * see: WOLF_ADAPTIVE_BITRATE
+ */
+struct VideoBitrateEvent {
+  std::size_t session_id;
+
+  int bitrate_kbps;
+  std::size_t increases;
+  std::size_t decreases;
+  double loss_ratio; // of the window that triggered the change
+  std::chrono::milliseconds rtt;
+  std::uint32_t recovery_requests;
 };
 
 struct AudioSession {
@@ -65,6 +96,9 @@ struct AudioSession {
   int packet_duration;
   int channels;
   int bitrate = 48000;
+
+  // When set, this will capture the audio of the given session instead of its own
+  std::optional<std::size_t> host_session_id = {};
 };
 
 /**
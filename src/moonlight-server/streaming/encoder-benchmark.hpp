@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <core/gstreamer.hpp>
+#include <core/virtual-display.hpp>
+#include <cstring>
+#include <fmt/format.h>
+#include <gst/gst.h>
+#include <helpers/logger.hpp>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <streaming/streaming.hpp>
+#include <string>
+
+namespace streaming {
+
+using namespace std::chrono_literals;
+
+struct EncoderBenchmarkResult {
+  std::size_t frames;
+  double avg_latency_ms; // Time spent by a frame in the encoder
+  double max_latency_ms;
+  double fps; // The source produces frames as fast as possible, this is the max throughput of the encoder
+};
+
+namespace benchmark {
+
+struct EncoderTimings {
+  std::mutex mutex;
+  std::map<GstClockTime /* pts */, std::chrono::steady_clock::time_point> in_flight;
+  std::optional<std::chrono::steady_clock::time_point> first_input;
+  std::chrono::steady_clock::time_point last_output;
+  std::chrono::steady_clock::duration total_latency{};
+  std::chrono::steady_clock::duration max_latency{};
+  std::size_t frames = 0;
+};
+
+static GstPadProbeReturn on_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto timings = static_cast<EncoderTimings *>(user_data);
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(timings->mutex);
+  if (!timings->first_input) {
+    timings->first_input = now;
+  }
+  timings->in_flight[GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info))] = now;
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_encoder_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto timings = static_cast<EncoderTimings *>(user_data);
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(timings->mutex);
+  auto input = timings->in_flight.find(GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+  if (input != timings->in_flight.end()) {
+    auto latency = now - input->second;
+    timings->total_latency += latency;
+    timings->max_latency = std::max(timings->max_latency, latency);
+    timings->frames++;
+    timings->last_output = now;
+    timings->in_flight.erase(input);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @return the first video encoder found in the pipeline, the caller owns the returned reference
+ */
+static GstElement *find_video_encoder(GstElement *pipeline) {
+  GstElement *encoder = nullptr;
+  wolf::core::gstreamer::for_each_element(pipeline, [&encoder](GstElement *element) {
+    auto factory = gst_element_get_factory(element);
+    auto klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : nullptr;
+    if (!encoder && klass && std::strstr(klass, "Encoder") && std::strstr(klass, "Video")) {
+      encoder = GST_ELEMENT(gst_object_ref(element));
+    }
+  });
+  return encoder;
+}
+
+} // namespace benchmark
+
+/**
+ * Pushes n_frames synthetic frames at the given resolution through the encoder and measures how long each frame
+ * spends in it.
+ *
+ * @param video_params, encoder_pipeline: the templates of the encoder as defined in the config file
+ * @return an empty optional if the pipeline fails or doesn't complete before the timeout
+ */
+static std::optional<EncoderBenchmarkResult> benchmark_encoder(const std::string &video_params,
+                                                               const std::string &encoder_pipeline,
+                                                               const wolf::core::virtual_display::DisplayMode &mode,
+                                                               const std::string &render_node,
+                                                               int n_frames = 300,
+                                                               std::chrono::seconds timeout = 60s) {
+  // Formatted like a real session would, so that every placeholder available to the templates is supported
+  auto session = state::VideoSession{.display_mode = mode,
+                                     .gst_pipeline = video_params + " ! " + encoder_pipeline,
+                                     .render_node = render_node,
+                                     .session_id = 0,
+                                     .port = 0,
+                                     .packet_size = 1024,
+                                     .fec_percentage = 20,
+                                     .min_required_fec_packets = 2,
+                                     .bitrate_kbps = 20000,
+                                     .slices_per_frame = 1,
+                                     .color_range = state::MPEG,
+                                     .color_space = state::BT709,
+                                     .client_ip = "127.0.0.1"};
+  std::string encoder_desc;
+  try {
+    encoder_desc = video_pipeline_description(session, 0);
+  } catch (const fmt::format_error &e) {
+    logs::log(logs::warning, "[BENCHMARK] Invalid template {}: {}", session.gst_pipeline, e.what());
+    return {};
+  }
+  // Same format as the frames produced by the virtual display
+  auto pipeline_desc = fmt::format("videotestsrc num-buffers={} pattern=ball is-live=false ! "
+                                   "video/x-raw, format=RGBx, width={}, height={}, framerate={}/1 ! "
+                                   "{} ! fakesink sync=false",
+                                   n_frames,
+                                   mode.width,
+                                   mode.height,
+                                   mode.refreshRate,
+                                   encoder_desc);
+
+  GError *error = nullptr;
+  auto pipeline = gst_parse_launch(pipeline_desc.c_str(), &error);
+  if (error) {
+    logs::log(logs::warning, "[BENCHMARK] Unable to create pipeline: {}", error->message);
+    g_error_free(error);
+    if (pipeline) {
+      gst_object_unref(pipeline);
+    }
+    return {};
+  }
+
+  auto encoder = benchmark::find_video_encoder(pipeline);
+  if (!encoder) {
+    logs::log(logs::warning, "[BENCHMARK] No video encoder found in: {}", encoder_desc);
+    gst_object_unref(pipeline);
+    return {};
+  }
+
+  benchmark::EncoderTimings timings;
+  auto sink_pad = gst_element_get_static_pad(encoder, "sink");
+  auto src_pad = gst_element_get_static_pad(encoder, "src");
+  gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, benchmark::on_encoder_input, &timings, nullptr);
+  gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, benchmark::on_encoder_output, &timings, nullptr);
+  gst_object_unref(sink_pad);
+  gst_object_unref(src_pad);
+  gst_object_unref(encoder);
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  auto bus = gst_element_get_bus(pipeline);
+  auto msg = gst_bus_timed_pop_filtered(bus,
+                                        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(),
+                                        static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  bool completed = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+  if (!msg) {
+    logs::log(logs::warning, "[BENCHMARK] Timeout while running: {}", encoder_desc);
+  } else if (!completed) {
+    GError *err = nullptr;
+    gst_message_parse_error(msg, &err, nullptr);
+    logs::log(logs::warning, "[BENCHMARK] Pipeline error: {}", err->message);
+    g_error_free(err);
+  }
+  if (msg) {
+    gst_message_unref(msg);
+  }
+  gst_object_unref(bus);
+  // After this no probe will be called anymore
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+
+  if (!completed || timings.frames == 0) {
+    return {};
+  }
+  auto elapsed = std::chrono::duration<double>(timings.last_output - *timings.first_input).count();
+  return EncoderBenchmarkResult{
+      .frames = timings.frames,
+      .avg_latency_ms = std::chrono::duration<double, std::milli>(timings.total_latency).count() / timings.frames,
+      .max_latency_ms = std::chrono::duration<double, std::milli>(timings.max_latency).count(),
+      .fps = elapsed > 0 ? timings.frames / elapsed : 0};
+}
+
+} // namespace streaming
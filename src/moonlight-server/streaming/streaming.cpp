@@ -1,52 +1,207 @@
+#include <algorithm>
+#include <atomic>
 #include <control/control.hpp>
 #include <core/gstreamer.hpp>
+#include <cstring>
+#include <filesystem>
 #include <functional>
 #include <gst-plugin/video.hpp>
 #include <gstreamer-1.0/gst/app/gstappsink.h>
 #include <gstreamer-1.0/gst/app/gstappsrc.h>
+#include <helpers/utils.hpp>
 #include <immer/array.hpp>
 #include <immer/array_transient.hpp>
+#include <immer/atom.hpp>
 #include <immer/box.hpp>
+#include <immer/map.hpp>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <platforms/hw.hpp>
+#include <streaming/congestion-control.hpp>
 #include <streaming/data-structures.hpp>
 #include <streaming/streaming.hpp>
+#include <vector>
 
 namespace streaming {
 
 struct GstAppDataState {
   wolf::core::gstreamer::gst_element_ptr app_src;
   wolf::core::virtual_display::wl_state_ptr wayland_state;
+  GMainContext *context = nullptr; // the context of the pipeline main loop, frames will be pulled from there
   guint source_id{};
   int framerate;
-  GstClockTime timestamp = 0;
+  gint64 next_frame_us = 0;                   // monotonic time at which the next frame will be pulled
+  GstClockTime last_pts = GST_CLOCK_TIME_NONE; // timestamp of the last pushed buffer
+  bool skip_static_frames = true;
+  GstBuffer *last_frame = nullptr; // a reference to the last pushed buffer, used to detect static frames
+  std::size_t sample_offset = 0;   // see: is_same_frame()
+
+  // Set by a VideoReconfigureEvent, will be applied by push_data() before pulling the next frame
+  std::mutex pending_mutex;
+  std::optional<wolf::core::virtual_display::DisplayMode> pending_display_mode;
 };
 
+/**
+ * When the screen doesn't change we still push a frame at least this often, so that the client doesn't think that
+ * the stream is stuck
+ */
+static constexpr GstClockTime STATIC_FRAMES_KEEPALIVE = 100 * GST_MSECOND;
+
+/**
+ * Static frames are detected by comparing FRAME_SAMPLE_SIZE bytes every FRAME_SAMPLE_STRIDE bytes
+ */
+static constexpr std::size_t FRAME_SAMPLE_STRIDE = 4096;
+static constexpr std::size_t FRAME_SAMPLE_SIZE = 64;
+
 namespace custom_src {
 
+/**
+ * g_source_remove() only looks into the global default context, our sources are attached to the pipeline context
+ */
+static void remove_source(GMainContext *context, guint source_id) {
+  if (auto source = g_main_context_find_source_by_id(context, source_id)) {
+    g_source_destroy(source);
+  }
+}
+
 std::shared_ptr<GstAppDataState> setup_app_src(const immer::box<state::VideoSession> &video_session,
                                                wolf::core::virtual_display::wl_state_ptr wl_ptr) {
+  bool skip_static_frames = std::string(utils::get_env("WOLF_SKIP_STATIC_FRAMES", "TRUE")) == "TRUE";
   return std::shared_ptr<GstAppDataState>(new GstAppDataState{.wayland_state = std::move(wl_ptr),
                                                               .source_id = 0,
-                                                              .framerate = video_session->display_mode.refreshRate},
+                                                              .framerate = video_session->display_mode.refreshRate,
+                                                              .skip_static_frames = skip_static_frames},
                                           [](const auto &app_data_state) {
                                             logs::log(logs::trace, "~GstAppDataState");
                                             if (app_data_state->source_id != 0) {
-                                              g_source_remove(app_data_state->source_id);
+                                              remove_source(app_data_state->context, app_data_state->source_id);
+                                            }
+                                            if (app_data_state->context) {
+                                              g_main_context_unref(app_data_state->context);
+                                            }
+                                            if (app_data_state->last_frame) {
+                                              gst_buffer_unref(app_data_state->last_frame);
                                             }
                                             delete app_data_state;
                                           });
 }
 
+/**
+ * @return the current running time of the element, GST_CLOCK_TIME_NONE if the element doesn't have a clock (yet)
+ */
+static GstClockTime get_running_time(GstElement *element) {
+  GstClockTime running_time = GST_CLOCK_TIME_NONE;
+  if (auto clock = gst_element_get_clock(element)) {
+    auto now = gst_clock_get_time(clock);
+    auto base_time = gst_element_get_base_time(element);
+    if (now >= base_time) {
+      running_time = now - base_time;
+    }
+    gst_object_unref(clock);
+  }
+  return running_time;
+}
+
+/**
+ * The compositor doesn't tell us which parts of the screen changed, but:
+ *  - when it didn't render anything new it'll hand us back the same buffer
+ *  - otherwise we only compare a sparse sample of the two frames, a full comparison would have to read the whole
+ *    frame twice on every pull; exactly when the screen is static.
+ *
+ * The sampled bytes move at every call (sample_offset) so that, over time, the whole frame is covered.
+ * A change that falls in between the samples will still be sent by the next keep-alive frame.
+ */
+static bool is_same_frame(GstBuffer *previous, GstBuffer *current, std::size_t sample_offset) {
+  if (previous == nullptr) {
+    return false;
+  } else if (previous == current) {
+    return true;
+  } else if (gst_buffer_get_size(previous) != gst_buffer_get_size(current)) {
+    return false;
+  }
+
+  GstMapInfo previous_map, current_map;
+  if (!gst_buffer_map(previous, &previous_map, GST_MAP_READ)) {
+    return false;
+  }
+  bool same = false;
+  if (gst_buffer_map(current, &current_map, GST_MAP_READ)) {
+    same = true;
+    for (auto offset = sample_offset % FRAME_SAMPLE_STRIDE; same && offset < current_map.size;
+         offset += FRAME_SAMPLE_STRIDE) {
+      auto size = std::min(FRAME_SAMPLE_SIZE, current_map.size - offset);
+      same = std::memcmp(previous_map.data + offset, current_map.data + offset, size) == 0;
+    }
+    gst_buffer_unmap(current, &current_map);
+  }
+  gst_buffer_unmap(previous, &previous_map);
+  return same;
+}
+
 static bool push_data(GstAppDataState *data) {
   GstFlowReturn ret;
 
+  std::optional<wolf::core::virtual_display::DisplayMode> new_display_mode;
+  {
+    std::lock_guard<std::mutex> lock(data->pending_mutex);
+    new_display_mode.swap(data->pending_display_mode);
+  }
+  if (new_display_mode) {
+    WOLF_LOG(logs::debug,
+             "[WAYLAND] Changing resolution to {}x{}@{}",
+             new_display_mode->width,
+             new_display_mode->height,
+             new_display_mode->refreshRate);
+    data->framerate = new_display_mode->refreshRate;
+    set_resolution(*data->wayland_state, *new_display_mode, data->app_src);
+  }
+
+  auto frame_duration = gst_util_uint64_scale_int(1, GST_SECOND, data->framerate);
+
+  /*
+   * Schedule the next pull exactly one frame after this one (instead of one frame after now) so that small delays
+   * in the main loop don't accumulate; when we are late by more than a frame we skip ahead instead of bursting.
+   */
+  auto now_us = g_get_monotonic_time();
+  data->next_frame_us += static_cast<gint64>(frame_duration / GST_USECOND);
+  if (data->next_frame_us < now_us) {
+    data->next_frame_us = now_us;
+  }
+  g_source_set_ready_time(g_main_current_source(), data->next_frame_us);
+
   auto buffer = get_frame(*data->wayland_state);
   if (GST_IS_BUFFER(buffer) && GST_IS_APP_SRC(data->app_src.get())) {
 
-    GST_BUFFER_PTS(buffer) = data->timestamp;
-    GST_BUFFER_DTS(buffer) = data->timestamp;
-    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale_int(1, GST_SECOND, data->framerate);
-    data->timestamp += GST_BUFFER_DURATION(buffer);
+    // Timestamp the buffer with the moment it has been captured, falls back to a synthetic timestamp before PLAYING
+    auto pts = get_running_time(data->app_src.get());
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+      pts = GST_CLOCK_TIME_IS_VALID(data->last_pts) ? data->last_pts + frame_duration : 0;
+    } else if (GST_CLOCK_TIME_IS_VALID(data->last_pts) && pts <= data->last_pts) {
+      pts = data->last_pts + 1;
+    }
+
+    data->sample_offset += FRAME_SAMPLE_SIZE;
+    if (data->skip_static_frames && is_same_frame(data->last_frame, buffer, data->sample_offset)) {
+      if (GST_CLOCK_TIME_IS_VALID(data->last_pts) && pts - data->last_pts < STATIC_FRAMES_KEEPALIVE) {
+        gst_buffer_unref(buffer);
+        return true;
+      }
+      // Keep-alive: the encoder will produce a (tiny) frame that only references the previous one
+      buffer = gst_buffer_make_writable(buffer);
+    }
+    data->last_pts = pts;
+
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DTS(buffer) = pts;
+    GST_BUFFER_DURATION(buffer) = frame_duration;
+
+    if (data->skip_static_frames) {
+      if (data->last_frame) {
+        gst_buffer_unref(data->last_frame);
+      }
+      data->last_frame = gst_buffer_ref(buffer);
+    }
 
     // gst_app_src_push_buffer takes ownership of the buffer
     ret = gst_app_src_push_buffer(GST_APP_SRC(data->app_src.get()), buffer);
@@ -55,21 +210,36 @@ static bool push_data(GstAppDataState *data) {
     }
   }
 
-  logs::log(logs::debug, "[WAYLAND] Error during app-src push data");
+  WOLF_LOG(logs::debug, "[WAYLAND] Error during app-src push data");
+  data->source_id = 0; // returning false will remove the source
   return false;
 }
 
+/**
+ * A source that is dispatched at the time set with g_source_set_ready_time(), see push_data()
+ */
+static gboolean frame_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+  return callback(user_data);
+}
+
+static GSourceFuncs frame_source_funcs = {.prepare = nullptr, .check = nullptr, .dispatch = frame_source_dispatch};
+
 static void app_src_need_data(GstElement *pipeline, guint size, GstAppDataState *data) {
   if (data->source_id == 0) {
-    logs::log(logs::debug, "[WAYLAND] Start feeding app-src");
-    data->source_id = g_idle_add((GSourceFunc)push_data, data);
+    WOLF_LOG(logs::debug, "[WAYLAND] Start feeding app-src");
+    auto source = g_source_new(&frame_source_funcs, sizeof(GSource));
+    g_source_set_callback(source, (GSourceFunc)push_data, data, nullptr);
+    data->next_frame_us = g_get_monotonic_time();
+    g_source_set_ready_time(source, data->next_frame_us);
+    data->source_id = g_source_attach(source, data->context);
+    g_source_unref(source); // The main context holds a reference until it's removed
   }
 }
 
 static void app_src_enough_data(GstElement *pipeline, guint size, GstAppDataState *data) {
   if (data->source_id != 0) {
-    logs::log(logs::debug, "[WAYLAND] Stop feeding app-src");
-    g_source_remove(data->source_id);
+    WOLF_LOG(logs::debug, "[WAYLAND] Stop feeding app-src");
+    remove_source(data->context, data->source_id);
     data->source_id = 0;
   }
 }
@@ -77,17 +247,320 @@ static void app_src_enough_data(GstElement *pipeline, guint size, GstAppDataStat
 
 using namespace wolf::core::gstreamer;
 
+namespace warm_pause {
+
 /**
- * Start VIDEO pipeline
+ * A pipeline that has been set to PAUSED when the client paused the stream, it can be resumed by simply pointing the
+ * network sink to the new client and without re-initialising the encoder.
  */
-void start_streaming_video(const immer::box<state::VideoSession> &video_session,
-                           const std::shared_ptr<dp::event_bus> &event_bus,
-                           wolf::core::virtual_display::wl_state_ptr wl_ptr,
-                           unsigned short client_port) {
-  std::string color_range = (static_cast<int>(video_session->color_range) == static_cast<int>(state::JPEG)) ? "jpeg"
-                                                                                                            : "mpeg2";
+template <typename SessionType> struct PausedPipeline {
+  immer::box<SessionType> session; // The session as the pipeline is running now, see: VideoReconfigureEvent
+  gst_element_ptr pipeline;
+  gst_main_loop_ptr loop;
+  std::size_t pause_id; // Tells apart subsequent pauses of the same pipeline, see: expire()
+};
+
+template <typename SessionType>
+using paused_pipelines = immer::atom<immer::map<std::size_t /* session_id */, PausedPipeline<SessionType>>>;
+
+static paused_pipelines<state::VideoSession> paused_video;
+static paused_pipelines<state::AudioSession> paused_audio;
+static std::atomic<std::size_t> next_pause_id = 0;
+
+static bool is_enabled() {
+  return std::string(utils::get_env("WOLF_WARM_PAUSE", "TRUE")) == "TRUE";
+}
+
+static guint timeout_seconds() {
+  static const guint timeout = []() -> guint {
+    try {
+      return std::max(0, std::stoi(utils::get_env("WOLF_WARM_PAUSE_TIMEOUT", "300")));
+    } catch (const std::exception &e) {
+      logs::log(logs::warning, "Invalid WOLF_WARM_PAUSE_TIMEOUT, using the default of 300 seconds");
+      return 300;
+    }
+  }();
+  return timeout;
+}
+
+template <typename SessionType> struct PauseTimeout {
+  paused_pipelines<SessionType> *paused;
+  std::size_t session_id;
+  std::size_t pause_id;
+};
+
+/**
+ * A client might never come back, after WOLF_WARM_PAUSE_TIMEOUT the paused pipeline is stopped so that the encoder
+ * and the rest of its resources are released. Does nothing if the pipeline has been resumed in the meantime.
+ */
+template <typename SessionType> static gboolean expire(gpointer user_data) {
+  auto timeout = static_cast<PauseTimeout<SessionType> *>(user_data);
+  std::optional<PausedPipeline<SessionType>> expired;
+  timeout->paused->update([&](const auto &map) {
+    // update() might be retried, make sure that expired only reflects the last run
+    expired.reset();
+    auto found = map.find(timeout->session_id);
+    if (found && found->pause_id == timeout->pause_id) {
+      expired = *found;
+      return map.erase(timeout->session_id);
+    }
+    return map;
+  });
+  if (expired) {
+    logs::log(logs::debug, "[GSTREAMER] Session {} has been paused for too long, stopping", timeout->session_id);
+    g_main_loop_quit(expired->loop.get());
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Keeps an already PAUSED pipeline around so that it can be resumed, see: try_resume()
+ */
+template <typename SessionType>
+static void store(paused_pipelines<SessionType> &paused,
+                  const immer::box<SessionType> &session,
+                  gst_element_ptr pipeline,
+                  gst_main_loop_ptr loop) {
+  // The client will send a PING on the same port before resuming, the sinks must not get it
+  release_udp_sinks(pipeline.get());
+
+  auto pause_id = next_pause_id++;
+  paused.update([&](const auto &map) {
+    return map.set(session->session_id, PausedPipeline<SessionType>{session, pipeline, loop, pause_id});
+  });
+
+  // The timeout is attached to the context of the pipeline, it'll be dropped together with it
+  auto source = g_timeout_source_new_seconds(timeout_seconds());
+  g_source_set_callback(
+      source,
+      expire<SessionType>,
+      new PauseTimeout<SessionType>{.paused = &paused, .session_id = session->session_id, .pause_id = pause_id},
+      [](gpointer user_data) { delete static_cast<PauseTimeout<SessionType> *>(user_data); });
+  g_source_attach(source, g_main_loop_get_context(loop.get()));
+  g_source_unref(source);
+}
+
+/**
+ * Removes the paused pipeline (if any) for the given session
+ */
+template <typename SessionType>
+static std::optional<PausedPipeline<SessionType>> take(paused_pipelines<SessionType> &paused,
+                                                       std::size_t session_id) {
+  std::optional<PausedPipeline<SessionType>> result;
+  paused.update([&](const auto &map) {
+    // update() might be retried, make sure that result only reflects the last run
+    result.reset();
+    if (auto found = map.find(session_id)) {
+      result = *found;
+      return map.erase(session_id);
+    }
+    return map;
+  });
+  return result;
+}
+
+/**
+ * A paused video pipeline can be re-used only if the encoder would have been created with the same parameters
+ */
+static bool can_resume(const state::VideoSession &paused, const state::VideoSession &resumed) {
+  return paused.gst_pipeline == resumed.gst_pipeline &&                         //
+         paused.display_mode.width == resumed.display_mode.width &&             //
+         paused.display_mode.height == resumed.display_mode.height &&           //
+         paused.display_mode.refreshRate == resumed.display_mode.refreshRate && //
+         paused.bitrate_kbps == resumed.bitrate_kbps &&                         //
+         paused.packet_size == resumed.packet_size &&                           //
+         paused.fec_percentage == resumed.fec_percentage &&                     //
+         paused.min_required_fec_packets == resumed.min_required_fec_packets && //
+         paused.slices_per_frame == resumed.slices_per_frame &&                 //
+         paused.color_range == resumed.color_range &&                           //
+         paused.color_space == resumed.color_space &&                           //
+         paused.port == resumed.port;
+}
+
+/**
+ * AES key and IV will be different on every resume but can be changed on the fly, see: update_audio_encryption()
+ */
+static bool can_resume(const state::AudioSession &paused, const state::AudioSession &resumed) {
+  return paused.gst_pipeline == resumed.gst_pipeline &&       //
+         paused.channels == resumed.channels &&               //
+         paused.bitrate == resumed.bitrate &&                 //
+         paused.packet_duration == resumed.packet_duration && //
+         paused.encrypt_audio == resumed.encrypt_audio &&     //
+         paused.port == resumed.port;
+}
+
+static void update_audio_encryption(GstElement *pipeline, const state::AudioSession &session) {
+  if (auto payloader = gst_bin_get_by_name(GST_BIN(pipeline), "moonlight_pay")) {
+    g_object_set(payloader, "aes_key", session.aes_key.c_str(), "aes_iv", session.aes_iv.c_str(), NULL);
+    gst_object_unref(payloader);
+  } else {
+    logs::log(logs::warning, "[GSTREAMER] Unable to find moonlight_pay, audio encryption keys not updated");
+  }
+}
+
+/**
+ * Tries to resume a previously paused pipeline for the given session.
+ * If the session parameters changed the paused pipeline will be stopped so that a new one can be created.
+ *
+ * @return true if the pipeline has been resumed
+ */
+template <typename SessionType, typename OnResume>
+static bool try_resume(paused_pipelines<SessionType> &paused,
+                       const immer::box<SessionType> &session,
+                       unsigned short client_port,
+                       OnResume &&on_resume) {
+  auto paused_pipeline = take(paused, session->session_id);
+  if (!paused_pipeline) {
+    return false;
+  }
+
+  if (!can_resume(*paused_pipeline->session, *session)) {
+    logs::log(logs::debug, "[GSTREAMER] Session {} parameters changed, re-creating pipeline", session->session_id);
+    g_main_loop_quit(paused_pipeline->loop.get());
+    return false;
+  }
+
+  logs::log(logs::debug, "[GSTREAMER] Resuming pipeline: {}", session->session_id);
+  auto pipeline = paused_pipeline->pipeline.get();
+  restore_udp_sinks(pipeline, session->client_ip, client_port);
+  on_resume(pipeline);
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    logs::log(logs::warning, "[GSTREAMER] Unable to resume pipeline {}, re-creating it", session->session_id);
+    g_main_loop_quit(paused_pipeline->loop.get());
+    return false;
+  }
+  return true;
+}
+
+} // namespace warm_pause
+
+namespace spectators {
+
+/**
+ * The video pipelines that are currently running, spectators will be attached to these
+ */
+struct HostPipeline {
+  immer::box<state::VideoSession> session;
+  gst_element_ptr pipeline;
+};
+
+static immer::atom<immer::map<std::size_t /* session_id */, HostPipeline>> running_video;
+
+static void store(const immer::box<state::VideoSession> &session, gst_element_ptr pipeline) {
+  running_video.update([&](const auto &map) { return map.set(session->session_id, HostPipeline{session, pipeline}); });
+}
+
+/**
+ * Removes the pipeline only if it hasn't been replaced in the meantime by a new one for the same session
+ */
+static void remove(std::size_t session_id, GstElement *pipeline) {
+  running_video.update([&](const auto &map) {
+    auto found = map.find(session_id);
+    return (found && found->pipeline.get() == pipeline) ? map.erase(session_id) : map;
+  });
+}
+
+/**
+ * The branch that has been attached to the host tee: queue ! rtpmoonlightpay_video ! udpsink
+ */
+struct SpectatorBranch {
+  std::size_t session_id;
+  gst_element_ptr pipeline;
+  gst_element_ptr tee;
+  GstPad *tee_pad;
+  GstElement *bin; // owned by the pipeline
+
+  std::atomic<bool> detached{false};
+  std::mutex handlers_mutex;
+  std::vector<wolf::core::events::handler_registration> handlers;
+};
+
+static GstPadProbeReturn unlink_branch(GstPad *tee_pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto branch = *static_cast<std::shared_ptr<SpectatorBranch> *>(user_data);
+  logs::log(logs::debug, "[GSTREAMER] Detaching spectator {}", branch->session_id);
+
+  if (auto bin_pad = gst_element_get_static_pad(branch->bin, "sink")) {
+    gst_pad_unlink(tee_pad, bin_pad);
+    gst_object_unref(bin_pad);
+  }
+  gst_element_release_request_pad(branch->tee.get(), tee_pad);
+  gst_object_unref(tee_pad);
+
+  gst_element_set_state(branch->bin, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(branch->pipeline.get()), branch->bin);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * Stops sending data to the spectator, the host pipeline will keep running untouched.
+ * Can be safely called multiple times.
+ */
+static void detach(const std::shared_ptr<SpectatorBranch> &branch) {
+  if (branch->detached.exchange(true)) {
+    return;
+  }
+
+  // Wait for the tee to be done pushing the current buffer before unlinking
+  gst_pad_add_probe(
+      branch->tee_pad,
+      GST_PAD_PROBE_TYPE_IDLE,
+      unlink_branch,
+      new std::shared_ptr<SpectatorBranch>(branch),
+      [](gpointer data) { delete static_cast<std::shared_ptr<SpectatorBranch> *>(data); });
+
+  // The handlers are the only other ones holding a reference to the branch
+  std::vector<wolf::core::events::handler_registration> handlers;
+  {
+    std::lock_guard<std::mutex> lock(branch->handlers_mutex);
+    handlers.swap(branch->handlers);
+  }
+  for (const auto &handler : handlers) {
+    handler.unregister();
+  }
+}
+
+} // namespace spectators
+
+/**
+ * nvcodec picks the GPU by CUDA device id: with CUDA_DEVICE_ORDER=PCI_BUS_ID (see: init()) that's the position of the
+ * GPU among the Nvidia ones, sorted by PCI address.
+ * @return the CUDA device id of the given render node, 0 when it's not an Nvidia GPU
+ */
+static int cuda_device_id(const std::string &render_node) {
+  auto inventory = get_hardware_inventory();
+  auto gpu = inventory->find(render_node);
+  if (gpu == inventory->end() || gpu->second.vendor != NVIDIA) {
+    return 0;
+  }
+  std::vector<std::string> nvidia_slots;
+  for (const auto &[_, info] : *inventory) {
+    if (info.vendor == NVIDIA) {
+      nvidia_slots.push_back(info.pci_slot);
+    }
+  }
+  std::sort(nvidia_slots.begin(), nvidia_slots.end());
+  auto slot = std::find(nvidia_slots.begin(), nvidia_slots.end(), gpu->second.pci_slot);
+  return static_cast<int>(std::distance(nvidia_slots.begin(), slot));
+}
+
+/**
+ * The VA plugin registers the elements of the first device as `vapostproc`, `vah264enc`, ...
+ * the other devices get their own elements named after the render node: `varenderD129postproc`, ...
+ * @return the name to put between `va` and the element name for the given render node, empty for the first device
+ */
+static std::string va_device(const std::string &render_node) {
+  auto device = std::filesystem::path(render_node).filename().string();
+  if (auto factory = gst_element_factory_find(fmt::format("va{}postproc", device).c_str())) {
+    gst_object_unref(factory);
+    return device;
+  }
+  return "";
+}
+
+std::string video_pipeline_description(const state::VideoSession &session, unsigned short client_port) {
+  std::string color_range = (static_cast<int>(session.color_range) == static_cast<int>(state::JPEG)) ? "jpeg" : "mpeg2";
   std::string color_space;
-  switch (static_cast<int>(video_session->color_space)) {
+  switch (static_cast<int>(session.color_space)) {
   case state::BT601:
     color_space = "bt601";
     break;
@@ -99,30 +572,148 @@ void start_streaming_video(const immer::box<state::VideoSession> &video_session,
     break;
   }
 
-  auto pipeline = fmt::format(video_session->gst_pipeline,
-                              fmt::arg("width", video_session->display_mode.width),
-                              fmt::arg("height", video_session->display_mode.height),
-                              fmt::arg("fps", video_session->display_mode.refreshRate),
-                              fmt::arg("bitrate", video_session->bitrate_kbps),
-                              fmt::arg("client_port", client_port),
-                              fmt::arg("client_ip", video_session->client_ip),
-                              fmt::arg("payload_size", video_session->packet_size),
-                              fmt::arg("fec_percentage", video_session->fec_percentage),
-                              fmt::arg("min_required_fec_packets", video_session->min_required_fec_packets),
-                              fmt::arg("slices_per_frame", video_session->slices_per_frame),
-                              fmt::arg("color_space", color_space),
-                              fmt::arg("color_range", color_range),
-                              fmt::arg("host_port", video_session->port));
+  // Legacy nvcodec encoders can't change device, each GPU after the first one gets its own: `nvh264device1enc`, ...
+  auto cuda_id = cuda_device_id(session.render_node);
+  auto nv_device = cuda_id > 0 ? fmt::format("device{}", cuda_id) : "";
+
+  return fmt::format(session.gst_pipeline,
+                     fmt::arg("width", session.display_mode.width),
+                     fmt::arg("height", session.display_mode.height),
+                     fmt::arg("fps", session.display_mode.refreshRate),
+                     fmt::arg("bitrate", session.bitrate_kbps),
+                     fmt::arg("client_port", client_port),
+                     fmt::arg("client_ip", session.client_ip),
+                     fmt::arg("payload_size", session.packet_size),
+                     fmt::arg("fec_percentage", session.fec_percentage),
+                     fmt::arg("min_required_fec_packets", session.min_required_fec_packets),
+                     fmt::arg("slices_per_frame", session.slices_per_frame),
+                     fmt::arg("color_space", color_space),
+                     fmt::arg("color_range", color_range),
+                     fmt::arg("render_node", session.render_node),
+                     fmt::arg("cuda_device_id", cuda_id),
+                     fmt::arg("nv_device", nv_device),
+                     fmt::arg("va_device", va_device(session.render_node)),
+                     fmt::arg("host_port", session.port));
+}
+
+std::string audio_pipeline_description(const state::AudioSession &session,
+                                       unsigned short client_port,
+                                       const std::string &sink_name,
+                                       const std::string &server_name) {
+  return fmt::format(session.gst_pipeline,
+                     fmt::arg("channels", session.channels),
+                     fmt::arg("bitrate", session.bitrate),
+                     fmt::arg("sink_name", sink_name),
+                     fmt::arg("server_name", server_name),
+                     fmt::arg("packet_duration", session.packet_duration),
+                     fmt::arg("aes_key", session.aes_key),
+                     fmt::arg("aes_iv", session.aes_iv),
+                     fmt::arg("encrypt", session.encrypt_audio),
+                     fmt::arg("client_port", client_port),
+                     fmt::arg("client_ip", session.client_ip),
+                     fmt::arg("host_port", session.port));
+}
+
+/**
+ * Formats the template with placeholder values and preloads the resulting pipeline, see: preload_pipeline()
+ */
+template <typename FormatFn> static bool preload(std::string_view kind, const std::string &title, FormatFn &&format) {
+  std::optional<std::string> error;
+  try {
+    error = preload_pipeline(format());
+  } catch (const fmt::format_error &e) {
+    error = fmt::format("invalid template, {}", e.what());
+  }
+  if (error) {
+    logs::log(logs::error, "[GSTREAMER] App {}: {} pipeline is not valid: {}", title, kind, *error);
+    return false;
+  }
+  return true;
+}
+
+bool preload_video_pipeline(const std::string &app_title,
+                            const std::string &gst_pipeline,
+                            const std::string &render_node) {
+  return preload("video", app_title, [&]() {
+    auto session = state::VideoSession{.display_mode = {.width = 1920, .height = 1080, .refreshRate = 60},
+                                       .gst_pipeline = gst_pipeline,
+                                       .render_node = render_node,
+                                       .session_id = 0,
+                                       .port = 0,
+                                       .packet_size = 1024,
+                                       .fec_percentage = 20,
+                                       .min_required_fec_packets = 2,
+                                       .bitrate_kbps = 15500,
+                                       .slices_per_frame = 1,
+                                       .color_range = state::MPEG,
+                                       .color_space = state::BT709,
+                                       .client_ip = "127.0.0.1"};
+    return video_pipeline_description(session, 0);
+  });
+}
+
+bool preload_audio_pipeline(const std::string &app_title, const std::string &gst_pipeline) {
+  return preload("audio", app_title, [&]() {
+    auto session = state::AudioSession{.gst_pipeline = gst_pipeline,
+                                       .session_id = 0,
+                                       .encrypt_audio = true,
+                                       .aes_key = "0000000000000000",
+                                       .aes_iv = "0000000000000000",
+                                       .port = 0,
+                                       .client_ip = "127.0.0.1",
+                                       .packet_duration = 5,
+                                       .channels = 2};
+    return audio_pipeline_description(session, 0, "virtual_sink.monitor", "");
+  });
+}
+
+/**
+ * Start VIDEO pipeline
+ */
+void start_streaming_video(const immer::box<state::VideoSession> &video_session,
+                           const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
+                           wolf::core::virtual_display::wl_state_ptr wl_ptr,
+                           unsigned short client_port) {
+  if (warm_pause::try_resume(warm_pause::paused_video, video_session, client_port, [](GstElement *pipeline) {
+        // The client has to start decoding from scratch
+        send_message(pipeline, gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
+      })) {
+    return;
+  }
+
+  auto pipeline = video_pipeline_description(*video_session, client_port);
   logs::log(logs::debug, "Starting video pipeline: {}", pipeline);
 
   auto appsrc_state = custom_src::setup_app_src(video_session, std::move(wl_ptr));
 
-  run_pipeline(pipeline, [video_session, event_bus, appsrc_state](auto pipeline, auto loop) {
+  // The client requested bitrate is the upper bound, we'll lower it when the network can't keep up
+  std::shared_ptr<CongestionController> congestion_control;
+  if (std::string(utils::get_env("WOLF_ADAPTIVE_BITRATE", "TRUE")) == "TRUE") {
+    auto min_bitrate = std::stoi(utils::get_env("WOLF_ADAPTIVE_BITRATE_MIN_KBPS", "1500"));
+    congestion_control = std::make_shared<CongestionController>(
+        video_session->session_id,
+        video_session->bitrate_kbps,
+        CongestionControlSettings{.min_bitrate_kbps = std::min(min_bitrate, video_session->bitrate_kbps),
+                                  .max_bitrate_kbps = video_session->bitrate_kbps,
+                                  .packet_size = video_session->packet_size});
+  }
+
+  // Live reconfigurations change the mode and bitrate of the running pipeline, a warm resume has to match those
+  auto live_session = std::make_shared<immer::atom<state::VideoSession>>(video_session);
+
+  GstElement *running_pipeline = nullptr;
+  run_pipeline(pipeline, [&, video_session, event_bus, appsrc_state, congestion_control](auto pipeline, auto loop) {
+    running_pipeline = pipeline.get();
+    spectators::store(video_session, pipeline);
+    track_video_bitrate(pipeline.get(), video_session->bitrate_kbps);
+
     if (auto app_src_el = gst_bin_get_by_name(GST_BIN(pipeline.get()), "wolf_wayland_source")) {
       logs::log(logs::debug, "Setting up wolf_wayland_source");
       g_assert(GST_IS_APP_SRC(app_src_el));
 
       auto app_src_ptr = wolf::core::gstreamer::gst_element_ptr(app_src_el, ::gst_object_unref);
+      // need-data is called from the appsrc streaming thread, the frames have to be pulled from our own main loop
+      appsrc_state->context = g_main_context_ref(g_main_loop_get_context(loop.get()));
 
       auto caps = set_resolution(*appsrc_state->wayland_state, video_session->display_mode, app_src_ptr);
       g_object_set(app_src_ptr.get(), "caps", caps.get(), NULL);
@@ -145,108 +736,261 @@ void start_streaming_video(const immer::box<state::VideoSession> &video_session,
      * We have to pass this back into the gstreamer pipeline
      * in order to force the encoder to produce a new IDR packet
      */
-    auto idr_handler = event_bus->register_handler<immer::box<control::ControlEvent>>(
-        [sess_id = video_session->session_id, pipeline](const immer::box<control::ControlEvent> &ctrl_ev) {
-          if (ctrl_ev->session_id == sess_id) {
-            if (ctrl_ev->type == moonlight::control::pkts::IDR_FRAME) {
-              logs::log(logs::debug, "[GSTREAMER] Forcing IDR");
-              // Force IDR event, see: https://github.com/centricular/gstwebrtc-demos/issues/186
-              // https://gstreamer.freedesktop.org/documentation/additional/design/keyframe-force.html?gi-language=c
-              wolf::core::gstreamer::send_message(
-                  pipeline.get(),
-                  gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
-            }
+    auto idr_handler = event_bus->register_session_handler<immer::box<control::ControlEvent>>(
+        video_session->session_id,
+        [pipeline](const immer::box<control::ControlEvent> &ctrl_ev) {
+          if (ctrl_ev->type == moonlight::control::pkts::IDR_FRAME) {
+            WOLF_LOG(logs::debug, "[GSTREAMER] Forcing IDR");
+            // Force IDR event, see: https://github.com/centricular/gstwebrtc-demos/issues/186
+            // https://gstreamer.freedesktop.org/documentation/additional/design/keyframe-force.html?gi-language=c
+            wolf::core::gstreamer::send_message(
+                pipeline.get(),
+                gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
           }
         });
 
-    auto pause_handler = event_bus->register_handler<immer::box<control::PauseStreamEvent>>(
-        [sess_id = video_session->session_id, loop](const immer::box<control::PauseStreamEvent> &ev) {
-          if (ev->session_id == sess_id) {
-            logs::log(logs::debug, "[GSTREAMER] Pausing pipeline: {}", sess_id);
-
-            /**
-             * Unfortunately here we can't just pause the pipeline,
-             * when a pipeline will be resumed there are a lot of breaking changes
-             * like:
-             *  - Client IP:PORT
-             *  - AES key and IV for encrypted payloads
-             *  - Client resolution, framerate, and encoding
-             *
-             *  The only solution is to kill the pipeline and re-create it again
-             * when a resume happens
-             */
-
+    auto pause_handler = event_bus->register_session_handler<immer::box<control::PauseStreamEvent>>(
+        video_session->session_id,
+        [sess_id = video_session->session_id, live_session, pipeline, loop](
+            const immer::box<control::PauseStreamEvent> &ev) {
+          logs::log(logs::debug, "[GSTREAMER] Pausing pipeline: {}", sess_id);
+
+          /**
+           * On resume the client IP:PORT will change (and the client might ask for a different resolution or
+           * encoding), we keep the pipeline PAUSED so that, when nothing else changed, we can just point the sink to
+           * the new client instead of re-initialising the encoder. See: warm_pause::try_resume()
+           */
+          if (warm_pause::is_enabled() &&
+              gst_element_set_state(pipeline.get(), GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE) {
+            warm_pause::store(warm_pause::paused_video, live_session->load(), pipeline, loop);
+          } else {
             g_main_loop_quit(loop.get());
           }
         });
 
-    auto stop_handler = event_bus->register_handler<immer::box<control::StopStreamEvent>>(
+    auto stop_handler = event_bus->register_session_handler<immer::box<control::StopStreamEvent>>(
+        video_session->session_id,
         [sess_id = video_session->session_id, loop](const immer::box<control::StopStreamEvent> &ev) {
-          if (ev->session_id == sess_id) {
-            logs::log(logs::debug, "[GSTREAMER] Stopping pipeline: {}", sess_id);
-            g_main_loop_quit(loop.get());
+          logs::log(logs::debug, "[GSTREAMER] Stopping pipeline: {}", sess_id);
+          warm_pause::take(warm_pause::paused_video, sess_id);
+          g_main_loop_quit(loop.get());
+        });
+
+    /*
+     * Bitrate can be changed straight away on the encoder, a new resolution has to be set in the capsfilters and
+     * in the virtual display (from the thread that pulls the frames); the encoder will renegotiate on the next frame
+     */
+    auto reconfigure_handler = event_bus->register_session_handler<immer::box<state::VideoReconfigureEvent>>(
+        video_session->session_id,
+        [pipeline, appsrc_state, congestion_control, live_session](const immer::box<state::VideoReconfigureEvent> &ev) {
+          live_session->update([&](const state::VideoSession &session) {
+            auto updated = session;
+            updated.bitrate_kbps = ev->bitrate_kbps.value_or(session.bitrate_kbps);
+            updated.display_mode = ev->display_mode.value_or(session.display_mode);
+            return updated;
+          });
+          if (ev->bitrate_kbps) {
+            set_video_bitrate(pipeline.get(), *ev->bitrate_kbps);
+            if (congestion_control) {
+              congestion_control->set_bitrate(*ev->bitrate_kbps);
+            }
+          }
+          if (ev->display_mode) {
+            auto mode = *ev->display_mode;
+            set_video_resolution(pipeline.get(), mode.width, mode.height, mode.refreshRate);
+            if (appsrc_state->app_src) {
+              std::lock_guard<std::mutex> lock(appsrc_state->pending_mutex);
+              appsrc_state->pending_display_mode = mode;
+            }
           }
         });
 
-    return immer::array<immer::box<dp::handler_registration>>{std::move(idr_handler),
-                                                              std::move(pause_handler),
-                                                              std::move(stop_handler)};
+    auto network_stats_handler = event_bus->register_session_handler<immer::box<control::NetworkStatsEvent>>(
+        video_session->session_id,
+        [pipeline, congestion_control, event_bus](const immer::box<control::NetworkStatsEvent> &ev) {
+          if (!congestion_control) {
+            return;
+          }
+          auto new_bitrate =
+              congestion_control->on_network_stats(ev->lost_packets, ev->interval, ev->rtt, ev->recovery_requests);
+          if (new_bitrate) {
+            set_video_bitrate(pipeline.get(), *new_bitrate);
+            auto stats = congestion_control->get_stats();
+            event_bus->fire_event(immer::box<state::VideoBitrateEvent>(
+                state::VideoBitrateEvent{.session_id = ev->session_id,
+                                         .bitrate_kbps = stats.bitrate_kbps,
+                                         .increases = stats.increases,
+                                         .decreases = stats.decreases,
+                                         .loss_ratio = stats.last_loss_ratio,
+                                         .rtt = stats.last_rtt,
+                                         .recovery_requests = stats.last_recovery_requests}));
+          }
+        });
+
+    return immer::array<immer::box<wolf::core::events::handler_registration>>{std::move(idr_handler),
+                                                                              std::move(pause_handler),
+                                                                              std::move(stop_handler),
+                                                                              std::move(reconfigure_handler),
+                                                                              std::move(network_stats_handler)};
   });
+  spectators::remove(video_session->session_id, running_pipeline);
+}
+
+void attach_spectator(const immer::box<state::VideoSession> &spectator_session,
+                      const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
+                      unsigned short client_port) {
+  auto session_id = spectator_session->session_id;
+  auto host_id = spectator_session->host_session_id.value();
+  auto host = spectators::running_video.load()->find(host_id);
+  if (!host) {
+    logs::log(logs::warning, "[GSTREAMER] Spectator {}: session {} is not streaming", session_id, host_id);
+    return;
+  }
+  if (host->session->gst_pipeline != spectator_session->gst_pipeline) {
+    // We are going to send the host bitstream as is, we can't switch codec
+    logs::log(logs::warning,
+              "[GSTREAMER] Spectator {}: requested a different codec from the one used by session {}",
+              session_id,
+              host_id);
+    return;
+  }
+
+  auto pipeline = host->pipeline;
+  auto tee = gst_bin_get_by_name(GST_BIN(pipeline.get()), state::SPECTATORS_TEE_NAME);
+  if (!tee) {
+    logs::log(logs::warning,
+              "[GSTREAMER] Spectator {}: {} not found, is allow_spectators set?",
+              session_id,
+              state::SPECTATORS_TEE_NAME);
+    return;
+  }
+
+  /*
+   * Each spectator gets its own payloader (packet size and FEC are negotiated by each client) and network sink.
+   * A leaky queue makes sure that a slow spectator will never slow down the host.
+   */
+  auto branch_desc = fmt::format("queue leaky=downstream max-size-buffers=10 max-size-bytes=0 max-size-time=0 ! "
+                                 "rtpmoonlightpay_video payload_size={} fec_percentage={} "
+                                 "min_required_fec_packets={} ! "
+                                 "udpsink bind-port={} host={} port={} sync=true async=false",
+                                 spectator_session->packet_size,
+                                 spectator_session->fec_percentage,
+                                 spectator_session->min_required_fec_packets,
+                                 spectator_session->port,
+                                 spectator_session->client_ip,
+                                 client_port);
+  GError *error = nullptr;
+  auto bin = gst_parse_bin_from_description(branch_desc.c_str(), TRUE, &error);
+  if (!bin) {
+    logs::log(logs::warning, "[GSTREAMER] Spectator {}: {}", session_id, error->message);
+    g_error_free(error);
+    gst_object_unref(tee);
+    return;
+  }
+  gst_object_set_name(GST_OBJECT(bin), fmt::format("spectator_{}", session_id).c_str());
+
+  auto branch = std::make_shared<spectators::SpectatorBranch>();
+  branch->session_id = session_id;
+  branch->pipeline = pipeline;
+  branch->tee = gst_element_ptr(tee, ::gst_object_unref);
+  branch->bin = bin;
+
+  gst_bin_add(GST_BIN(pipeline.get()), bin);
+  gst_element_sync_state_with_parent(bin);
+#if GST_CHECK_VERSION(1, 20, 0)
+  branch->tee_pad = gst_element_request_pad_simple(tee, "src_%u");
+#else
+  branch->tee_pad = gst_element_get_request_pad(tee, "src_%u");
+#endif
+  auto bin_pad = gst_element_get_static_pad(bin, "sink");
+  auto link_result = gst_pad_link(branch->tee_pad, bin_pad);
+  gst_object_unref(bin_pad);
+  if (link_result != GST_PAD_LINK_OK) {
+    logs::log(logs::warning, "[GSTREAMER] Spectator {}: unable to link to session {}", session_id, host_id);
+    spectators::detach(branch);
+    return;
+  }
+  logs::log(logs::info, "[GSTREAMER] Spectator {} attached to session {}", session_id, host_id);
+
+  auto force_idr = [pipeline]() {
+    send_message(pipeline.get(), gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
+  };
+  // The spectator can't decode anything until the next keyframe
+  force_idr();
+
+  std::vector<wolf::core::events::handler_registration> handlers;
+  handlers.push_back(event_bus->register_session_handler<immer::box<control::ControlEvent>>(
+      session_id,
+      [force_idr](const immer::box<control::ControlEvent> &ctrl_ev) {
+        if (ctrl_ev->type == moonlight::control::pkts::IDR_FRAME) {
+          force_idr();
+        }
+      }));
+  // Spectators don't keep a paused pipeline around, on resume they'll simply be attached again
+  handlers.push_back(event_bus->register_session_handler<immer::box<control::PauseStreamEvent>>(
+      session_id,
+      [branch](const immer::box<control::PauseStreamEvent> &ev) { spectators::detach(branch); }));
+  handlers.push_back(event_bus->register_session_handler<immer::box<control::StopStreamEvent>>(
+      session_id,
+      [branch](const immer::box<control::StopStreamEvent> &ev) { spectators::detach(branch); }));
+
+  std::lock_guard<std::mutex> lock(branch->handlers_mutex);
+  if (branch->detached) { // Stopped while we were registering the handlers
+    for (const auto &handler : handlers) {
+      handler.unregister();
+    }
+  } else {
+    branch->handlers = std::move(handlers);
+  }
 }
 
 /**
  * Start AUDIO pipeline
  */
 void start_streaming_audio(const immer::box<state::AudioSession> &audio_session,
-                           const std::shared_ptr<dp::event_bus> &event_bus,
+                           const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
                            unsigned short client_port,
                            const std::string &sink_name,
                            const std::string &server_name) {
-  auto pipeline = fmt::format(audio_session->gst_pipeline,
-                              fmt::arg("channels", audio_session->channels),
-                              fmt::arg("bitrate", audio_session->bitrate),
-                              fmt::arg("sink_name", sink_name),
-                              fmt::arg("server_name", server_name),
-                              fmt::arg("packet_duration", audio_session->packet_duration),
-                              fmt::arg("aes_key", audio_session->aes_key),
-                              fmt::arg("aes_iv", audio_session->aes_iv),
-                              fmt::arg("encrypt", audio_session->encrypt_audio),
-                              fmt::arg("client_port", client_port),
-                              fmt::arg("client_ip", audio_session->client_ip),
-                              fmt::arg("host_port", audio_session->port));
-  logs::log(logs::debug, "Starting audio pipeline: {}", pipeline);
+  if (warm_pause::try_resume(warm_pause::paused_audio, audio_session, client_port, [&](GstElement *pipeline) {
+        warm_pause::update_audio_encryption(pipeline, *audio_session);
+      })) {
+    return;
+  }
 
-  run_pipeline(pipeline, [session_id = audio_session->session_id, event_bus](auto pipeline, auto loop) {
-    auto pause_handler = event_bus->register_handler<immer::box<control::PauseStreamEvent>>(
-        [session_id, loop](const immer::box<control::PauseStreamEvent> &ev) {
-          if (ev->session_id == session_id) {
-            logs::log(logs::debug, "[GSTREAMER] Pausing pipeline: {}", session_id);
-
-            /**
-             * Unfortunately here we can't just pause the pipeline,
-             * when a pipeline will be resumed there are a lot of breaking changes
-             * like:
-             *  - Client IP:PORT
-             *  - AES key and IV for encrypted payloads
-             *  - Client resolution, framerate, and encoding
-             *
-             *  The only solution is to kill the pipeline and re-create it again
-             * when a resume happens
-             */
+  auto pipeline = audio_pipeline_description(*audio_session, client_port, sink_name, server_name);
+  logs::log(logs::debug, "Starting audio pipeline: {}", pipeline);
 
+  run_pipeline(pipeline, [audio_session, event_bus](auto pipeline, auto loop) {
+    auto session_id = audio_session->session_id;
+    auto pause_handler = event_bus->register_session_handler<immer::box<control::PauseStreamEvent>>(
+        session_id,
+        [session_id, audio_session, pipeline, loop](const immer::box<control::PauseStreamEvent> &ev) {
+          logs::log(logs::debug, "[GSTREAMER] Pausing pipeline: {}", session_id);
+
+          /**
+           * On resume the client IP:PORT and the AES key and IV will change (and the client might ask for a
+           * different audio configuration), we keep the pipeline PAUSED so that, when nothing else changed, we can
+           * just update those instead of re-creating the pipeline. See: warm_pause::try_resume()
+           */
+          if (warm_pause::is_enabled() &&
+              gst_element_set_state(pipeline.get(), GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE) {
+            warm_pause::store(warm_pause::paused_audio, audio_session, pipeline, loop);
+          } else {
             g_main_loop_quit(loop.get());
           }
         });
 
-    auto stop_handler = event_bus->register_handler<immer::box<control::StopStreamEvent>>(
+    auto stop_handler = event_bus->register_session_handler<immer::box<control::StopStreamEvent>>(
+        session_id,
         [session_id, loop](const immer::box<control::StopStreamEvent> &ev) {
-          if (ev->session_id == session_id) {
-            logs::log(logs::debug, "[GSTREAMER] Stopping pipeline: {}", session_id);
-            g_main_loop_quit(loop.get());
-          }
+          logs::log(logs::debug, "[GSTREAMER] Stopping pipeline: {}", session_id);
+          warm_pause::take(warm_pause::paused_audio, session_id);
+          g_main_loop_quit(loop.get());
         });
 
-    return immer::array<immer::box<dp::handler_registration>>{std::move(pause_handler), std::move(stop_handler)};
+    return immer::array<immer::box<wolf::core::events::handler_registration>>{std::move(pause_handler),
+                                                                              std::move(stop_handler)};
   });
 }
 
@@ -2,6 +2,7 @@
 #include "moonlight/fec.hpp"
 #include <boost/asio.hpp>
 #include <core/virtual-display.hpp>
+#include <cstdlib>
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <gst-plugin/gstrtpmoonlightpay_audio.hpp>
@@ -9,17 +10,52 @@
 #include <gst/gst.h>
 #include <immer/box.hpp>
 #include <memory>
+#include <string>
 #include <streaming/data-structures.hpp>
 
 namespace streaming {
 
+/**
+ * @return the video pipeline for the given session, with all the template variables substituted
+ */
+std::string video_pipeline_description(const state::VideoSession &session, unsigned short client_port);
+
+/**
+ * @return the audio pipeline for the given session, with all the template variables substituted
+ */
+std::string audio_pipeline_description(const state::AudioSession &session,
+                                       unsigned short client_port,
+                                       const std::string &sink_name,
+                                       const std::string &server_name);
+
+/**
+ * Checks the pipeline template of an app once at startup, so that errors are reported straight away instead of when
+ * a client tries to start a session; this will also load all the GStreamer plugins needed by the pipeline.
+ *
+ * @return false if the pipeline is not valid, the error will be logged
+ */
+bool preload_video_pipeline(const std::string &app_title,
+                            const std::string &gst_pipeline,
+                            const std::string &render_node);
+
+bool preload_audio_pipeline(const std::string &app_title, const std::string &gst_pipeline);
+
 void start_streaming_video(const immer::box<state::VideoSession> &video_session,
-                           const std::shared_ptr<dp::event_bus> &event_bus,
+                           const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
                            wolf::core::virtual_display::wl_state_ptr wl_state,
                            unsigned short client_port);
 
+/**
+ * Attaches a spectator to the running video pipeline of the session in `host_session_id`.
+ * The encoded bitstream is shared, the spectator will only get its own payloader and network sink.
+ * Doesn't block: the branch will be removed from the host pipeline when the spectator pauses or stops.
+ */
+void attach_spectator(const immer::box<state::VideoSession> &spectator_session,
+                      const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
+                      unsigned short client_port);
+
 void start_streaming_audio(const immer::box<state::AudioSession> &audio_session,
-                           const std::shared_ptr<dp::event_bus> &event_bus,
+                           const std::shared_ptr<wolf::core::events::EventBus> &event_bus,
                            unsigned short client_port,
                            const std::string &sink_name,
                            const std::string &server_name);
@@ -41,6 +77,8 @@ inline void init() {
   /* It is also possible to call the init function with two NULL arguments,
    * in which case no command line options will be parsed by GStreamer.
    */
+  // The CUDA device ids that we hand out to nvcodec follow the PCI bus order, see: video_pipeline_description()
+  setenv("CUDA_DEVICE_ORDER", "PCI_BUS_ID", 0);
   gst_init(nullptr, nullptr);
   logs::log(logs::info, "Gstreamer version: {}", get_gst_version());
 
@@ -1,20 +1,28 @@
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <chrono>
 #include <control/control.hpp>
+#include <control/input_handler.hpp>
 #include <core/docker.hpp>
 #include <csignal>
 #include <exceptions/exceptions.h>
 #include <filesystem>
+#include <functional>
 #include <immer/array.hpp>
 #include <immer/array_transient.hpp>
 #include <immer/map_transient.hpp>
 #include <immer/vector_transient.hpp>
 #include <memory>
+#include <mutex>
 #include <platforms/hw.hpp>
 #include <rest/rest.hpp>
+#include <rtp/udp-ping.hpp>
 #include <rtsp/net.hpp>
+#include <set>
 #include <state/config.hpp>
+#include <state/gpu-scheduler.hpp>
 #include <streaming/streaming.hpp>
+#include <thread>
 #include <vector>
 
 namespace ba = boost::asio;
@@ -30,7 +38,7 @@ static constexpr int DEFAULT_SESSION_TIMEOUT_MILLIS = 4000;
 /**
  * @brief Will try to load the config file and fallback to defaults
  */
-auto load_config(std::string_view config_file, const std::shared_ptr<dp::event_bus> &ev_bus) {
+auto load_config(std::string_view config_file, const std::shared_ptr<events::EventBus> &ev_bus) {
   logs::log(logs::info, "Reading config file from: {}", config_file);
   return state::load_or_default(config_file.data(), ev_bus);
 }
@@ -80,9 +88,51 @@ state::Host get_host_config(std::string_view pkey_filename, std::string_view cer
  * @brief Local state initialization
  */
 auto initialize(std::string_view config_file, std::string_view pkey_filename, std::string_view cert_filename) {
-  auto event_bus = std::make_shared<dp::event_bus>();
-  auto config = load_config(config_file, event_bus);
+  auto event_bus = std::make_shared<events::EventBus>();
+  // Probe the GPUs once now, sessions will just look them up
+  logs::log(logs::info, "Found {} GPUs", get_hardware_inventory()->size());
+  watch_hardware_changes();
   auto display_modes = getDisplayModes();
+  if (std::string(utils::get_env("WOLF_ENCODERS_BENCHMARK", "FALSE")) == "TRUE") {
+    // Has to run before loading the config so that the new encoders ranking will be picked up
+    state::benchmark_encoders(config_file.data(), display_modes);
+  }
+  auto config = load_config(config_file, event_bus);
+  auto executor = std::make_shared<Executor>(std::stoi(utils::get_env("WOLF_EXECUTOR_THREADS", "4")));
+
+  /*
+   * Report broken pipelines and make sure that the first session doesn't have to load the plugins.
+   * Creating the encoders is slow, apps usually share the same pipelines: each one is preloaded only once and
+   * on a dedicated background thread, startup and the shared executor (sessions setup, PING timeouts) don't wait for
+   * them.
+   */
+  std::set<std::pair<std::string /* pipeline */, std::string /* render_node */>> video_pipelines;
+  std::set<std::string> audio_pipelines;
+  std::vector<std::function<void()>> preloads;
+  for (const auto &app : config.apps) {
+    for (const auto &video_pipeline : {app.h264_gst_pipeline, app.hevc_gst_pipeline, app.av1_gst_pipeline}) {
+      if (!video_pipeline.empty() && video_pipelines.emplace(video_pipeline, app.render_node).second) {
+        preloads.emplace_back([title = app.base.title, video_pipeline, render_node = app.render_node]() {
+          streaming::preload_video_pipeline(title, video_pipeline, render_node);
+        });
+      }
+    }
+    if (audio_pipelines.insert(app.opus_gst_pipeline).second) {
+      preloads.emplace_back([title = app.base.title, audio_pipeline = app.opus_gst_pipeline]() {
+        streaming::preload_audio_pipeline(title, audio_pipeline);
+      });
+    }
+  }
+  std::thread([preloads = std::move(preloads)]() {
+    for (const auto &preload : preloads) {
+      preload();
+    }
+  }).detach();
+
+  if (std::any_of(config.apps.begin(), config.apps.end(), [](const auto &app) { return app.schedule_render_node; })) {
+    // Launching a session will just look up the last sample
+    state::watch_gpu_utilization(executor);
+  }
 
   auto host = get_host_config(pkey_filename, cert_filename);
   auto state = state::AppState{
@@ -90,7 +140,9 @@ auto initialize(std::string_view config_file, std::string_view pkey_filename, st
       .host = host,
       .pairing_cache = std::make_shared<immer::atom<immer::map<std::string, state::PairCache>>>(),
       .event_bus = event_bus,
-      .running_sessions = std::make_shared<immer::atom<immer::vector<state::StreamSession>>>()};
+      .running_sessions = std::make_shared<immer::atom<immer::vector<state::StreamSession>>>(),
+      .port_leases = std::make_shared<immer::atom<immer::map<std::size_t, unsigned short>>>(),
+      .executor = executor};
   return immer::box<state::AppState>(state);
 }
 
@@ -147,9 +199,105 @@ std::optional<AudioServer> setup_audio_server(const std::string &runtime_dir) {
 
 using session_devices = immer::map<std::size_t /* session_id */, std::shared_ptr<state::devices_atom_queue>>;
 
+/**
+ * Asynchronously waits for the first RTP PING coming from the session client on the session port, on_ping will then be
+ * called with the client port. The wait is abandoned if no PING arrives within DEFAULT_SESSION_TIMEOUT_MILLIS or if a
+ * new session with the same session_id has been queued in the meantime.
+ *
+ * Nothing here blocks: the timeout is a timer on the shared executor.
+ * This has to be called outside of an event bus handler since it'll register new handlers.
+ */
+template <typename PingEvent, typename SessionType>
+void wait_for_first_ping(const immer::box<state::AppState> &app_state,
+                         const std::shared_ptr<rtp::PingListener> &ping_listener,
+                         const immer::box<SessionType> &sess,
+                         const std::string &session_type,
+                         const std::function<void(unsigned short /* client_port */)> &on_ping) {
+  struct ping_wait {
+    std::atomic<bool> done = false;
+    std::mutex handlers_m;
+    std::vector<events::handler_registration> handlers;
+    std::shared_ptr<boost::asio::steady_timer> timeout;
+    std::function<void()> forget_ping;
+
+    /* Returns true only for the first caller */
+    bool finish() {
+      return !done.exchange(true);
+    }
+
+    void cleanup() {
+      std::lock_guard<std::mutex> lock(handlers_m);
+      for (const auto &handler : handlers) {
+        handler.unregister();
+      }
+      handlers.clear();
+      if (timeout) {
+        timeout->cancel();
+        timeout.reset();
+      }
+      if (forget_ping) {
+        forget_ping();
+        forget_ping = nullptr;
+      }
+    }
+  };
+
+  auto wait = std::make_shared<ping_wait>();
+  auto executor = app_state->executor;
+  // Handlers can't be unregistered from inside the event bus dispatch, we defer it to the executor
+  auto complete = [wait, executor]() { executor->post([wait]() { wait->cleanup(); }); };
+
+  auto ping_handler = app_state->event_bus->register_handler<immer::box<PingEvent>>(
+      [wait, sess, on_ping, complete](const immer::box<PingEvent> &ping_ev) {
+        // We'll keep receiving PING requests, but we only want the first one
+        // Multiple sessions can come from the same IP (NAT, spectators), the host port tells them apart
+        if (ping_ev->client_ip == sess->client_ip && ping_ev->host_port == sess->port && wait->finish()) {
+          complete();
+          on_ping(ping_ev->client_port);
+        }
+      });
+
+  auto cancel_handler = app_state->event_bus->register_session_handler<immer::box<SessionType>>(
+      sess->session_id,
+      [wait, complete](const immer::box<SessionType> &new_sess) {
+        // A new session has been queued whilst we still haven't received a PING
+        if (wait->finish()) {
+          complete();
+        }
+      });
+
+  auto timeout = executor->run_after(
+      std::chrono::milliseconds(DEFAULT_SESSION_TIMEOUT_MILLIS),
+      [wait, complete, session_type, session_id = sess->session_id](const boost::system::error_code &ec) {
+        if (!ec && wait->finish()) {
+          logs::log(logs::warning, "{} session {} timed out waiting for PING", session_type, session_id);
+          complete();
+        }
+      });
+
+  {
+    std::lock_guard<std::mutex> lock(wait->handlers_m);
+    wait->handlers = {events::handler_registration(std::move(ping_handler)), std::move(cancel_handler)};
+    wait->timeout = std::move(timeout);
+
+    // Only now that the handlers are in place we can start listening for the PING
+    auto expect_id = ping_listener->expect(sess->port, sess->client_ip);
+    wait->forget_ping = [ping_listener, port = sess->port, client_ip = sess->client_ip, expect_id]() {
+      ping_listener->forget(port, client_ip, expect_id);
+    };
+  }
+
+  // The wait might have already been completed before the handlers were stored
+  if (wait->done) {
+    complete();
+  }
+}
+
 auto setup_sessions_handlers(const immer::box<state::AppState> &app_state,
                              const std::string &runtime_dir,
-                             const std::optional<AudioServer> &audio_server) {
+                             const std::optional<AudioServer> &audio_server,
+                             const std::shared_ptr<rtp::PingListener> &video_ping,
+                             const std::shared_ptr<rtp::PingListener> &audio_ping) {
   immer::vector_transient<immer::box<dp::handler_registration>> handlers;
 
   auto wayland_sessions = std::make_shared<
@@ -167,6 +315,15 @@ auto setup_sessions_handlers(const immer::box<state::AppState> &app_state,
         app_state->running_sessions->update([&ev](const immer::vector<state::StreamSession> &ses_v) {
           return remove_session(ses_v, {.session_id = ev->session_id});
         });
+        // The session ports can now be used by someone else
+        release_ports(app_state->port_leases, ev->session_id);
+
+        // Spectators can't outlive the session they are watching
+        for (const auto &spectator : get_spectators(app_state->running_sessions->load(), ev->session_id)) {
+          app_state->executor->post([&app_state, spectator_id = spectator.session_id]() {
+            app_state->event_bus->fire_event(immer::box<StopStreamEvent>(StopStreamEvent{.session_id = spectator_id}));
+          });
+        }
 
         // On termination cleanup the WaylandSession; since this is the only reference to it
         // this will effectively destroy the virtual Wayland session
@@ -186,6 +343,16 @@ auto setup_sessions_handlers(const immer::box<state::AppState> &app_state,
         }
       }));
 
+  handlers.push_back(app_state->event_bus->register_handler<immer::box<state::SpectatorInputEvent>>(
+      [&app_state](const immer::box<state::SpectatorInputEvent> &ev) {
+        if (auto session = get_session_by_id(app_state->running_sessions->load(), ev->session_id)) {
+          logs::log(logs::info, "Session {} input {}", ev->session_id, ev->allowed ? "granted" : "revoked");
+          session->input_allowed->store(ev->allowed);
+        } else {
+          logs::log(logs::warning, "Unable to find session {}", ev->session_id);
+        }
+      }));
+
   // Run process and our custom wayland as soon as a new StreamSession is created
   handlers.push_back(app_state->event_bus->register_handler<immer::box<state::StreamSession>>(
       [=](const immer::box<state::StreamSession> &session) {
@@ -337,100 +504,47 @@ auto setup_sessions_handlers(const immer::box<state::AppState> &app_state,
   // Video streaming pipeline
   handlers.push_back(app_state->event_bus->register_handler<immer::box<state::VideoSession>>(
       [=](const immer::box<state::VideoSession> &sess) {
-        std::thread([=]() {
-          boost::promise<unsigned short> port_promise;
-          auto port_fut = port_promise.get_future();
-          std::once_flag called;
-          auto ev_handler = app_state->event_bus->register_handler<immer::box<state::RTPVideoPingEvent>>(
-              [pp = std::ref(port_promise), &called, sess](const immer::box<state::RTPVideoPingEvent> &ping_ev) {
-                std::call_once(called, [=]() { // We'll keep receiving PING requests, but we only want the first one
-                  if (ping_ev->client_ip == sess->client_ip) {
-                    pp.get().set_value(ping_ev->client_port); // This throws when set multiple times
-                  }
-                });
-              });
-
-          std::shared_ptr<std::atomic_bool> cancel_job = std::make_shared<std::atomic<bool>>(false);
-          auto cancel_event = app_state->event_bus->register_handler<immer::box<state::VideoSession>>(
-              [=](const immer::box<state::VideoSession> &new_sess) {
-                if (new_sess->session_id == sess->session_id) {
-                  // A new VideoSession has been queued whilst we still haven't received a PING
-                  *cancel_job = true;
-                }
-              });
-
+        app_state->executor->post([=]() {
           logs::log(logs::debug, "Video session {}, waiting for PING...", sess->session_id);
 
-          // Stop here until we get a PING
-          auto status = port_fut.wait_for(boost::chrono::milliseconds(DEFAULT_SESSION_TIMEOUT_MILLIS));
-          if (status != boost::future_status::ready) {
-            logs::log(logs::warning, "Video session {} timed out waiting for PING", sess->session_id);
-            return;
-          }
-          auto client_port = port_fut.get();
-          cancel_event.unregister();
-          ev_handler.unregister();
-
-          if (*cancel_job) {
-            return;
-          }
-
-          virtual_display::wl_state_ptr wl_state;
-          if (auto wayland_promise = wayland_sessions->load()->find(sess->session_id)) {
-            wl_state = wayland_promise->get(); // Stops here until the wayland socket is ready
-          }
-          streaming::start_streaming_video(sess, app_state->event_bus, std::move(wl_state), client_port);
-        }).detach();
+          auto on_ping = [=](unsigned short client_port) {
+            if (sess->host_session_id) {
+              // Spectators are just a new branch on the host pipeline, this doesn't block
+              streaming::attach_spectator(sess, app_state->event_bus, client_port);
+              return;
+            }
+            // The pipeline will run until the session is paused or stopped, it needs its own thread
+            std::thread([=]() {
+              virtual_display::wl_state_ptr wl_state;
+              if (auto wayland_promise = wayland_sessions->load()->find(sess->session_id)) {
+                wl_state = wayland_promise->get(); // Stops here until the wayland socket is ready
+              }
+              streaming::start_streaming_video(sess, app_state->event_bus, std::move(wl_state), client_port);
+            }).detach();
+          };
+          wait_for_first_ping<state::RTPVideoPingEvent>(app_state, video_ping, sess, "Video", on_ping);
+        });
       }));
 
   // Audio streaming pipeline
   handlers.push_back(app_state->event_bus->register_handler<immer::box<state::AudioSession>>(
       [=](const immer::box<state::AudioSession> &sess) {
-        std::thread([=]() {
-          boost::promise<unsigned short> port_promise;
-          auto port_fut = port_promise.get_future();
-          std::once_flag called;
-          auto ev_handler = app_state->event_bus->register_handler<immer::box<state::RTPAudioPingEvent>>(
-              [pp = std::ref(port_promise), &called, sess](const immer::box<state::RTPAudioPingEvent> &ping_ev) {
-                std::call_once(called, [=]() { // We'll keep receiving PING requests, but we only want the first one
-                  if (ping_ev->client_ip == sess->client_ip) {
-                    pp.get().set_value(ping_ev->client_port); // This throws when set multiple times
-                  }
-                });
-              });
-
-          std::shared_ptr<std::atomic_bool> cancel_job = std::make_shared<std::atomic<bool>>(false);
-          auto cancel_event = app_state->event_bus->register_handler<immer::box<state::AudioSession>>(
-              [=](const immer::box<state::AudioSession> &new_sess) {
-                if (new_sess->session_id == sess->session_id) {
-                  // A new AudioSession has been queued whilst we still haven't received a PING
-                  *cancel_job = true;
-                }
-              });
-
+        app_state->executor->post([=]() {
           logs::log(logs::debug, "Audio session {}, waiting for PING...", sess->session_id);
 
-          // Stop here until we get a PING
-          auto status = port_fut.wait_for(boost::chrono::milliseconds(DEFAULT_SESSION_TIMEOUT_MILLIS));
-          if (status != boost::future_status::ready) {
-            logs::log(logs::warning, "Audio session {} timed out waiting for PING", sess->session_id);
-            return;
-          }
-          auto client_port = port_fut.get();
-          cancel_event.unregister();
-          ev_handler.unregister();
-
-          if (*cancel_job) {
-            return;
-          }
-
-          auto audio_server_name = audio_server ? audio::get_server_name(audio_server->server)
-                                                : std::optional<std::string>();
-          auto sink_name = fmt::format("virtual_sink_{}.monitor", sess->session_id);
-          auto server_name = audio_server_name ? audio_server_name.value() : "";
-
-          streaming::start_streaming_audio(sess, app_state->event_bus, client_port, sink_name, server_name);
-        }).detach();
+          auto on_ping = [=](unsigned short client_port) {
+            auto audio_server_name = audio_server ? audio::get_server_name(audio_server->server)
+                                                  : std::optional<std::string>();
+            auto sink_name = fmt::format("virtual_sink_{}.monitor", sess->host_session_id.value_or(sess->session_id));
+            auto server_name = audio_server_name ? audio_server_name.value() : "";
+
+            // The pipeline will run until the session is paused or stopped, it needs its own thread
+            std::thread([=]() {
+              streaming::start_streaming_audio(sess, app_state->event_bus, client_port, sink_name, server_name);
+            }).detach();
+          };
+          wait_for_first_ping<state::RTPAudioPingEvent>(app_state, audio_ping, sess, "Audio", on_ping);
+        });
       }));
 
   return handlers.persistent();
@@ -443,6 +557,7 @@ void run() {
   streaming::init(); // Need to initialise gstreamer once
   control::init();   // Need to initialise enet once
   docker::init();    // Need to initialise libcurl once
+  control::init_joypads_pool();
 
   auto runtime_dir = utils::get_env("XDG_RUNTIME_DIR", "/tmp/sockets");
   logs::log(logs::debug, "XDG_RUNTIME_DIR={}", runtime_dir);
@@ -474,8 +589,31 @@ void run() {
     control::run_control(state::CONTROL_PORT, sessions, ev_bus);
   }).detach();
 
+  // RTP PING, a single listener for all the sessions
+  auto video_ping = std::make_shared<rtp::PingListener>(
+      local_state->executor->io_context(),
+      state::VIDEO_PING_PORT,
+      state::MAX_PING_PORTS,
+      [ev_bus = local_state->event_bus](unsigned short host_port, unsigned short client_port, const std::string &ip) {
+        WOLF_LOG(logs::trace, "[PING] video from {}:{}", ip, client_port);
+        auto ev = state::RTPVideoPingEvent{.client_ip = ip, .client_port = client_port, .host_port = host_port};
+        ev_bus->fire_event(immer::box<state::RTPVideoPingEvent>(ev));
+      });
+  video_ping->start();
+
+  auto audio_ping = std::make_shared<rtp::PingListener>(
+      local_state->executor->io_context(),
+      state::AUDIO_PING_PORT,
+      state::MAX_PING_PORTS,
+      [ev_bus = local_state->event_bus](unsigned short host_port, unsigned short client_port, const std::string &ip) {
+        WOLF_LOG(logs::trace, "[PING] audio from {}:{}", ip, client_port);
+        auto ev = state::RTPAudioPingEvent{.client_ip = ip, .client_port = client_port, .host_port = host_port};
+        ev_bus->fire_event(immer::box<state::RTPAudioPingEvent>(ev));
+      });
+  audio_ping->start();
+
   auto audio_server = setup_audio_server(runtime_dir);
-  auto sess_handlers = setup_sessions_handlers(local_state, runtime_dir, audio_server);
+  auto sess_handlers = setup_sessions_handlers(local_state, runtime_dir, audio_server, video_ping, audio_ping);
 
   http_thread.join(); // Let's park the main thread over here
 
@@ -485,8 +623,10 @@ void run() {
 }
 
 int main(int argc, char *argv[]) try {
-  logs::init(logs::parse_level(utils::get_env("WOLF_LOG_LEVEL", "INFO")));
+  logs::init(logs::parse_level(utils::get_env("WOLF_LOG_LEVEL", "INFO")),
+             std::string(utils::get_env("WOLF_LOG_ASYNC", "FALSE")) == "TRUE");
   // Exception and termination handling
+  handle_shutdown_signals();
   std::signal(SIGINT, shutdown_handler);
   std::signal(SIGTERM, shutdown_handler);
   std::signal(SIGQUIT, shutdown_handler);
@@ -496,6 +636,7 @@ int main(int argc, char *argv[]) try {
   check_exceptions();
 
   run(); // Main loop
+  logs::flush();
 } catch (...) {
   on_terminate();
 }
\ No newline at end of file
@@ -9,6 +9,8 @@ using Catch::Matchers::Equals;
 
 #include <core/docker.hpp>
 #include <runners/docker.hpp>
+#include <thread>
+#include <vector>
 
 TEST_CASE("Docker API", "DOCKER") {
   docker::init();
@@ -53,11 +55,60 @@ TEST_CASE("Docker API", "DOCKER") {
   REQUIRE(docker_api.remove_by_id(second_container->id));
 }
 
+TEST_CASE("Docker API wait for container exit", "DOCKER") {
+  docker::init();
+  docker::DockerAPI docker_api;
+
+  auto container = docker_api.create(docker::Container{.id = "",
+                                                       .name = "WolfTestWaitHelloWorld",
+                                                       .image = "hello-world",
+                                                       .status = docker::CREATED,
+                                                       .ports = {},
+                                                       .mounts = {},
+                                                       .devices = {},
+                                                       .env = {}});
+  REQUIRE(container.has_value());
+  REQUIRE(docker_api.start_by_id(container->id));
+
+  // hello-world will exit straight away
+  auto exit_code = docker_api.wait_by_id(container->id);
+  REQUIRE(exit_code.has_value());
+  REQUIRE(*exit_code == 0);
+  REQUIRE(docker_api.get_by_id(container->id)->status == docker::EXITED);
+
+  REQUIRE(docker_api.remove_by_id(container->id));
+  REQUIRE(!docker_api.wait_by_id(container->id).has_value());
+}
+
+TEST_CASE("Docker API concurrent requests", "DOCKER") {
+  docker::init();
+  docker::DockerAPI docker_api;
+  auto expected = docker_api.get_containers(true).size();
+
+  // Copies share the same connections
+  std::vector<std::thread> threads;
+  std::vector<std::size_t> results(8);
+  for (std::size_t i = 0; i < results.size(); i++) {
+    threads.emplace_back([docker_api, &results, i]() {
+      for (int request = 0; request < 5; request++) {
+        results[i] = docker_api.get_containers(true).size();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto result : results) {
+    REQUIRE(result == expected);
+  }
+}
+
 TEST_CASE("Docker TOML", "DOCKER") {
   docker::init();
   docker::DockerAPI docker_api;
 
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   std::string toml_cfg = R"(
 
     type = "docker"
@@ -100,4 +151,162 @@ TEST_CASE("Docker TOML", "DOCKER") {
   REQUIRE_THAT(toml::get<std::vector<std::string>>(container.at("env")),
                Equals(std::vector<std::string>{"LOG_LEVEL=info"}));
   REQUIRE_THAT(container.at("base_create_json").as_string(), Equals("{'HostConfig': {}}"));
-}
\ No newline at end of file
+  REQUIRE(container.at("warm_containers").as_integer() == 0);
+}
+
+TEST_CASE("Warm containers shape", "DOCKER") {
+  docker::Container session_a = {.id = "",
+                                 .name = "WolfTest_1",
+                                 .image = "hello-world",
+                                 .status = docker::CREATED,
+                                 .ports = {},
+                                 .mounts = {docker::MountPoint{.source = "/etc/wolf/client_a/Test",
+                                                               .destination = "/home/retro",
+                                                               .mode = "rw"},
+                                            docker::MountPoint{.source = "nvidia-driver-vol",
+                                                               .destination = "/usr/nvidia",
+                                                               .mode = "rw"}},
+                                 .devices = {docker::Device{.path_on_host = "/dev/dri/renderD128",
+                                                            .path_in_container = "/dev/dri/renderD128",
+                                                            .cgroup_permission = "mrw"}},
+                                 .env = {"GAMESCOPE_WIDTH=1920"}};
+  auto shape = docker::ContainerPool::shape_of(session_a, "{}");
+
+  // Host paths are replaced by placeholders, they can change
+  auto session_b = session_a;
+  session_b.name = "WolfTest_2";
+  session_b.mounts[0].source = "/etc/wolf/client_b/Test";
+  session_b.devices[0].path_on_host = "/dev/dri/renderD129";
+  REQUIRE(docker::ContainerPool::shape_of(session_b, "{}") == shape);
+
+  // Everything else can't be changed after the container has been created
+  auto different_env = session_a;
+  different_env.env = {"GAMESCOPE_WIDTH=1280"};
+  REQUIRE(docker::ContainerPool::shape_of(different_env, "{}") != shape);
+
+  auto different_volume = session_a;
+  different_volume.mounts[1].source = "another-volume";
+  REQUIRE(docker::ContainerPool::shape_of(different_volume, "{}") != shape);
+
+  auto different_device = session_a;
+  different_device.devices[0].path_in_container = "/dev/dri/renderD129";
+  REQUIRE(docker::ContainerPool::shape_of(different_device, "{}") != shape);
+
+  REQUIRE(docker::ContainerPool::shape_of(session_a, R"({"HostConfig": {}})") != shape);
+}
+
+TEST_CASE("Warm containers shape across sessions", "DOCKER") {
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
+  std::string toml_cfg = R"(
+    type = "docker"
+    name = "WolfTest"
+    image = "hello-world"
+    warm_containers = 1
+    )";
+  std::istringstream is(toml_cfg, std::ios_base::binary | std::ios_base::in);
+  auto runner = docker::RunDocker::from_toml(event_bus, toml::parse(is, "std::string"));
+
+  // Same as what wolf.cpp passes to run() for an app that starts the virtual compositor
+  auto make_session = [&runner](std::size_t session_id, const std::string &wayland_display) {
+    auto app_state_folder = fmt::format("/tmp/wolf-test/client_{}/Test", session_id);
+    auto wayland_socket = fmt::format("/tmp/sockets/{}", wayland_display);
+    auto sink_name = fmt::format("virtual_sink_{}", session_id);
+    return runner.make_container(session_id,
+                                 app_state_folder,
+                                 immer::array<std::string>{"/dev/dri/renderD128"},
+                                 immer::array<std::pair<std::string, std::string>>{
+                                     {"/tmp/sockets/pulse-socket", "/tmp/sockets/pulse-socket"},
+                                     {wayland_socket, wayland_socket},
+                                     {app_state_folder, "/home/retro"}},
+                                 immer::map<std::string, std::string>{}
+                                     .set("XDG_RUNTIME_DIR", "/tmp/sockets")
+                                     .set("PULSE_SINK", sink_name)
+                                     .set("PULSE_SOURCE", sink_name + ".monitor")
+                                     .set("PULSE_SERVER", "/tmp/sockets/pulse-socket")
+                                     .set("WAYLAND_DISPLAY", wayland_display)
+                                     .set("GAMESCOPE_WIDTH", "1920"),
+                                 "/dev/dri/renderD128");
+  };
+
+  auto [session_1, params_1] = make_session(1, "wayland-1");
+  auto [session_2, params_2] = make_session(2, "wayland-2");
+  REQUIRE(session_1.name != session_2.name);
+  REQUIRE(docker::ContainerPool::shape_of(session_1, params_1) ==
+          docker::ContainerPool::shape_of(session_2, params_2));
+
+  // What changes on every session is picked up from the placeholders
+  REQUIRE_THAT(session_1.env, Contains("WAYLAND_DISPLAY=wayland-wolf"));
+  REQUIRE_THAT(session_1.env, Contains("PULSE_CLIENTCONFIG=/run/wolf/pulse-client.conf"));
+  REQUIRE(std::none_of(session_1.env.begin(), session_1.env.end(), [](const std::string &env) {
+    return env.rfind("PULSE_SINK=", 0) == 0;
+  }));
+}
+
+#if __has_include(<fake-udev/fake-udev.hpp>)
+#include <fake-udev/fake-udev.hpp>
+
+TEST_CASE("fake-udev daemon", "DOCKER") {
+  auto socket_path = std::filesystem::temp_directory_path() / "wolf-fake-udev-test.sock";
+  int server = listen_daemon(socket_path.string());
+  REQUIRE(server >= 0);
+  struct stat socket_stat = {};
+  REQUIRE(stat(socket_path.c_str(), &socket_stat) == 0);
+  REQUIRE((socket_stat.st_mode & 0777) == 0600);
+
+  // Instead of the udev multicast group, events will be sent straight to this socket
+  int listener = socket(AF_NETLINK, SOCK_RAW, NETLINK_USERSOCK);
+  sockaddr_nl listener_addr = {.nl_family = AF_NETLINK};
+  socklen_t addr_len = sizeof(listener_addr);
+  REQUIRE(bind(listener, (sockaddr *)&listener_addr, sizeof(listener_addr)) == 0);
+  REQUIRE(getsockname(listener, (sockaddr *)&listener_addr, &addr_len) == 0);
+  timeval tv = {.tv_sec = 1};
+  setsockopt(listener, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  netlink_connection conn{};
+  REQUIRE(connect(conn, AF_NETLINK, SOCK_RAW, NETLINK_USERSOCK, 0));
+  conn.sa.nl_pid = listener_addr.nl_pid;
+
+  auto daemon = std::thread([&]() { run_daemon(conn, server, "", std::chrono::milliseconds(100)); });
+
+  std::map<std::string, std::string> event = {{"ACTION", "add"},
+                                              {"DEVPATH", "/devices/virtual/input/input1"},
+                                              {"SUBSYSTEM", "input"}};
+  REQUIRE(docker::send_fake_udev_batch(socket_path, {event}));
+  char datagram[1024] = {};
+  auto received = recv(listener, datagram, sizeof(datagram), 0);
+  REQUIRE(received == sizeof(monitor_netlink_header) + utils::map_to_string(event).size());
+  REQUIRE_THAT(std::string(datagram), Equals("libudev"));
+
+  // Only the device nodes that Wolf creates can be touched
+  auto victim = std::filesystem::temp_directory_path() / "wolf-fake-udev-victim";
+  std::ofstream(victim) << "test";
+  REQUIRE(!docker::send_fake_udev_batch(socket_path, {{{"ACTION", "remove"}, {"DEVNAME", victim.string()}}}));
+  REQUIRE(std::filesystem::exists(victim));
+  REQUIRE(!docker::send_fake_udev_batch(
+      socket_path,
+      {{{"ACTION", "add"}, {"DEVNAME", "/dev/input/../wolf-test"}, {"MAJOR", "13"}, {"MINOR", "1"}}}));
+  REQUIRE(!docker::send_fake_udev_batch(
+      socket_path,
+      {{{"ACTION", "add"}, {"DEVNAME", "/dev/input/wolf-test"}, {"MAJOR", "1"}, {"MINOR", "3"}}}));
+
+  // Invalid batches are rejected without bringing down the daemon
+  REQUIRE(!docker::send_fake_udev_batch(
+      socket_path,
+      {{{"ACTION", "add"}, {"DEVNAME", "/dev/input/wolf-test"}, {"MAJOR", "abc"}, {"MINOR", "1"}}}));
+
+  // A client that never completes its batch doesn't block the others
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  int stalled = socket(AF_UNIX, SOCK_STREAM, 0);
+  REQUIRE(connect(stalled, (sockaddr *)&addr, sizeof(addr)) == 0);
+  REQUIRE(docker::send_fake_udev_batch(socket_path, {event}));
+  close(stalled);
+
+  shutdown(server, SHUT_RDWR);
+  daemon.join();
+  close(server);
+  close(listener);
+  cleanup(conn);
+  std::filesystem::remove(socket_path);
+  std::filesystem::remove(victim);
+}
+#endif
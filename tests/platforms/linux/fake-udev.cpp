@@ -27,4 +27,51 @@ TEST_CASE("Helper methods", "[fake-udev]") {
              "SUBSYSTEM=input\0"
              "TAGS=:seat:uaccess:\0"
              "USEC_INITIALIZED=1695908821\0"s));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Device nodes", "[fake-udev]") {
+  auto properties = parse_udev_properties("ACTION=add\0DEVNAME=/tmp/wolf-fake-udev/input/event23\0"
+                                          "MAJOR=13\0MINOR=87\0SUBSYSTEM=input\0"s);
+  REQUIRE(properties.size() == 5);
+  REQUIRE_THAT(properties["DEVNAME"], Equals("/tmp/wolf-fake-udev/input/event23"));
+  REQUIRE_THAT(properties["MINOR"], Equals("87"));
+
+  // Device nodes are only managed under /dev, unless told otherwise
+  REQUIRE(!sync_device_node(properties));
+  if (getuid() == 0) { // mknod() requires CAP_MKNOD
+    REQUIRE(sync_device_node(properties, "/tmp/wolf-fake-udev"));
+    REQUIRE(std::filesystem::is_character_file("/tmp/wolf-fake-udev/input/event23"));
+
+    properties["ACTION"] = "remove";
+    REQUIRE(sync_device_node(properties, "/tmp/wolf-fake-udev"));
+    REQUIRE(!std::filesystem::exists("/tmp/wolf-fake-udev/input/event23"));
+  }
+
+  // Events without a device node are left untouched
+  REQUIRE(sync_device_node(parse_udev_properties("ACTION=add\0SUBSYSTEM=input\0"s)));
+
+  // Only the device nodes that Wolf creates can be managed, with their expected major
+  REQUIRE(is_allowed_device_node("/dev/input/event23", INPUT_MAJOR));
+  REQUIRE(is_allowed_device_node("/dev/uhid", MISC_MAJOR));
+  REQUIRE(!is_allowed_device_node("/dev/input/event23", MISC_MAJOR));
+  REQUIRE(!is_allowed_device_node("/dev/input/../sda", INPUT_MAJOR));
+  REQUIRE(!is_allowed_device_node("/etc/passwd", INPUT_MAJOR));
+  REQUIRE_THROWS(sync_device_node(parse_udev_properties("ACTION=add\0DEVNAME=/dev/input/event23\0"
+                                                        "MAJOR=abc\0MINOR=87\0"s)));
+}
+
+TEST_CASE("Tags bloom filter", "[fake-udev]") {
+  auto seat = string_bloom64("seat");
+  auto uaccess = string_bloom64("uaccess");
+  REQUIRE(__builtin_popcountll(seat) <= 4);
+  REQUIRE(tags_bloom64("ACTION=add\0TAGS=:seat:uaccess:\0"s) == (seat | uaccess));
+  REQUIRE(tags_bloom64("ACTION=add\0SUBSYSTEM=input\0"s) == 0);
+
+  std::string msg = "ACTION=add\0SUBSYSTEM=input\0TAGS=:seat:uaccess:\0"s;
+  auto header_str = make_udev_header(msg, "input", "");
+  REQUIRE(header_str.size() == sizeof(monitor_netlink_header));
+  auto header = reinterpret_cast<const monitor_netlink_header *>(header_str.data());
+  // Same values as udevd, checked against the libudev in-kernel filter (see: udev_monitor_filter_add_match_tag)
+  REQUIRE(be32toh(header->filter_tag_bloom_hi) == 0x02082008);
+  REQUIRE(be32toh(header->filter_tag_bloom_lo) == 0x00401009);
+}
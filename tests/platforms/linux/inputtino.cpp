@@ -51,7 +51,7 @@ TEST_CASE("uinput - keyboard", "[UINPUT]") {
 }
 
 TEST_CASE("uinput - pen tablet", "[UINPUT]") {
-  auto session = state::StreamSession{.event_bus = std::make_shared<dp::event_bus>()};
+  auto session = state::StreamSession{.event_bus = std::make_shared<wolf::core::events::EventBus>()};
   auto packet = pkts::PEN_PACKET{.event_type = pkts::TOUCH_EVENT_HOVER,
                                  .tool_type = pkts::TOOL_TYPE_PEN,
                                  .pen_buttons = pkts::PEN_BUTTON_TYPE_PRIMARY,
@@ -126,7 +126,7 @@ TEST_CASE("uinput - pen tablet", "[UINPUT]") {
 }
 
 TEST_CASE("uinput - touch screen", "[UINPUT]") {
-  auto session = state::StreamSession{.event_bus = std::make_shared<dp::event_bus>()};
+  auto session = state::StreamSession{.event_bus = std::make_shared<wolf::core::events::EventBus>()};
 
   auto packet = pkts::TOUCH_PACKET{
       .event_type = pkts::TOUCH_EVENT_UP,
@@ -290,8 +290,8 @@ TEST_CASE("uinput - mouse", "[UINPUT]") {
 TEST_CASE("uinput - joypad", "[UINPUT]") {
   SECTION("OLD Moonlight: create joypad on first packet arrival") {
     state::App app = {.joypad_type = moonlight::control::pkts::CONTROLLER_TYPE::AUTO};
-    auto session =
-        state::StreamSession{.event_bus = std::make_shared<dp::event_bus>(), .app = std::make_shared<state::App>(app)};
+    auto session = state::StreamSession{.event_bus = std::make_shared<wolf::core::events::EventBus>(),
+                                        .app = std::make_shared<state::App>(app)};
     short controller_number = 1;
     auto c_pkt =
         pkts::CONTROLLER_MULTI_PACKET{.controller_number = controller_number, .button_flags = pkts::RIGHT_STICK};
@@ -306,8 +306,8 @@ TEST_CASE("uinput - joypad", "[UINPUT]") {
 
   SECTION("NEW Moonlight: create joypad with CONTROLLER_ARRIVAL") {
     state::App app = {.joypad_type = moonlight::control::pkts::CONTROLLER_TYPE::AUTO};
-    auto session =
-        state::StreamSession{.event_bus = std::make_shared<dp::event_bus>(), .app = std::make_shared<state::App>(app)};
+    auto session = state::StreamSession{.event_bus = std::make_shared<wolf::core::events::EventBus>(),
+                                        .app = std::make_shared<state::App>(app)};
     uint8_t controller_number = 1;
     auto c_pkt = pkts::CONTROLLER_ARRIVAL_PACKET{.controller_number = controller_number,
                                                  .controller_type = pkts::XBOX,
@@ -28,4 +28,19 @@ TEST_CASE("libpci get vendor", "[NVIDIA]") {
   REQUIRE(get_vendor("/dev/dri/renderD128") == NVIDIA);
   REQUIRE(get_vendor("/dev/dri/a_non_existing_thing") == UNKNOWN);
   REQUIRE(get_vendor("software") == UNKNOWN);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Hardware inventory", "[NVIDIA]") {
+  auto inventory = get_hardware_inventory();
+  REQUIRE(inventory->count("/dev/dri/renderD128") == 1);
+
+  auto gpu = inventory->at("/dev/dri/renderD128");
+  REQUIRE(gpu.vendor == NVIDIA);
+  REQUIRE(gpu.primary_node == "/dev/dri/card0");
+  REQUIRE(!gpu.pci_slot.empty());
+  REQUIRE_THAT(gpu.linked_devices, Equals(linked_devices("/dev/dri/renderD128")));
+
+  // Lookups are served from the inventory
+  REQUIRE_THAT(get_render_nodes(), Contains("/dev/dri/renderD128"));
+  REQUIRE(is_same_gpu_model("/dev/dri/renderD128", "/dev/dri/renderD128"));
+}
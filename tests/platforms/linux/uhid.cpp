@@ -16,7 +16,7 @@ using namespace std::string_literals;
 TEST_CASE("Create PS5 pad with CONTROLLER_ARRIVAL", "[UHID]") {
   state::App app = {.joypad_type = moonlight::control::pkts::CONTROLLER_TYPE::AUTO};
   auto session = state::StreamSession{
-      .event_bus = std::make_shared<dp::event_bus>(),
+      .event_bus = std::make_shared<wolf::core::events::EventBus>(),
       .app = std::make_shared<state::App>(app)};
   uint8_t controller_number = 1;
   auto c_pkt = pkts::CONTROLLER_ARRIVAL_PACKET{
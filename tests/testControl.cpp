@@ -3,7 +3,12 @@
 
 using Catch::Matchers::Equals;
 
+#include <chrono>
+#include <control/joypads-pool.hpp>
+#include <future>
 #include <moonlight/control.hpp>
+#include <streaming/congestion-control.hpp>
+#include <thread>
 using namespace moonlight::control;
 
 static std::string to_string(const ControlEncryptedPacket &packet) {
@@ -88,4 +93,156 @@ TEST_CASE("control joypad input packets") {
   REQUIRE(input_data->type == pkts::CONTROLLER_MULTI);
   REQUIRE(input_data->active_gamepad_mask == 1);
   REQUIRE(pressed_btns & pkts::CONTROLLER_BTN::A);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Congestion control", "CONTROL") {
+  using namespace std::chrono_literals;
+  auto settings = streaming::CongestionControlSettings{.min_bitrate_kbps = 2000,
+                                                       .max_bitrate_kbps = 20000,
+                                                       .packet_size = 1024};
+  streaming::CongestionController controller(1, 20000, settings);
+  auto now = std::chrono::steady_clock::now();
+
+  // Stats are accumulated, no decision is taken on a single report
+  REQUIRE_FALSE(controller.on_network_stats(100, 50ms, 10ms, 0, now));
+
+  // Heavy packet loss, the bitrate should go down
+  std::optional<int> bitrate;
+  for (int i = 0; i < 20 && !bitrate; i++) {
+    now += 50ms;
+    bitrate = controller.on_network_stats(100, 50ms, 10ms, 0, now);
+  }
+  REQUIRE(bitrate);
+  REQUIRE(*bitrate < 20000);
+  REQUIRE(*bitrate >= 2000);
+  auto lowered_bitrate = *bitrate;
+
+  // Once the network is good again, it'll slowly go up, never above the max
+  for (int i = 0; i < 400; i++) {
+    now += 50ms;
+    if (auto new_bitrate = controller.on_network_stats(0, 50ms, 10ms, 0, now)) {
+      REQUIRE(*new_bitrate > *bitrate);
+      bitrate = new_bitrate;
+    }
+  }
+  REQUIRE(*bitrate > lowered_bitrate);
+  REQUIRE(*bitrate <= 20000);
+
+  // Growing delay without packet loss is a sign of congestion too
+  std::optional<int> delayed_bitrate;
+  for (int i = 0; i < 20 && !delayed_bitrate; i++) {
+    now += 50ms;
+    delayed_bitrate = controller.on_network_stats(0, 50ms, 100ms, 0, now);
+  }
+  REQUIRE(delayed_bitrate);
+  REQUIRE(*delayed_bitrate < *bitrate);
+
+  auto stats = controller.get_stats();
+  REQUIRE(stats.bitrate_kbps == *delayed_bitrate);
+  REQUIRE(stats.decreases >= 2);
+  REQUIRE(stats.increases >= 1);
+
+  // Recent clients only report the IDR requests, without any lost packet count
+  std::optional<int> recovery_bitrate;
+  for (int i = 0; i < 20 && !recovery_bitrate; i++) {
+    now += 50ms;
+    recovery_bitrate = controller.on_network_stats(0, 50ms, 10ms, i == 0 ? 1 : 0, now);
+  }
+  REQUIRE(recovery_bitrate);
+  REQUIRE(*recovery_bitrate < *delayed_bitrate);
+  REQUIRE(controller.get_stats().last_recovery_requests == 1);
+}
+
+TEST_CASE("Congestion control after a permanent RTT change", "CONTROL") {
+  using namespace std::chrono_literals;
+  auto settings = streaming::CongestionControlSettings{.min_bitrate_kbps = 2000,
+                                                       .max_bitrate_kbps = 20000,
+                                                       .packet_size = 1024};
+  streaming::CongestionController controller(1, 10000, settings);
+  auto now = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < 100; i++) {
+    now += 50ms;
+    controller.on_network_stats(0, 50ms, 20ms, 0, now);
+  }
+  auto stable_bitrate = controller.get_stats().bitrate_kbps;
+
+  // The route changed: the RTT steps up and stays there, at first this looks like queues building up
+  for (int i = 0; i < 20; i++) {
+    now += 50ms;
+    controller.on_network_stats(0, 50ms, 80ms, 0, now);
+  }
+  auto delayed_bitrate = controller.get_stats().bitrate_kbps;
+  REQUIRE(delayed_bitrate < stable_bitrate);
+
+  // Once the old samples are out of the window the new RTT is the baseline and the bitrate can go up again
+  for (int i = 0; i < 800; i++) {
+    now += 50ms;
+    controller.on_network_stats(0, 50ms, 80ms, 0, now);
+  }
+  auto stats = controller.get_stats();
+  REQUIRE(stats.bitrate_kbps > delayed_bitrate);
+  REQUIRE(stats.bitrate_kbps > settings.min_bitrate_kbps);
+  REQUIRE(stats.increases >= 1);
+}
+
+TEST_CASE("Joypads pool", "CONTROL") {
+  using namespace moonlight::control::pkts;
+  std::atomic<int> created = 0;
+  auto pool = std::make_shared<control::JoypadsPool<int>>(2, std::vector<CONTROLLER_TYPE>{XBOX, PS}, [&](auto type) {
+    created++;
+    return std::make_shared<int>(type);
+  });
+
+  auto wait_for_refill = [&]() {
+    for (int i = 0; i < 100 && (pool->available(XBOX) < 2 || pool->available(PS) < 2); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  };
+
+  // Nothing has been created yet
+  REQUIRE(pool->claim(NINTENDO) == nullptr);
+  wait_for_refill();
+  REQUIRE(pool->available(XBOX) == 2);
+  REQUIRE(pool->available(PS) == 2);
+  REQUIRE(pool->available(NINTENDO) == 0);
+  REQUIRE(created == 4);
+
+  auto pad = pool->claim(PS);
+  REQUIRE(pad);
+  REQUIRE(*pad == PS);
+  wait_for_refill();
+  REQUIRE(pool->available(PS) == 2);
+  REQUIRE(created == 5);
+
+  REQUIRE(pool->claim(NINTENDO) == nullptr);
+}
+
+TEST_CASE("Joypads pool claimed while refilling", "CONTROL") {
+  using namespace moonlight::control::pkts;
+  std::promise<void> unblock;
+  auto unblocked = unblock.get_future().share();
+  std::atomic<bool> creating_ps = false;
+  auto pool = std::make_shared<control::JoypadsPool<int>>(1, std::vector<CONTROLLER_TYPE>{XBOX, PS}, [&](auto type) {
+    if (type == PS) {
+      creating_ps = true;
+      unblocked.wait();
+    }
+    return std::make_shared<int>(type);
+  });
+
+  pool->refill();
+  for (int i = 0; i < 100 && !creating_ps; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  REQUIRE(creating_ps);
+
+  // The refill is past XBOX already, the claimed pad has to be replaced anyway
+  REQUIRE(pool->claim(XBOX));
+  unblock.set_value();
+  for (int i = 0; i < 100 && (pool->available(XBOX) < 1 || pool->available(PS) < 1); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  REQUIRE(pool->available(XBOX) == 1);
+  REQUIRE(pool->available(PS) == 1);
+}
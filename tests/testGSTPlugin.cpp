@@ -6,10 +6,17 @@
 
 using Catch::Matchers::Equals;
 
+#include <boost/asio.hpp>
+#include <core/gstreamer.hpp>
 #include <gst-plugin/audio.hpp>
 #include <gst-plugin/video.hpp>
 #include <moonlight/fec.hpp>
+#include <optional>
+#include <rtp/udp-ping.hpp>
+#include <streaming/encoder-benchmark.hpp>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -495,3 +502,177 @@ TEST_CASE_METHOD(GStreamerTestsFixture, "Audio RTP packet creation", "[GSTPlugin
     g_object_unref(rtpmoonlightpay);
   }
 }
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Live video reconfiguration", "[GSTPlugin]") {
+  auto pipeline = gst_parse_launch("videotestsrc ! "
+                                   "capsfilter name=scale "
+                                   "caps=\"video/x-raw, width=640, height=480, framerate=30/1\" ! "
+                                   "capsfilter caps=\"video/x-raw, format=I420\" ! "
+                                   "fakesink",
+                                   nullptr);
+  REQUIRE(pipeline);
+
+  // Only the capsfilter that sets the resolution should be changed
+  REQUIRE(wolf::core::gstreamer::set_video_resolution(pipeline, 1920, 1080, 60) == 1);
+
+  auto scale = gst_bin_get_by_name(GST_BIN(pipeline), "scale");
+  GstCaps *caps = nullptr;
+  g_object_get(scale, "caps", &caps, NULL);
+  auto structure = gst_caps_get_structure(caps, 0);
+  int width, height, fps_n, fps_d;
+  REQUIRE(gst_structure_get_int(structure, "width", &width));
+  REQUIRE(gst_structure_get_int(structure, "height", &height));
+  REQUIRE(gst_structure_get_fraction(structure, "framerate", &fps_n, &fps_d));
+  REQUIRE(width == 1920);
+  REQUIRE(height == 1080);
+  REQUIRE(fps_n == 60);
+  REQUIRE(fps_d == 1);
+  gst_caps_unref(caps);
+  gst_object_unref(scale);
+
+  // There's no encoder in this pipeline
+  REQUIRE(wolf::core::gstreamer::set_video_bitrate(pipeline, 5000) == 0);
+
+  gst_object_unref(pipeline);
+}
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Live bitrate changes", "[GSTPlugin]") {
+  auto pipeline = gst_parse_launch("videotestsrc ! x264enc name=encoder bitrate=3000 vbv-buf-capacity=600 ! fakesink",
+                                   nullptr);
+  REQUIRE(pipeline);
+  auto encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+
+  // Only the property that has been set to the configured bitrate will be changed
+  wolf::core::gstreamer::track_video_bitrate(pipeline, 3000);
+  REQUIRE(std::string(static_cast<const char *>(
+              g_object_get_data(G_OBJECT(encoder), wolf::core::gstreamer::VIDEO_BITRATE_PROP_KEY))) == "bitrate");
+
+  REQUIRE(wolf::core::gstreamer::set_video_bitrate(pipeline, 5000) == 1);
+  guint bitrate = 0, vbv_buf_capacity = 0;
+  g_object_get(encoder, "bitrate", &bitrate, "vbv-buf-capacity", &vbv_buf_capacity, NULL);
+  REQUIRE(bitrate == 5000);
+  REQUIRE(vbv_buf_capacity == 600);
+
+  gst_object_unref(encoder);
+  gst_object_unref(pipeline);
+}
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Pipelines run on their own main context", "[GSTPlugin]") {
+  using handlers_t = immer::array<immer::box<wolf::core::events::handler_registration>>;
+  constexpr int n_pipelines = 3;
+  std::array<bool, n_pipelines> own_context = {};
+  std::array<bool, n_pipelines> results = {};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n_pipelines; i++) {
+    threads.emplace_back([&own_context, &results, i]() {
+      results[i] = wolf::core::gstreamer::run_pipeline("videotestsrc num-buffers=5 ! fakesink sync=false",
+                                                       [&own_context, i](auto pipeline, auto loop) {
+                                                         auto context = g_main_loop_get_context(loop.get());
+                                                         auto is_default = context == g_main_context_default();
+                                                         auto is_thread_default =
+                                                             context == g_main_context_get_thread_default();
+                                                         own_context[i] = !is_default && is_thread_default;
+                                                         return handlers_t{};
+                                                       });
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Each pipeline quits its own loop on EOS without going through the default context
+  for (int i = 0; i < n_pipelines; i++) {
+    REQUIRE(results[i]);
+    REQUIRE(own_context[i]);
+  }
+}
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Paused pipelines don't steal the resume PING", "[GSTPlugin]") {
+  using boost::asio::ip::udp;
+  constexpr unsigned short host_port = 48100;
+  constexpr unsigned short client_port = 48101;
+  auto localhost = boost::asio::ip::make_address("127.0.0.1");
+
+  boost::asio::io_context io_context;
+  std::optional<unsigned short> ping_from;
+  auto listener = std::make_shared<rtp::PingListener>(
+      io_context,
+      host_port,
+      1,
+      [&ping_from](unsigned short host_port, unsigned short client_port, const std::string &client_ip) {
+        ping_from = client_port;
+      });
+  listener->start();
+
+  // The session pipeline binds its sink on the same leased host port as the listener
+  auto pipeline_desc = fmt::format("audiotestsrc is-live=true ! "
+                                   "udpsink bind-port={} host=127.0.0.1 port={} sync=false",
+                                   host_port,
+                                   client_port);
+  auto pipeline = gst_parse_launch(pipeline_desc.c_str(), nullptr);
+  REQUIRE(pipeline);
+  REQUIRE(gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+  REQUIRE(gst_element_get_state(pipeline, nullptr, nullptr, 5 * GST_SECOND) != GST_STATE_CHANGE_FAILURE);
+
+  // Pause it like warm_pause::store() does
+  REQUIRE(gst_element_set_state(pipeline, GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE);
+  wolf::core::gstreamer::release_udp_sinks(pipeline);
+
+  // Before resuming the client sends a PING to the host port, it has to reach the listener
+  udp::socket client(io_context, udp::endpoint(udp::v4(), client_port));
+  listener->expect(host_port, "127.0.0.1");
+  client.send_to(boost::asio::buffer("PING", 4), udp::endpoint(localhost, host_port));
+  io_context.run_one_for(std::chrono::seconds(2));
+  REQUIRE(ping_from == client_port);
+
+  // On resume the sink binds the host port again and streams to the client
+  wolf::core::gstreamer::restore_udp_sinks(pipeline, "127.0.0.1", client_port);
+  REQUIRE(gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+
+  std::array<char, 2048> packet = {};
+  udp::endpoint sender;
+  std::optional<std::size_t> received;
+  client.async_receive_from(boost::asio::buffer(packet),
+                            sender,
+                            [&received](const boost::system::error_code &ec, std::size_t size) {
+                              if (!ec) {
+                                received = size;
+                              }
+                            });
+  io_context.restart();
+  io_context.run_one_for(std::chrono::seconds(2));
+  REQUIRE(received.has_value());
+  REQUIRE(sender.port() == host_port);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+}
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Preload pipelines", "[GSTPlugin]") {
+  REQUIRE(!wolf::core::gstreamer::preload_pipeline("videotestsrc ! videoconvert ! fakesink").has_value());
+
+  auto missing = wolf::core::gstreamer::preload_pipeline("videotestsrc ! not_an_element ! fakesink");
+  REQUIRE(missing.has_value());
+  REQUIRE_THAT(*missing, Catch::Matchers::ContainsSubstring("not_an_element"));
+
+  REQUIRE(wolf::core::gstreamer::preload_pipeline("videotestsrc ! ! fakesink").has_value());
+}
+
+TEST_CASE_METHOD(GStreamerTestsFixture, "Encoder benchmark", "[GSTPlugin]") {
+  auto result = streaming::benchmark_encoder("videoconvert ! video/x-raw, format=I420",
+                                             "x264enc bitrate={bitrate} tune=zerolatency speed-preset=superfast",
+                                             {.width = 320, .height = 240, .refreshRate = 30},
+                                             "/dev/dri/renderD128",
+                                             30);
+  REQUIRE(result.has_value());
+  REQUIRE(result->frames == 30);
+  REQUIRE(result->avg_latency_ms > 0);
+  REQUIRE(result->max_latency_ms >= result->avg_latency_ms);
+
+  REQUIRE(!streaming::benchmark_encoder("videoconvert", "not_an_encoder", {320, 240, 30}, "", 30).has_value());
+
+  // All the placeholders of a session are available, an unknown one will just fail the benchmark
+  auto render_node_template = "videoconvert ! video/x-raw, format=I420 ! identity name={render_node}";
+  REQUIRE(streaming::benchmark_encoder(render_node_template, "x264enc", {320, 240, 30}, "renderD128", 30).has_value());
+  REQUIRE(!streaming::benchmark_encoder("videoconvert", "x264enc {unknown}", {320, 240, 30}, "", 30).has_value());
+}
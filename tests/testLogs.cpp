@@ -0,0 +1,173 @@
+#include <catch2/catch_test_macros.hpp>
+#include <condition_variable>
+#include <helpers/logger.hpp>
+#include <helpers/ring_buffer.hpp>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+static std::string count_evaluation(int &evaluations) {
+  evaluations++;
+  return "evaluated";
+}
+
+TEST_CASE("Lazy log arguments", "[LOGS]") {
+  auto previous_level = logs::runtime_min_level.load();
+  int evaluations = 0;
+
+  SECTION("Below the runtime level") {
+    logs::runtime_min_level = logs::info;
+    WOLF_LOG(logs::debug, "{}", count_evaluation(evaluations));
+    REQUIRE(evaluations == 0);
+
+    WOLF_LOG(logs::warning, "{}", count_evaluation(evaluations));
+    REQUIRE(evaluations == 1);
+  }
+
+  SECTION("Below the compile time level") {
+    logs::runtime_min_level = logs::trace;
+#pragma push_macro("WOLF_LOG_COMPILE_MIN_LEVEL")
+#undef WOLF_LOG_COMPILE_MIN_LEVEL
+#define WOLF_LOG_COMPILE_MIN_LEVEL 2 // info
+    WOLF_LOG(logs::debug, "{}", count_evaluation(evaluations));
+    REQUIRE(evaluations == 0);
+
+    WOLF_LOG(logs::info, "{}", count_evaluation(evaluations));
+    REQUIRE(evaluations == 1);
+#pragma pop_macro("WOLF_LOG_COMPILE_MIN_LEVEL")
+  }
+
+  logs::runtime_min_level = previous_level;
+}
+
+TEST_CASE("SPSCRingBuffer", "[LOGS]") {
+  SPSCRingBuffer<int, 4> ring;
+  REQUIRE(ring.empty());
+  REQUIRE(!ring.pop());
+
+  SECTION("Full and empty") {
+    for (int i = 0; i < 4; i++) {
+      REQUIRE(ring.push(int(i)));
+    }
+    REQUIRE(!ring.push(4));
+    REQUIRE(!ring.empty());
+
+    for (int i = 0; i < 4; i++) {
+      REQUIRE(ring.pop() == i);
+    }
+    REQUIRE(!ring.pop());
+    REQUIRE(ring.empty());
+  }
+
+  SECTION("Wrap around") {
+    int pushed = 0, popped = 0;
+    for (int cycle = 0; cycle < 10; cycle++) {
+      // Filling the buffer and popping 2 every time moves the head and tail across the end of the buffer
+      while (ring.push(int(pushed))) {
+        pushed++;
+      }
+      REQUIRE(pushed - popped == 4);
+      for (int i = 0; i < 2; i++) {
+        REQUIRE(ring.pop() == popped++);
+      }
+    }
+    while (auto item = ring.pop()) {
+      REQUIRE(*item == popped++);
+    }
+    REQUIRE(popped == pushed);
+    REQUIRE(ring.empty());
+  }
+}
+
+/**
+ * A stream buffer that blocks the writer thread on the first write until release() is called
+ */
+class blocking_buf : public std::stringbuf {
+public:
+  void wait_blocked() {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [this]() { return blocked; });
+  }
+
+  void release() {
+    std::lock_guard lock(mutex);
+    released = true;
+    cv.notify_all();
+  }
+
+protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    {
+      std::unique_lock lock(mutex);
+      blocked = true;
+      cv.notify_all();
+      cv.wait(lock, [this]() { return released; });
+    }
+    return std::stringbuf::xsputn(s, n);
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool blocked = false;
+  bool released = false;
+};
+
+static logs::log_record make_record(const std::string &msg) {
+  return {.lvl = logs::info, .time = std::chrono::system_clock::now(), .msg = msg};
+}
+
+TEST_CASE("Async log writer", "[LOGS]") {
+  SECTION("Flush ordering") {
+    std::ostringstream out;
+    logs::async_writer writer(out);
+    writer.push(make_record("first"));
+    writer.push(make_record("second"));
+    writer.push(make_record("third"));
+    writer.flush(std::chrono::seconds(5));
+
+    auto written = out.str();
+    auto first = written.find("first"), second = written.find("second"), third = written.find("third");
+    REQUIRE(first != std::string::npos);
+    REQUIRE(second != std::string::npos);
+    REQUIRE(third != std::string::npos);
+    REQUIRE(first < second);
+    REQUIRE(second < third);
+    REQUIRE(writer.dropped_messages() == 0);
+  }
+
+  SECTION("Drop counter") {
+    blocking_buf buf;
+    std::ostream out(&buf);
+    logs::async_writer writer(out);
+
+    // The writer thread pops this and then blocks while writing it, leaving the ring empty
+    writer.push(make_record("blocking"));
+    buf.wait_blocked();
+
+    for (std::size_t i = 0; i < logs::async_writer::RING_SIZE + 10; i++) {
+      writer.push(make_record(fmt::format("message {}", i)));
+    }
+    REQUIRE(writer.dropped_messages() == 10);
+
+    buf.release();
+    writer.flush(std::chrono::seconds(5));
+    auto written = buf.str();
+    REQUIRE(written.find(fmt::format("message {}", logs::async_writer::RING_SIZE - 1)) != std::string::npos);
+    REQUIRE(written.find(fmt::format("message {}", logs::async_writer::RING_SIZE)) == std::string::npos);
+    REQUIRE(written.find("dropped 10 messages") != std::string::npos);
+  }
+
+  SECTION("Drained on destruction") {
+    std::ostringstream out;
+    {
+      logs::async_writer writer(out);
+      for (int i = 0; i < 100; i++) {
+        writer.push(make_record(fmt::format("message {}", i)));
+      }
+    }
+    auto written = out.str();
+    REQUIRE(written.find("message 0") != std::string::npos);
+    REQUIRE(written.find("message 99") != std::string::npos);
+  }
+}
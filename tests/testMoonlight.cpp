@@ -6,11 +6,14 @@
 
 using Catch::Matchers::Equals;
 
+#include <control/control.hpp>
 #include <crypto/crypto.hpp>
 #include <moonlight/protocol.hpp>
 #include <range/v3/view.hpp>
 #include <rest/helpers.hpp>
 #include <state/config.hpp>
+#include <state/gpu-scheduler.hpp>
+#include <state/sessions.hpp>
 #include <streaming/streaming.hpp>
 
 using namespace moonlight;
@@ -18,7 +21,7 @@ using namespace state;
 using namespace ranges;
 
 TEST_CASE("LocalState load TOML", "[LocalState]") {
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   auto state = state::load_or_default("config.v2.toml", event_bus);
   REQUIRE(state.hostname == "Wolf");
   REQUIRE(state.uuid == "0000-1111-2222-3333");
@@ -62,7 +65,7 @@ TEST_CASE("LocalState load TOML", "[LocalState]") {
 }
 
 TEST_CASE("LocalState pairing information", "[LocalState]") {
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   auto clients_atom = new immer::atom<state::PairedClientList>();
   auto cfg = state::Config{.config_source = "config.v2.toml", .paired_clients = *clients_atom};
   auto a_client_cert = "-----BEGIN CERTIFICATE-----\n"
@@ -123,7 +126,7 @@ TEST_CASE("LocalState pairing information", "[LocalState]") {
 }
 
 TEST_CASE("Mocked serverinfo", "[MoonlightProtocol]") {
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   auto cfg = state::load_or_default("config.v2.toml", event_bus);
   immer::array<DisplayMode> displayModes = {{1920, 1080, 60}, {1024, 768, 30}};
 
@@ -327,7 +330,7 @@ TEST_CASE("Pairing moonlight", "[MoonlightProtocol]") {
 }
 
 TEST_CASE("applist", "[MoonlightProtocol]") {
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   auto cfg = state::load_or_default("config.v2.toml", event_bus);
   auto base_apps = cfg.apps | views::transform([](auto app) { return app.base; }) | to<immer::vector<moonlight::App>>();
   auto result = applist(base_apps);
@@ -339,7 +342,7 @@ TEST_CASE("applist", "[MoonlightProtocol]") {
 }
 
 TEST_CASE("launch", "[MoonlightProtocol]") {
-  auto event_bus = std::make_shared<dp::event_bus>();
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
   auto cfg = state::load_or_default("config.v2.toml", event_bus);
   auto result = launch_success("192.168.1.1", "3021");
   REQUIRE(xml_to_str(result) == "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
@@ -348,3 +351,124 @@ TEST_CASE("launch", "[MoonlightProtocol]") {
                                 "<gamesession>1</gamesession>"
                                 "</root>");
 }
+
+TEST_CASE("Session scoped events", "[EventBus]") {
+  auto event_bus = std::make_shared<wolf::core::events::EventBus>();
+  int session_1_calls = 0, session_2_calls = 0, global_calls = 0;
+
+  auto session_1 = event_bus->register_session_handler<immer::box<control::StopStreamEvent>>(
+      1,
+      [&session_1_calls](const immer::box<control::StopStreamEvent> &ev) {
+        REQUIRE(ev->session_id == 1);
+        session_1_calls++;
+      });
+  auto session_2 = event_bus->register_session_handler<immer::box<control::StopStreamEvent>>(
+      2,
+      [&session_2_calls](const immer::box<control::StopStreamEvent> &ev) { session_2_calls++; });
+  auto global = event_bus->register_handler<immer::box<control::StopStreamEvent>>(
+      [&global_calls](const immer::box<control::StopStreamEvent> &ev) { global_calls++; });
+
+  event_bus->fire_event(immer::box<control::StopStreamEvent>(control::StopStreamEvent{.session_id = 1}));
+  REQUIRE(session_1_calls == 1);
+  REQUIRE(session_2_calls == 0);
+  REQUIRE(global_calls == 1);
+
+  session_1.unregister();
+  event_bus->fire_event(immer::box<control::StopStreamEvent>(control::StopStreamEvent{.session_id = 1}));
+  event_bus->fire_event(immer::box<control::StopStreamEvent>(control::StopStreamEvent{.session_id = 2}));
+  REQUIRE(session_1_calls == 1);
+  REQUIRE(session_2_calls == 1);
+  REQUIRE(global_calls == 3);
+
+  session_2.unregister();
+  global.unregister();
+}
+
+TEST_CASE("Port leases", "[LocalState]") {
+  auto leases = std::make_shared<immer::atom<immer::map<std::size_t, unsigned short>>>();
+
+  auto first = lease_ports(leases, 1).value();
+  REQUIRE(first.video == state::VIDEO_PING_PORT);
+  REQUIRE(first.audio == state::AUDIO_PING_PORT);
+
+  auto second = lease_ports(leases, 2).value();
+  REQUIRE(second.video == state::VIDEO_PING_PORT + 1);
+  REQUIRE(second.audio == state::AUDIO_PING_PORT + 1);
+
+  // Leasing again for the same session returns the same ports
+  REQUIRE(lease_ports(leases, 1).value().video == first.video);
+
+  // Sessions might end out of order, released ports will be re-used
+  release_ports(leases, 1);
+  auto third = lease_ports(leases, 3).value();
+  REQUIRE(third.video == state::VIDEO_PING_PORT);
+  REQUIRE(third.audio == state::AUDIO_PING_PORT);
+
+  for (std::size_t session_id = 4; session_id < 2 + state::MAX_PING_PORTS; session_id++) {
+    REQUIRE(lease_ports(leases, session_id).has_value());
+  }
+  REQUIRE(!lease_ports(leases, 1000).has_value());
+}
+
+TEST_CASE("Spectator sessions", "[LocalState]") {
+  auto app = std::make_shared<state::App>(state::App{.base = {.title = "Test", .id = "1"}, .allow_spectators = true});
+  auto host = state::StreamSession{.app = app, .session_id = 1};
+  auto other = state::StreamSession{.app = std::make_shared<state::App>(state::App{.base = {.id = "2"}}),
+                                    .session_id = 2};
+  auto spectator = state::StreamSession{.app = app, .session_id = 3, .host_session_id = 1};
+  auto sessions = immer::vector<state::StreamSession>{spectator, other, host};
+
+  // Spectators are never returned as the host of an app
+  REQUIRE(get_host_session_by_app(sessions, "1")->session_id == host.session_id);
+  REQUIRE(get_host_session_by_app(sessions, "2")->session_id == other.session_id);
+  REQUIRE(!get_host_session_by_app(sessions, "3").has_value());
+
+  auto spectators = get_spectators(sessions, host.session_id);
+  REQUIRE(spectators.size() == 1);
+  REQUIRE(spectators[0].session_id == spectator.session_id);
+  REQUIRE(get_spectators(sessions, other.session_id).empty());
+
+  // Input is allowed by default, it has to be explicitly revoked for spectators
+  REQUIRE(host.input_allowed->load());
+}
+
+TEST_CASE("GPU scheduler", "[LocalState]") {
+  SECTION("Engines utilization") {
+    std::map<std::string, std::uint64_t> before = {{"render", 1'000'000}, {"video", 0}};
+    std::map<std::string, std::uint64_t> after = {{"render", 26'000'000}, {"video", 50'000'000}, {"copy", 5'000'000}};
+    REQUIRE(engines_utilization(before, after, 100ms) == 0.5);
+    // A client that exited in between will make the counters go backwards
+    REQUIRE(engines_utilization(after, before, 100ms) == 0);
+    // Engines with more than one instance can report more busy time than the elapsed time
+    REQUIRE(engines_utilization({}, {{"render", 200'000'000}}, 100ms) == 1);
+  }
+
+  SECTION("Least loaded render node") {
+    REQUIRE(least_loaded_render_node({{"/dev/dri/renderD128", 1, 0.1}, {"/dev/dri/renderD129", 0, 0.9}}) ==
+            "/dev/dri/renderD129");
+    REQUIRE(least_loaded_render_node({{"/dev/dri/renderD128", 1, 0.9}, {"/dev/dri/renderD129", 1, 0.2}}) ==
+            "/dev/dri/renderD129");
+    REQUIRE(least_loaded_render_node({{"/dev/dri/renderD128", 0, 0}, {"/dev/dri/renderD129", 0, 0}}) ==
+            "/dev/dri/renderD128");
+  }
+
+  SECTION("Render nodes load") {
+    auto app = std::make_shared<state::App>(state::App{.base = {.id = "1"}, .render_node = "/dev/dri/renderD129"});
+    auto host = state::StreamSession{.app = app, .session_id = 1};
+    auto spectator = state::StreamSession{.app = app, .session_id = 2, .host_session_id = 1};
+    auto utilization = immer::map<std::string, double>{}.set("/dev/dri/renderD128", 0.4);
+
+    auto loads = get_render_nodes_load({host, spectator}, {"/dev/dri/renderD128", "/dev/dri/renderD129"}, utilization);
+    REQUIRE(loads.size() == 2);
+    REQUIRE(loads[0].sessions == 0);
+    REQUIRE(loads[0].utilization == 0.4);
+    // Spectators don't add to the load, GPUs without usage stats are reported as idle
+    REQUIRE(loads[1].sessions == 1);
+    REQUIRE(loads[1].utilization == 0);
+  }
+
+  SECTION("Apps without scheduling are never moved") {
+    auto app = state::App{.base = {.id = "1"}, .render_node = "/dev/dri/renderD129"};
+    REQUIRE(schedule_render_node({}, app) == "/dev/dri/renderD129");
+  }
+}
@@ -23,7 +23,7 @@ public:
   static auto create_client(asio::io_context &io_context,
                             int port,
                             const state::SessionsAtoms state,
-                            const std::shared_ptr<dp::event_bus> event_bus) {
+                            const std::shared_ptr<wolf::core::events::EventBus> event_bus) {
     auto tester = new tcp_tester(io_context, state, event_bus);
 
     tcp::resolver resolver(io_context);
@@ -54,7 +54,7 @@ public:
 protected:
   explicit tcp_tester(asio::io_context &io_context,
                       const state::SessionsAtoms state,
-                      const std::shared_ptr<dp::event_bus> event_bus)
+                      const std::shared_ptr<wolf::core::events::EventBus> event_bus)
       : tcp_connection(io_context, state, event_bus), ioc(io_context) {}
 
   boost::asio::io_context &ioc;
@@ -262,6 +262,8 @@ state::SessionsAtoms test_init_state() {
       .aes_iv = crypto::hex_to_str("01234567890", true),
       .session_id = 1234,
       .ip = "127.0.0.1",
+      .video_port = state::VIDEO_PING_PORT,
+      .audio_port = state::AUDIO_PING_PORT,
   };
   return std::make_shared<immer::atom<immer::vector<StreamSession>>>(immer::vector<StreamSession>{session});
 }
@@ -270,7 +272,7 @@ TEST_CASE("Commands", "[RTSP]") {
   constexpr int port = 8080;
   boost::asio::io_context ioc;
   auto state = test_init_state();
-  auto ev_bus = std::make_shared<dp::event_bus>();
+  auto ev_bus = std::make_shared<wolf::core::events::EventBus>();
   auto wolf_server = tcp_server(ioc, port, state, ev_bus);
   auto wolf_client = tcp_tester::create_client(ioc, port, state, ev_bus);
 